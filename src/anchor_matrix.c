@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+#include "anchor_matrix.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "framedistance.h"
+
+#define ANCHOR_ALIGN 64
+#define ANCHOR_INITIAL_SLOTS 16
+
+int anchor_matrix_init(AnchorMatrix *m, long nelem, FrameDType dtype, int max_capacity) {
+    memset(m, 0, sizeof(AnchorMatrix));
+    if (nelem <= 0 || max_capacity <= 0) return -1;
+
+    m->nelem = nelem;
+    m->dtype = dtype;
+    m->max_capacity = max_capacity;
+    size_t row = (size_t)nelem * frame_dtype_size(dtype);
+    m->slot_bytes = (row + ANCHOR_ALIGN - 1) & ~(size_t)(ANCHOR_ALIGN - 1);
+    m->free_slots = (int *)malloc(max_capacity * sizeof(int));
+    if (!m->free_slots) return -1;
+    return 0;
+}
+
+int anchor_matrix_spill(AnchorMatrix *m, const char *path) {
+    if (m->data || m->spilled) return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("Failed to create anchor spill file");
+        return -1;
+    }
+    // The mapping keeps the file alive; nothing is left behind on exit
+    unlink(path);
+    m->spill_fd = fd;
+    m->spilled = 1;
+    return 0;
+}
+
+// Extend the spill file to bytes and map it whole. The old mapping is
+// dropped: rows live in the file, so nothing is copied.
+static unsigned char *spill_remap(AnchorMatrix *m, size_t bytes) {
+    int rc = posix_fallocate(m->spill_fd, 0, (off_t)bytes);
+    if (rc != 0) {
+        errno = rc;
+        return NULL;
+    }
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m->spill_fd, 0);
+    if (p == MAP_FAILED) return NULL;
+    if (m->data) munmap(m->data, (size_t)m->capacity * m->slot_bytes);
+    return (unsigned char *)p;
+}
+
+static int anchor_matrix_grow(AnchorMatrix *m) {
+    if (m->capacity >= m->max_capacity) return -1;
+    int new_capacity = (m->capacity == 0) ? ANCHOR_INITIAL_SLOTS : m->capacity * 2;
+    if (new_capacity > m->max_capacity) new_capacity = m->max_capacity;
+
+    double *new_norm2 = (double *)realloc(m->norm2, new_capacity * sizeof(double));
+    if (new_norm2) m->norm2 = new_norm2;
+    if (m->spilled) {
+        unsigned char *new_data = new_norm2 ? spill_remap(m, (size_t)new_capacity * m->slot_bytes) : NULL;
+        if (!new_data) {
+            perror("Failed to grow anchor spill file");
+            return -1;
+        }
+        m->data = new_data;
+        m->capacity = new_capacity;
+        return 0;
+    }
+
+    unsigned char *new_data = (unsigned char *)aligned_alloc(ANCHOR_ALIGN, (size_t)new_capacity * m->slot_bytes);
+    if (!new_data || !new_norm2) {
+        free(new_data);
+        perror("Failed to grow anchor matrix");
+        return -1;
+    }
+    if (m->data) {
+        memcpy(new_data, m->data, (size_t)m->used * m->slot_bytes);
+        free(m->data);
+    }
+    m->data = new_data;
+    m->norm2 = new_norm2;
+    m->capacity = new_capacity;
+    return 0;
+}
+
+int anchor_matrix_store(AnchorMatrix *m, const Frame *src) {
+    if (src->width * src->height != m->nelem || src->dtype != m->dtype) return -1;
+
+    int slot;
+    if (m->num_free > 0) {
+        slot = m->free_slots[--m->num_free];
+    } else {
+        if (m->used >= m->capacity && anchor_matrix_grow(m) != 0) return -1;
+        slot = m->used++;
+    }
+
+    unsigned char *row = (unsigned char *)anchor_matrix_row(m, slot);
+    size_t row_bytes = (size_t)m->nelem * frame_dtype_size(m->dtype);
+    memcpy(row, src->data, row_bytes);
+    memset(row + row_bytes, 0, m->slot_bytes - row_bytes);
+    m->norm2[slot] = framedist_norm2(src);
+    return slot;
+}
+
+void anchor_matrix_release(AnchorMatrix *m, int slot) {
+    if (slot < 0 || slot >= m->used) return;
+    m->free_slots[m->num_free++] = slot;
+}
+
+void anchor_matrix_free(AnchorMatrix *m) {
+    if (m->spilled) {
+        if (m->data) munmap(m->data, (size_t)m->capacity * m->slot_bytes);
+        close(m->spill_fd);
+    } else {
+        free(m->data);
+    }
+    free(m->norm2);
+    free(m->free_slots);
+    memset(m, 0, sizeof(AnchorMatrix));
+}
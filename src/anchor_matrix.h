@@ -0,0 +1,48 @@
+#ifndef ANCHOR_MATRIX_H
+#define ANCHOR_MATRIX_H
+
+#include <stddef.h>
+#include "common.h"
+
+// Cluster anchors stored as rows of one contiguous, 64-byte aligned matrix.
+// Each anchor occupies a slot; slots released by removed clusters are reused.
+// With a spill file the matrix is a shared mapping of that file instead of
+// heap memory, so the kernel can page rows out under memory pressure.
+typedef struct {
+    unsigned char *data; // capacity * slot_bytes
+    double *norm2;       // ||anchor||^2 per slot
+    int *free_slots;     // Stack of released slots
+    int num_free;
+    int capacity;
+    int max_capacity;
+    int used;            // Slots handed out so far (high-water mark)
+    long nelem;
+    FrameDType dtype;
+    size_t slot_bytes;   // Row stride, multiple of 64
+    int spilled;         // data maps spill_fd
+    int spill_fd;        // Unlinked spill file
+} AnchorMatrix;
+
+// Prepare an empty matrix for nelem-element anchors of the given dtype.
+// Storage grows on demand up to max_capacity slots. Returns 0 on success.
+int anchor_matrix_init(AnchorMatrix *m, long nelem, FrameDType dtype, int max_capacity);
+
+// Back the matrix with a memory-mapped file created at path (and unlinked
+// right away). Call before the first anchor_matrix_store(). Returns 0 on success.
+int anchor_matrix_spill(AnchorMatrix *m, const char *path);
+
+// Copy src pixels into a free slot. Returns the slot index, or -1 when the
+// matrix is full or src does not match its size/dtype. Growing the matrix
+// moves it: callers must refresh anchor pointers with anchor_matrix_row().
+int anchor_matrix_store(AnchorMatrix *m, const Frame *src);
+
+// Return a slot to the free list
+void anchor_matrix_release(AnchorMatrix *m, int slot);
+
+static inline void *anchor_matrix_row(const AnchorMatrix *m, int slot) {
+    return m->data + (size_t)slot * m->slot_bytes;
+}
+
+void anchor_matrix_free(AnchorMatrix *m);
+
+#endif // ANCHOR_MATRIX_H
@@ -0,0 +1,47 @@
+#include "cand_mask.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int cand_mask_init(CandMask *m, int capacity) {
+    memset(m, 0, sizeof(CandMask));
+    if (capacity <= 0) return -1;
+    m->bits = (uint64_t *)calloc((capacity + 63) / 64, sizeof(uint64_t));
+    if (!m->bits) {
+        perror("Memory allocation failed for candidate mask");
+        return -1;
+    }
+    m->capacity = capacity;
+    return 0;
+}
+
+void cand_mask_fill(CandMask *m, int n) {
+    if (n > m->capacity) n = m->capacity;
+    if (n < 0) n = 0;
+    int nwords = (n + 63) / 64;
+    int full = n / 64;
+    for (int w = 0; w < full; w++) m->bits[w] = ~(uint64_t)0;
+    if (full < nwords) m->bits[full] = ((uint64_t)1 << (n & 63)) - 1;
+    // Words left over from a frame with more clusters
+    for (int w = nwords; w < m->nwords; w++) m->bits[w] = 0;
+    m->n = n;
+    m->nwords = nwords;
+    m->count = n;
+}
+
+void cand_mask_recount(CandMask *m) {
+    int count = 0;
+    for (int w = 0; w < m->nwords; w++) {
+#if defined(__GNUC__) || defined(__clang__)
+        count += __builtin_popcountll(m->bits[w]);
+#else
+        for (uint64_t b = m->bits[w]; b; b &= b - 1) count++;
+#endif
+    }
+    m->count = count;
+}
+
+void cand_mask_free(CandMask *m) {
+    free(m->bits);
+    memset(m, 0, sizeof(CandMask));
+}
@@ -0,0 +1,83 @@
+#ifndef CAND_MASK_H
+#define CAND_MASK_H
+
+#include <stdint.h>
+
+// Clusters still candidates for the current frame: one bit per cluster and
+// the number of bits set. Counting survivors is O(1) and walks over them skip
+// 64 pruned clusters per word, in increasing index order.
+//
+// Parallel loops split the walk by word (cand_mask_words()): bits of a word
+// are then only cleared by the thread that owns it, with
+// cand_mask_clear_owned(), and count is fixed up afterwards.
+
+typedef struct {
+    uint64_t *bits;
+    int capacity; // Clusters
+    int n;        // Clusters this frame
+    int nwords;   // Words covering n
+    int count;    // Bits set
+} CandMask;
+
+int cand_mask_init(CandMask *m, int capacity);
+
+// Start a frame with clusters 0..n-1 all active
+void cand_mask_fill(CandMask *m, int n);
+
+// Recompute count from the bits (popcount)
+void cand_mask_recount(CandMask *m);
+
+void cand_mask_free(CandMask *m);
+
+static inline int cand_mask_ctz(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int i = 0;
+    while (!(w & 1)) {
+        w >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static inline int cand_mask_test(const CandMask *m, int i) {
+    return i >= 0 && i < m->n && ((m->bits[i >> 6] >> (i & 63)) & 1);
+}
+
+static inline void cand_mask_clear(CandMask *m, int i) {
+    if (!cand_mask_test(m, i)) return;
+    m->bits[i >> 6] &= ~((uint64_t)1 << (i & 63));
+    m->count--;
+}
+
+// Clear an active bit of a word owned by the calling thread; count is not updated
+static inline void cand_mask_clear_owned(CandMask *m, int i) {
+    m->bits[i >> 6] &= ~((uint64_t)1 << (i & 63));
+}
+
+// First active cluster >= i, or -1
+static inline int cand_mask_next(const CandMask *m, int i) {
+    if (i < 0) i = 0;
+    if (i >= m->n) return -1;
+    int w = i >> 6;
+    uint64_t bits = m->bits[w] & (~(uint64_t)0 << (i & 63));
+    while (!bits) {
+        if (++w >= m->nwords) return -1;
+        bits = m->bits[w];
+    }
+    return (w << 6) + cand_mask_ctz(bits);
+}
+
+static inline int cand_mask_words(const CandMask *m) {
+    return m->nwords;
+}
+
+// Active clusters of word w, lowest first: for (b = cand_mask_word(m, w); b; b &= b - 1)
+// visits cluster (w << 6) + cand_mask_ctz(b)
+static inline uint64_t cand_mask_word(const CandMask *m, int w) {
+    return m->bits[w];
+}
+
+#endif // CAND_MASK_H
@@ -9,9 +9,8 @@
 #endif
 #include "cluster_core.h"
 #include "frameread.h"
-
-// Forward declaration
-double framedist(Frame *a, Frame *b);
+#include "framedistance.h"
+#include "sketch.h"
 
 #define ANSI_COLOR_ORANGE  "\x1b[38;5;208m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
@@ -20,12 +19,13 @@ double framedist(Frame *a, Frame *b);
 #define ANSI_COLOR_BLACK   "\x1b[30m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
+// Decreasing p; equal p in increasing cluster index, whatever the input order
 int compare_candidates(const void *a, const void *b) {
     Candidate *ca = (Candidate *)a;
     Candidate *cb = (Candidate *)b;
     if (ca->p < cb->p) return 1;
     if (ca->p > cb->p) return -1;
-    return 0;
+    return (ca->id > cb->id) - (ca->id < cb->id);
 }
 
 // Global pointer for sorting wrapper (legacy workaround)
@@ -67,22 +67,836 @@ void add_visitor(VisitorList *list, int frame_idx) {
     list->frames[list->count++] = frame_idx;
 }
 
-double get_dist(Frame *a, Frame *b, int cluster_idx, double cluster_prob, double current_gprob, ClusterConfig *config, ClusterState *state) {
-    #ifdef _OPENMP
-    #pragma omp atomic
-    #endif
-    state->framedist_calls++;
-    double d = framedist(a, b);
+// gprob of cluster i for the current frame (1.0 until first updated)
+static double gprob_get(const ClusterState *state, int i) {
+    return (state->gprob_stamp[i] == state->gprob_epoch) ? state->current_gprobs[i] : 1.0;
+}
+
+static void gprob_scale(ClusterState *state, int i, double val) {
+    state->current_gprobs[i] = gprob_get(state, i) * val;
+    state->gprob_stamp[i] = state->gprob_epoch;
+}
+
+// New frame: every gprob back to 1.0 without touching the array
+static void gprob_reset(ClusterState *state, int capacity) {
+    if (++state->gprob_epoch == 0) {
+        memset(state->gprob_stamp, 0, capacity * sizeof(unsigned int));
+        state->gprob_epoch = 1;
+    }
+}
+
+// Cluster priors are kept unnormalized: clusters[i].prob is a weight and the
+// prior is weight / prob_unit, prob_unit being the total at the start of the
+// frame. A reward or a new cluster then changes one weight (O(log N) in the
+// heap) instead of renormalizing every cluster each frame.
+#define PROB_RESCALE_LIMIT 1e100
+
+// prob_unit for the frame; weights are brought back near 1 before they overflow
+static void prob_begin_frame(ClusterState *state) {
+    if (state->prob_total > PROB_RESCALE_LIMIT) {
+        double f = 1.0 / state->prob_total;
+        double total = 0.0;
+        for (int i = 0; i < state->num_clusters; i++) {
+            state->clusters[i].prob *= f;
+            total += state->clusters[i].prob;
+        }
+        prob_heap_scale(&state->prob_heap, f);
+        state->prob_total = total;
+    }
+    state->prob_unit = state->prob_total;
+}
+
+static double prob_prior(const ClusterState *state, int i) {
+    return state->clusters[i].prob / state->prob_unit;
+}
+
+// Assigned to cj: prior + deltaprob, before the next frame's normalization
+static void prob_reward(ClusterConfig *config, ClusterState *state, int cj) {
+    double dw = config->deltaprob * state->prob_unit;
+    state->clusters[cj].prob += dw;
+    state->prob_total += dw;
+    prob_heap_update(&state->prob_heap, cj, state->clusters[cj].prob);
+}
+
+// New cluster idx (== num_clusters) with a prior of 1.0
+static void prob_add_cluster(ClusterState *state, int idx) {
+    if (idx == 0) {
+        state->prob_total = 0.0;
+        state->prob_unit = 1.0;
+    }
+    state->clusters[idx].prob = state->prob_unit;
+    state->prob_total += state->prob_unit;
+    prob_heap_insert(&state->prob_heap, idx, state->prob_unit);
+}
+
+// Cluster idx removed (num_clusters already decremented)
+static void prob_remove(ClusterState *state, int idx) {
+    prob_heap_remove(&state->prob_heap, idx);
+    double total = 0.0;
+    for (int i = 0; i < state->num_clusters; i++) total += state->clusters[i].prob;
+    state->prob_total = total;
+}
+
+// Candidates by decreasing mixed probability, produced on demand into
+// probsortedclindex. Without transitions the order is the heap's. With
+// tm_mixing_coeff, only the clusters reached from the previous one get a
+// transition term: they are sorted apart and merged with the heap order,
+// where every other cluster keeps (1 - tm) * prior.
+typedef struct {
+    Candidate *tm; // Clusters with transitions, by mixed probability
+    unsigned char *tm_mark;
+    int ntm;
+    int tm_pos;
+    double prior_coeff;
+    int head; // Next cluster of the heap walk (-2: not fetched)
+    int filled; // Entries of probsortedclindex produced
+} ProbOrder;
+
+static void prob_order_begin(ClusterConfig *config, ClusterState *state, ProbOrder *po, int prev) {
+    for (int i = 0; i < po->ntm; i++) po->tm_mark[po->tm[i].id] = 0;
+    po->ntm = 0;
+    po->tm_pos = 0;
+    po->prior_coeff = 1.0;
+    po->head = -2;
+    po->filled = 0;
+    prob_heap_walk_begin(&state->prob_heap);
+
+    if (config->tm_mixing_coeff <= 0.0 || prev == -1) return;
+    const long *row = state->transition_matrix + (size_t)prev * config->maxnbclust;
+    double trans_prob_sum = 0.0;
+    for (int i = 0; i < state->num_clusters; i++) trans_prob_sum += (double)row[i];
+    if (trans_prob_sum <= 0.0) return;
+
+    po->prior_coeff = 1.0 - config->tm_mixing_coeff;
+    for (int i = 0; i < state->num_clusters; i++) {
+        if (row[i] == 0) continue;
+        double tp = (double)row[i] / trans_prob_sum;
+        po->tm[po->ntm].id = i;
+        po->tm[po->ntm].p = po->prior_coeff * prob_prior(state, i) + config->tm_mixing_coeff * tp;
+        po->tm_mark[i] = 1;
+        po->ntm++;
+    }
+    qsort(po->tm, po->ntm, sizeof(Candidate), compare_candidates);
+}
+
+static int prob_order_next(ClusterState *state, ProbOrder *po) {
+    if (po->head == -2) {
+        do {
+            po->head = prob_heap_walk_next(&state->prob_heap);
+        } while (po->head >= 0 && po->tm_mark[po->head]);
+    }
+    if (po->tm_pos < po->ntm) {
+        const Candidate *t = &po->tm[po->tm_pos];
+        double p = (po->head >= 0) ? po->prior_coeff * prob_prior(state, po->head) : -1.0;
+        if (po->head < 0 || t->p > p || (t->p == p && t->id < po->head)) {
+            po->tm_pos++;
+            return t->id;
+        }
+    }
+    int cj = po->head;
+    if (cj >= 0) po->head = -2;
+    return cj;
+}
+
+// Extend probsortedclindex to its first n entries
+static void prob_order_fill(ClusterState *state, ProbOrder *po, int n) {
+    while (po->filled < n) {
+        int cj = prob_order_next(state, po);
+        if (cj < 0) break;
+        state->probsortedclindex[po->filled++] = cj;
+    }
+}
+
+// Distance dump and verbose trace for one frame/anchor distance
+static void report_dist(Frame *a, Frame *b, int cluster_idx, double cluster_prob, double current_gprob, double d, int exact, ClusterConfig *config, ClusterState *state) {
     if (config->distall_mode && state->distall_out) {
         double ratio = (config->rlim > 0.0) ? d / config->rlim : -1.0;
         fprintf(state->distall_out, "%-8d %-8d %-12.6f %-12.6f %-8d %-12.6f %-12.6f\n", a->id, b->id, d, ratio, cluster_idx, cluster_prob, current_gprob);
     }
     if (config->verbose_level >= 2 && cluster_idx >= 0) {
-        printf(ANSI_COLOR_BLUE "  [VV] Computed distance: Frame %5d to Cluster %4d = %12.5e\n" ANSI_COLOR_RESET, a->id, cluster_idx, d);
+        if (exact) {
+            printf(ANSI_COLOR_BLUE "  [VV] Computed distance: Frame %5d to Cluster %4d = %12.5e\n" ANSI_COLOR_RESET, a->id, cluster_idx, d);
+        } else {
+            printf(ANSI_COLOR_BLUE "  [VV] Computed distance: Frame %5d to Cluster %4d > %12.5e (abandoned)\n" ANSI_COLOR_RESET, a->id, cluster_idx, d);
+        }
     }
+}
+
+// Distance with early abandon past 'bound' (< 0: always exact).
+// *exact is 0 when the returned value is only a lower bound.
+double get_dist_bounded(Frame *a, Frame *b, int cluster_idx, double cluster_prob, double current_gprob, double bound, int *exact, ClusterConfig *config, ClusterState *state) {
+    long *calls = &state->framedist_calls;
+    long *abandoned = &state->framedist_abandoned;
+    #ifdef _OPENMP
+    if (omp_in_parallel() && omp_get_thread_num() < state->nthread_counters) {
+        ThreadCounters *tc = &state->thread_counters[omp_get_thread_num()];
+        calls = &tc->framedist_calls;
+        abandoned = &tc->framedist_abandoned;
+    }
+    #endif
+    (*calls)++;
+    // The distance dump reports every value in full
+    if (config->distall_mode && state->distall_out) bound = -1.0;
+    double d = framedist_bounded(a, b, bound, exact);
+    if (!*exact) (*abandoned)++;
+    report_dist(a, b, cluster_idx, cluster_prob, current_gprob, d, *exact, config, state);
     return d;
 }
 
+// Pruning loops run in parallel unless the distance dump is on: dcc entries
+// they compute are then printed in the same order at any -ncpu.
+static int prune_parallel(ClusterConfig *config, ClusterState *state) {
+    return !(config->distall_mode && state->distall_out);
+}
+
+// Add the per-thread counters into the state totals
+static void merge_thread_counters(ClusterState *state) {
+    for (int t = 0; t < state->nthread_counters; t++) {
+        ThreadCounters *tc = &state->thread_counters[t];
+        state->framedist_calls += tc->framedist_calls;
+        state->framedist_abandoned += tc->framedist_abandoned;
+        tc->framedist_calls = 0;
+        tc->framedist_abandoned = 0;
+    }
+}
+
+double get_dist(Frame *a, Frame *b, int cluster_idx, double cluster_prob, double current_gprob, ClusterConfig *config, ClusterState *state) {
+    int exact;
+    return get_dist_bounded(a, b, cluster_idx, cluster_prob, current_gprob, -1.0, &exact, config, state);
+}
+
+// Early-abandon bound for d(frame, cj). Beyond rlim + max dcc(cj, cl) over the
+// active clusters, the 3-point test prunes every one of them, so the exact
+// value would not change the outcome. Returns -1 (no bound) if any such dcc
+// is not known yet.
+static double dfc_abandon_bound(ClusterConfig *config, ClusterState *state, int cj) {
+    double dmax = 0.0;
+    for (int cl = cand_mask_next(&state->clmemb, 0); cl >= 0; cl = cand_mask_next(&state->clmemb, cl + 1)) {
+        double dcc = dcc_store_get(&state->dcc, cj, cl);
+        if (dcc < 0) return -1.0;
+        if (dcc > dmax) dmax = dcc;
+    }
+    return config->rlim + dmax;
+}
+
+// Delta mode: share of changed pixels above which full distances are cheaper
+#define DELTA_MAX_FILL 0.25
+
+static void delta_free(DeltaCache *dc) {
+    free(dc->prev);
+    free(dc->next);
+    free(dc->changed);
+    free(dc->d2);
+    free(dc->stamp);
+    free(dc->age);
+    memset(dc, 0, sizeof(DeltaCache));
+}
+
+// Cluster indices changed: drop every cached distance
+static void delta_invalidate(ClusterConfig *config, ClusterState *state) {
+    if (!state->delta.stamp) return;
+    for (int i = 0; i < config->maxnbclust; i++) state->delta.stamp[i] = -1;
+}
+
+// List the pixels that changed since the previous frame and keep a copy of
+// this one for the next frame.
+static void delta_begin_frame(ClusterConfig *config, ClusterState *state, Frame *frame) {
+    DeltaCache *dc = &state->delta;
+    if (config->delta_period <= 0) return;
+
+    long size = frame->width * frame->height;
+    size_t bytes = size * frame_dtype_size(frame->dtype);
+    if (!dc->d2) {
+        dc->frame_bytes = bytes;
+        dc->max_changed = (long)(DELTA_MAX_FILL * size);
+        dc->prev = malloc(bytes);
+        dc->next = malloc(bytes);
+        dc->changed = (uint32_t *)malloc((dc->max_changed > 0 ? dc->max_changed : 1) * sizeof(uint32_t));
+        dc->d2 = (double *)malloc(config->maxnbclust * sizeof(double));
+        dc->stamp = (long *)malloc(config->maxnbclust * sizeof(long));
+        dc->age = (int *)calloc(config->maxnbclust, sizeof(int));
+        if (!dc->prev || !dc->next || !dc->changed || !dc->d2 || !dc->stamp || !dc->age) {
+            perror("Memory allocation failed for delta mode");
+            delta_free(dc);
+            config->delta_period = 0;
+            return;
+        }
+        delta_invalidate(config, state);
+    }
+
+    dc->seq++;
+    dc->active = 0;
+    if (bytes != dc->frame_bytes) {
+        dc->have_prev = 0;
+        return;
+    }
+    void *tmp = dc->prev;
+    dc->prev = dc->next;
+    dc->next = tmp;
+    if (dc->have_prev) {
+        long n = framedist_changed_pixels(frame, dc->prev, dc->changed, dc->max_changed);
+        if (n >= 0) {
+            dc->nchanged = n;
+            dc->active = 1;
+        }
+    }
+    memcpy(dc->next, frame->data, bytes);
+    dc->have_prev = 1;
+}
+
+// Frame-to-anchor distance for the main loop. In delta mode, the previous
+// frame's squared distance to the same anchor is corrected over the changed
+// pixels; after delta_period such updates a full distance is computed again.
+// With lb_reject >= 0, a full distance is first checked against the norm and
+// block-sum lower bounds: if one exceeds lb_reject it is returned instead
+// (*exact = 0) and counted in framedist_lbound, not framedist_calls.
+static double get_dfc(Frame *frame, int cj, double bound, double lb_reject, int *exact, ClusterConfig *config, ClusterState *state) {
+    Cluster *c = &state->clusters[cj];
+    DeltaCache *dc = &state->delta;
+    if (state->pivots.dist && state->pivots.dist[cj] >= 0.0) {
+        // Pivot: already computed for this frame by the pivot sweep
+        *exact = 1;
+        return state->pivots.dist[cj];
+    }
+    if (dc->active && dc->stamp[cj] == dc->seq - 1 && dc->age[cj] < config->delta_period) {
+        double d2 = dc->d2[cj] + framedist_delta_sqdist(frame, dc->prev, &c->anchor, dc->changed, dc->nchanged);
+        if (d2 < 0.0) d2 = 0.0;
+        dc->d2[cj] = d2;
+        dc->stamp[cj] = dc->seq;
+        dc->age[cj]++;
+        state->framedist_delta++;
+        *exact = 1;
+        double d = sqrt(d2);
+        report_dist(frame, &c->anchor, c->id, prob_prior(state, cj), gprob_get(state, cj), d, 1, config, state);
+        return d;
+    }
+
+    if (lb_reject >= 0.0 && c->anchor.lbsum) {
+        if (!frame->lbsum) framedist_summarize(frame);
+        double lb = framedist_lower_bound(frame, &c->anchor, lb_reject);
+        if (lb > lb_reject) {
+            state->framedist_lbound++;
+            *exact = 0;
+            if (config->verbose_level >= 2) {
+                printf(ANSI_COLOR_BLUE "  [VV] Lower bound: Frame %5d to Cluster %4d > %12.5e (skipped)\n" ANSI_COLOR_RESET, frame->id, c->id, lb);
+            }
+            return lb;
+        }
+    }
+
+    double d = get_dist_bounded(frame, &c->anchor, c->id, prob_prior(state, cj), gprob_get(state, cj), bound, exact, config, state);
+    if (dc->d2 && *exact && d >= 0.0) {
+        // Integer frames have integer squared distances: undo sqrt rounding
+        double d2 = d * d;
+        if (frame_dtype_is_integer(frame->dtype)) d2 = nearbyint(d2);
+        dc->d2[cj] = d2;
+        dc->stamp[cj] = dc->seq;
+        dc->age[cj] = 0;
+    }
+    return d;
+}
+
+// Anchor-to-anchor distance, computed and stored if not known yet. Safe in
+// the parallel pruning loops: only the thread that claims an entry computes it.
+// With 'exact' set, a saturated Q16 entry is returned as its lower bound
+// (*exact = 0) instead of being recomputed.
+static double get_dcc_bounded(ClusterConfig *config, ClusterState *state, int a, int b, int *exact) {
+    double dcc = dcc_store_claim(&state->dcc, a, b);
+    if (exact) *exact = 1;
+    if (dcc == -3.0 && exact) {
+        *exact = 0;
+        return dcc_store_floor(&state->dcc);
+    }
+    if (dcc < 0) {
+        int claimed = (dcc == -1.0);
+        dcc = get_dist(&state->clusters[a].anchor, &state->clusters[b].anchor, -1, -1.0, -1.0, config, state);
+        if (claimed) dcc_store_publish(&state->dcc, a, b, dcc);
+    }
+    return dcc;
+}
+
+static double get_dcc(ClusterConfig *config, ClusterState *state, int a, int b) {
+    return get_dcc_bounded(config, state, a, b, NULL);
+}
+
+static void coherence_free(CoherenceCache *cc) {
+    free(cc->ref.data);
+    free(cc->next.data);
+    free(cc->lo);
+    free(cc->hi);
+    free(cc->cur_lo);
+    free(cc->cur_hi);
+    memset(cc, 0, sizeof(CoherenceCache));
+}
+
+// Compute d(ref, frame) and derive the current frame's bounds from the
+// reference's: d(frame, A) lies within d(ref, A) -+ d(ref, frame). Bounds
+// that cannot decide anything (lo <= rlim <= hi) are dropped.
+static void coherence_begin_frame(ClusterConfig *config, ClusterState *state, Frame *frame) {
+    CoherenceCache *cc = &state->coherence;
+    if (!config->coherence_mode) return;
+
+    size_t bytes = frame->width * frame->height * frame_dtype_size(frame->dtype);
+    if (!cc->lo) {
+        cc->frame_bytes = bytes;
+        cc->ref.data = malloc(bytes);
+        cc->next.data = malloc(bytes);
+        cc->lo = (double *)malloc(config->maxnbclust * sizeof(double));
+        cc->hi = (double *)malloc(config->maxnbclust * sizeof(double));
+        cc->cur_lo = (double *)malloc(config->maxnbclust * sizeof(double));
+        cc->cur_hi = (double *)malloc(config->maxnbclust * sizeof(double));
+        if (!cc->ref.data || !cc->next.data || !cc->lo || !cc->hi || !cc->cur_lo || !cc->cur_hi) {
+            perror("Memory allocation failed for coherence bounds");
+            coherence_free(cc);
+            config->coherence_mode = 0;
+            return;
+        }
+    }
+
+    double d = -1.0;
+    if (bytes == cc->frame_bytes && cc->have_ref && cc->ref.dtype == frame->dtype) {
+        d = get_dist(frame, &cc->ref, -1, -1.0, -1.0, config, state);
+    }
+    for (int i = 0; i < config->maxnbclust; i++) {
+        double lo = 0.0, hi = INFINITY;
+        if (d >= 0.0 && i < state->num_clusters) {
+            lo = cc->lo[i] - d;
+            hi = cc->hi[i] + d;
+            if (lo <= config->rlim && hi >= config->rlim) {
+                lo = 0.0;
+                hi = INFINITY;
+            }
+        }
+        cc->cur_lo[i] = (lo > 0.0) ? lo : 0.0;
+        cc->cur_hi[i] = hi;
+    }
+
+    if (bytes != cc->frame_bytes) {
+        cc->have_ref = 0;
+        cc->next.width = 0;
+        return;
+    }
+    void *data = cc->next.data;
+    cc->next = *frame;
+    cc->next.data = data;
+    cc->next.nnz = -1;
+    cc->next.sp_idx = NULL;
+    cc->next.sp_val = NULL;
+    cc->next.norm2 = -1.0;
+    cc->next.lbsum = NULL;
+    cc->next.pca = NULL;
+    cc->next.sketch = NULL;
+    memcpy(cc->next.data, frame->data, bytes);
+}
+
+// Frame-to-anchor distance measured for the current frame (exact = 0: lower
+// bound only)
+static void coherence_note(ClusterState *state, int cj, double d, int exact) {
+    CoherenceCache *cc = &state->coherence;
+    if (!cc->lo || d < 0.0) return;
+    if (exact) {
+        cc->cur_lo[cj] = d;
+        cc->cur_hi[cj] = d;
+    } else if (d > cc->cur_lo[cj]) {
+        cc->cur_lo[cj] = d;
+    }
+}
+
+// Apply the carried bounds: prune the anchors proven out of range, and return
+// the most probable anchor proven within rlim (-1: none)
+static int coherence_match(ClusterConfig *config, ClusterState *state) {
+    CoherenceCache *cc = &state->coherence;
+    if (!cc->lo) return -1;
+    int best = -1;
+    for (int i = 0; i < state->num_clusters; i++) {
+        if (cc->cur_lo[i] > config->rlim) {
+            if (cand_mask_test(&state->clmemb, i)) {
+                cand_mask_clear(&state->clmemb, i);
+                state->coherence_pruned++;
+            }
+        } else if (cc->cur_hi[i] < config->rlim && (best < 0 || state->mixed_probs[i] > state->mixed_probs[best])) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+// A frame that measured distances becomes the reference: its bounds are
+// tighter than the ones derived for the frames after it would be
+static void coherence_end_frame(ClusterState *state, int measured) {
+    CoherenceCache *cc = &state->coherence;
+    if (!cc->lo || !measured || cc->next.width == 0) return;
+    double *tmp = cc->lo;
+    cc->lo = cc->cur_lo;
+    cc->cur_lo = tmp;
+    tmp = cc->hi;
+    cc->hi = cc->cur_hi;
+    cc->cur_hi = tmp;
+    Frame f = cc->ref;
+    cc->ref = cc->next;
+    cc->next = f;
+    cc->have_ref = 1;
+}
+
+// Cluster idx removed: ids above it shift down by one
+static void coherence_remove(ClusterState *state, int idx) {
+    CoherenceCache *cc = &state->coherence;
+    if (!cc->lo) return;
+    int tail = state->num_clusters - idx;
+    if (tail > 0) {
+        memmove(cc->lo + idx, cc->lo + idx + 1, tail * sizeof(double));
+        memmove(cc->hi + idx, cc->hi + idx + 1, tail * sizeof(double));
+        memmove(cc->cur_lo + idx, cc->cur_lo + idx + 1, tail * sizeof(double));
+        memmove(cc->cur_hi + idx, cc->cur_hi + idx + 1, tail * sizeof(double));
+    }
+    cc->lo[state->num_clusters] = 0.0;
+    cc->hi[state->num_clusters] = INFINITY;
+    cc->cur_lo[state->num_clusters] = 0.0;
+    cc->cur_hi[state->num_clusters] = INFINITY;
+}
+
+// Pivot index: anchors needed per pivot before the pivots are selected, and
+// dictionary growth factor after which they are selected again
+#define PIVOT_MIN_ANCHORS 4
+#define PIVOT_RESELECT_GROWTH 2
+
+static void pivot_free(PivotIndex *pv) {
+    free(pv->idx);
+    free(pv->table);
+    free(pv->dfp);
+    free(pv->lb);
+    free(pv->dist);
+    memset(pv, 0, sizeof(PivotIndex));
+}
+
+// Cluster indices changed: select the pivots again on the next frame
+static void pivot_invalidate(ClusterConfig *config, ClusterState *state) {
+    PivotIndex *pv = &state->pivots;
+    if (!pv->dist) return;
+    for (int i = 0; i < config->maxnbclust; i++) pv->dist[i] = -1.0;
+    pv->count = 0;
+}
+
+// Farthest-first traversal over the dcc store, from the most visited anchor: each
+// new pivot is the anchor farthest from all pivots so far. The table rows are
+// filled on the way.
+static void pivot_select(ClusterConfig *config, ClusterState *state) {
+    PivotIndex *pv = &state->pivots;
+    int n = state->num_clusters;
+    int np = config->pivots < n ? config->pivots : n;
+    double *mind = pv->lb; // Scratch: distance to the nearest pivot
+
+    int next = 0;
+    for (int i = 1; i < n; i++) {
+        if (state->cluster_visitors[i].count > state->cluster_visitors[next].count) next = i;
+    }
+    for (int k = 0; k < n; k++) mind[k] = HUGE_VAL;
+
+    pv->count = 0;
+    while (pv->count < np) {
+        double *row = pv->table + (size_t)pv->count * config->maxnbclust;
+        pv->idx[pv->count++] = next;
+        int far = -1;
+        double fard = 0.0;
+        for (int k = 0; k < n; k++) {
+            row[k] = get_dcc(config, state, next, k);
+            if (row[k] < mind[k]) mind[k] = row[k];
+            if (mind[k] > fard) {
+                fard = mind[k];
+                far = k;
+            }
+        }
+        if (far < 0) break; // Every anchor coincides with a pivot
+        next = far;
+    }
+    pv->cols = n;
+    pv->selected_at = n;
+}
+
+// Forget the pivot distances of the previous frame
+static void pivot_begin_frame(ClusterState *state) {
+    PivotIndex *pv = &state->pivots;
+    for (int p = 0; p < pv->count; p++) pv->dist[pv->idx[p]] = -1.0;
+}
+
+// Exact distances from the frame to the pivots, then
+//   lb[k] = max_p |d(f, p) - d(p, k)|
+// for every anchor in one pass per pivot over the table (triangle
+// inequality). Returns 1 if pv->lb is valid for this frame.
+static int pivot_sweep(ClusterConfig *config, ClusterState *state, Frame *frame) {
+    PivotIndex *pv = &state->pivots;
+    int n = state->num_clusters;
+
+    if (config->pivots <= 0 || n < PIVOT_MIN_ANCHORS * config->pivots) return 0;
+
+    if (!pv->idx) {
+        pv->idx = (int *)malloc(config->pivots * sizeof(int));
+        pv->table = (double *)malloc((size_t)config->pivots * config->maxnbclust * sizeof(double));
+        pv->dfp = (double *)malloc(config->pivots * sizeof(double));
+        pv->lb = (double *)malloc(config->maxnbclust * sizeof(double));
+        pv->dist = (double *)malloc(config->maxnbclust * sizeof(double));
+        if (!pv->idx || !pv->table || !pv->dfp || !pv->lb || !pv->dist) {
+            perror("Memory allocation failed for pivot index");
+            pivot_free(pv);
+            config->pivots = 0;
+            return 0;
+        }
+        pivot_invalidate(config, state);
+    }
+
+    if (pv->count == 0 || n >= PIVOT_RESELECT_GROWTH * pv->selected_at) {
+        pivot_select(config, state);
+    } else if (pv->cols < n) {
+        // Anchors created since the last frame
+        for (int p = 0; p < pv->count; p++) {
+            double *row = pv->table + (size_t)p * config->maxnbclust;
+            for (int k = pv->cols; k < n; k++) row[k] = get_dcc(config, state, pv->idx[p], k);
+        }
+        pv->cols = n;
+    }
+
+    for (int p = 0; p < pv->count; p++) {
+        int exact;
+        pv->dfp[p] = get_dfc(frame, pv->idx[p], -1.0, -1.0, &exact, config, state);
+    }
+    for (int p = 0; p < pv->count; p++) pv->dist[pv->idx[p]] = pv->dfp[p];
+
+    double *lb = pv->lb;
+    for (int k = 0; k < n; k++) lb[k] = 0.0;
+    for (int p = 0; p < pv->count; p++) {
+        const double *row = pv->table + (size_t)p * config->maxnbclust;
+        double d = pv->dfp[p];
+        for (int k = 0; k < n; k++) {
+            double v = fabs(d - row[k]);
+            lb[k] = v > lb[k] ? v : lb[k];
+        }
+    }
+    return 1;
+}
+
+static void pq_free(ClusterState *state) {
+    pq_codebook_free(&state->pq);
+    free(state->pq_codes);
+    free(state->pq_resid);
+    free(state->pq_table);
+    free(state->pq_est);
+    state->pq_codes = NULL;
+    state->pq_resid = NULL;
+    state->pq_table = NULL;
+    state->pq_est = NULL;
+}
+
+static void pq_setup(ClusterConfig *config, ClusterState *state) {
+    if (pq_codebook_init(&state->pq, config->pq_m, config->pq_frames, get_frame_width() * get_frame_height(),
+                         get_frame_dtype(), (SimdLevel)config->simd_level) != 0) {
+        config->pq_m = 0;
+        return;
+    }
+    // Codes stay within the table for anchors not coded yet
+    state->pq_codes = (unsigned char *)calloc((size_t)config->maxnbclust * state->pq.m, 1);
+    state->pq_resid = (double *)malloc(config->maxnbclust * sizeof(double));
+    state->pq_table = (double *)malloc((size_t)state->pq.m * state->pq.k * sizeof(double));
+    state->pq_est = (double *)malloc(config->maxnbclust * sizeof(double));
+    if (!state->pq_codes || !state->pq_resid || !state->pq_table || !state->pq_est) {
+        perror("Memory allocation failed for PQ codes");
+        pq_free(state);
+        config->pq_m = 0;
+        return;
+    }
+    for (int i = 0; i < config->maxnbclust; i++) state->pq_resid[i] = -1.0;
+}
+
+// Code anchor idx (no-op until the codebook is learned)
+static void pq_encode_anchor(ClusterState *state, int idx) {
+    if (!state->pq.ready) return;
+    if (!pq_codebook_encode(&state->pq, &state->clusters[idx].anchor, state->pq_codes + (size_t)idx * state->pq.m,
+                            &state->pq_resid[idx])) {
+        state->pq_resid[idx] = -1.0;
+    }
+}
+
+// Cluster idx removed: codes above it shift down by one
+static void pq_remove(ClusterState *state, int idx) {
+    if (!state->pq_codes) return;
+    int tail = state->num_clusters - idx; // num_clusters already decremented
+    if (tail > 0) {
+        memmove(state->pq_codes + (size_t)idx * state->pq.m, state->pq_codes + (size_t)(idx + 1) * state->pq.m,
+                (size_t)tail * state->pq.m);
+        memmove(state->pq_resid + idx, state->pq_resid + idx + 1, tail * sizeof(double));
+    }
+    state->pq_resid[state->num_clusters] = -1.0;
+}
+
+// One distance table for the frame, then ||frame - q(anchor)|| for every
+// anchor by table lookups (pq_est). Anchors whose lower bound
+//   ||frame - q(a)|| - ||a - q(a)||
+// exceeds rlim are pruned. Returns 1 if pq_est is valid for this frame.
+static int pq_sweep(ClusterConfig *config, ClusterState *state, Frame *frame) {
+    int n = state->num_clusters;
+    if (!state->pq.ready || n == 0 || !pq_codebook_table(&state->pq, frame, state->pq_table)) return 0;
+
+    pq_codebook_scan(&state->pq, state->pq_table, state->pq_codes, n, state->pq_est);
+    for (int i = 0; i < n; i++) {
+        double adc = state->pq_est[i];
+        state->pq_est[i] = sqrt(adc > 0.0 ? adc : 0.0);
+        if (state->pq_resid[i] < 0.0) {
+            state->pq_est[i] = 0.0;
+            continue;
+        }
+        if (cand_mask_test(&state->clmemb, i) && pq_codebook_lower_bound(adc, state->pq_resid[i]) > config->rlim) {
+            cand_mask_clear(&state->clmemb, i);
+            state->pq_rejected++;
+        }
+    }
+    return 1;
+}
+
+// VP-tree index: rebuilt balanced once the dictionary has grown by this
+// factor since the last build; anchors in between are inserted at the leaves
+#define INDEX_REBUILD_GROWTH 2
+
+typedef struct {
+    ClusterConfig *config;
+    ClusterState *state;
+} DccContext;
+
+static double index_dcc(void *ctx, int a, int b) {
+    DccContext *c = (DccContext *)ctx;
+    return get_dcc(c->config, c->state, a, b);
+}
+
+// hnsw index: new clusters checked before the beam width is reconsidered
+// against the target recall
+#define INDEX_RECALL_WINDOW 50
+
+// Bring the tree up to the current anchors. Removed anchors leave routing
+// nodes behind; once they are as many as the live ones, rebuild.
+static void index_sync(ClusterConfig *config, ClusterState *state) {
+    VpTree *t = &state->vptree;
+    DccContext ctx = { config, state };
+    int rebuild = t->root < 0 || state->num_clusters >= INDEX_REBUILD_GROWTH * t->built || t->dead > t->live;
+    for (int id = t->live; !rebuild && id < state->num_clusters; id++) {
+        if (vptree_insert(t, id, index_dcc, &ctx) != 0) rebuild = 1;
+    }
+    if (rebuild) vptree_build(t, state->num_clusters, index_dcc, &ctx);
+}
+
+// Start the search of the current frame. Distances already measured (the
+// prediction candidates) seed the graph search; grid candidates are tried in
+// probability order, ties in cluster index order as in the linear walk.
+static void index_begin(ClusterConfig *config, ClusterState *state, Frame *frame, const int *temp_indices,
+                        const double *temp_dists, int temp_count, Candidate *sort_buf) {
+    if (config->index_mode == ANCHOR_INDEX_VPTREE) {
+        index_sync(config, state);
+        vptree_query_begin(&state->vptree, state->mixed_probs);
+    } else if (config->index_mode == ANCHOR_INDEX_GRID) {
+        GridIndex *g = &state->grid;
+        int n = grid_index_query(g, frame);
+        for (int i = 0; i < n; i++) {
+            sort_buf[i].id = g->hits[i];
+            sort_buf[i].p = state->mixed_probs[g->hits[i]];
+        }
+        qsort(sort_buf, n, sizeof(Candidate), compare_candidates);
+        for (int i = 0; i < n; i++) g->hits[i] = sort_buf[i].id;
+        g->cursor = 0;
+    } else {
+        nsw_query_begin(&state->nsw, state->nsw_ef);
+        for (int i = 0; i < temp_count; i++) nsw_report(&state->nsw, temp_indices[i], temp_dists[i]);
+    }
+}
+
+// Distance from the frame to anchor cj, measured or known (d < 0: unknown)
+static void index_report(ClusterConfig *config, ClusterState *state, int cj, double d, int exact) {
+    if (config->index_mode == ANCHOR_INDEX_VPTREE) vptree_report(&state->vptree, d, exact, config->rlim);
+    else if (config->index_mode == ANCHOR_INDEX_HNSW) nsw_report(&state->nsw, cj, d);
+}
+
+// A cluster was created at idx: add it to the grid, or link it into the
+// graph. If the frame went through the graph search, its exact dcc row tells
+// whether the search missed an anchor within rlim (a duplicate cluster); with
+// a target recall, the beam is widened while duplicates are too frequent.
+static void index_cluster_created(ClusterConfig *config, ClusterState *state, int idx, int searched) {
+    if (config->index_mode == ANCHOR_INDEX_GRID) {
+        while (state->grid.count <= idx && state->grid.count < state->grid.capacity) {
+            grid_index_insert(&state->grid, state->grid.count, &state->clusters[state->grid.count].anchor);
+        }
+        return;
+    }
+    if (config->index_mode != ANCHOR_INDEX_HNSW || !state->nsw.links) return;
+    DccContext ctx = { config, state };
+    while (state->nsw.count <= idx && state->nsw.count < state->nsw.capacity) {
+        nsw_insert(&state->nsw, state->nsw.count, index_dcc, &ctx);
+    }
+    if (!searched) return;
+
+    int duplicate = 0;
+    for (int i = 0; i < idx && !duplicate; i++) {
+        double d = dcc_store_get(&state->dcc, idx, i);
+        if (d >= 0.0 && d < config->rlim) duplicate = 1;
+    }
+    state->nsw_checked++;
+    state->nsw_duplicates += duplicate;
+    state->nsw_window_checked++;
+    state->nsw_window_duplicates += duplicate;
+    if (config->index_recall > 0.0 && state->nsw_window_checked >= INDEX_RECALL_WINDOW) {
+        double rate = (double)state->nsw_window_duplicates / state->nsw_window_checked;
+        if (rate > 1.0 - config->index_recall && state->nsw_ef < config->maxnbclust) {
+            state->nsw_ef *= 2;
+            if (state->nsw_ef > config->maxnbclust) state->nsw_ef = config->maxnbclust;
+            if (config->verbose_level >= 1) {
+                printf("hnsw: duplicate rate %.4f above target, beam width -> %d\n", rate, state->nsw_ef);
+            }
+        }
+        state->nsw_window_checked = 0;
+        state->nsw_window_duplicates = 0;
+    }
+}
+
+// Most probable active anchor: tested before the tree search, as it usually
+// matches
+static int index_first(ClusterState *state) {
+    int best = -1;
+    for (int i = cand_mask_next(&state->clmemb, 0); i >= 0; i = cand_mask_next(&state->clmemb, i + 1)) {
+        if (best < 0 || state->mixed_probs[i] > state->mixed_probs[best]) best = i;
+    }
+    return best;
+}
+
+// Next anchor to test. Anchors already pruned or tested for this frame are
+// passed over without a new distance: with their known distance if any, else
+// as unknown (tree children inherit the node bound, the graph search routes
+// through to the neighbours).
+static int index_next(ClusterConfig *config, ClusterState *state, const int *temp_indices, const double *temp_dists,
+                      const unsigned char *temp_exact, int temp_count) {
+    for (;;) {
+        int cj;
+        if (config->index_mode == ANCHOR_INDEX_GRID) {
+            GridIndex *g = &state->grid;
+            cj = (g->cursor < g->nhits) ? g->hits[g->cursor++] : -1;
+            if (cj < 0 || cand_mask_test(&state->clmemb, cj)) return cj;
+            continue;
+        } else if (config->index_mode == ANCHOR_INDEX_VPTREE) {
+            double lb;
+            cj = vptree_next(&state->vptree, config->rlim, &lb);
+        } else {
+            cj = nsw_next(&state->nsw);
+        }
+        if (cj < 0 || cand_mask_test(&state->clmemb, cj)) return cj;
+        double d = -1.0;
+        int exact = 0;
+        for (int i = 0; i < temp_count; i++) {
+            if (temp_indices[i] == cj) {
+                d = temp_dists[i];
+                exact = temp_exact[i];
+                break;
+            }
+        }
+        // Pruned on a carried bound: that bound
+        if (d < 0.0 && state->coherence.lo && state->coherence.cur_lo[cj] > 0.0) d = state->coherence.cur_lo[cj];
+        index_report(config, state, cj, d, exact);
+    }
+}
+
 void run_scandist(ClusterConfig *config, char *out_dir) {
     long nframes = get_num_frames();
     if (nframes < 2) {
@@ -284,83 +1098,149 @@ int get_prediction_candidates(ClusterState *state, ClusterConfig *config, int *c
 }
 
 
-static void prune_candidates_te5(ClusterConfig *config, ClusterState *state, int *temp_indices, double *temp_dists, int temp_count) {
+static void prune_candidates_te5(ClusterConfig *config, ClusterState *state, int *temp_indices, double *temp_dists, unsigned char *temp_exact, int temp_count) {
     if (!config->te5_mode || temp_count < 3) return;
+    // Lower-bound (abandoned) distances cannot be used in the embedding
+    if (!temp_exact[temp_count - 1]) return;
 
     int c3 = temp_indices[temp_count - 1]; // Current cluster (newest anchor)
     double d_f_c3 = temp_dists[temp_count - 1];
 
     for (int p = 0; p < temp_count - 2; p++) {
+        if (!temp_exact[p]) continue;
         for (int q = p + 1; q < temp_count - 1; q++) {
+            if (!temp_exact[q]) continue;
             int c1 = temp_indices[p];
             double d_f_c1 = temp_dists[p];
             int c2 = temp_indices[q];
             double d_f_c2 = temp_dists[q];
 
             // Get inter-cluster distances (lazy load)
-            double d_c1_c2 = state->dccarray[c1 * config->maxnbclust + c2];
-            if (d_c1_c2 < 0) {
-                 d_c1_c2 = get_dist(&state->clusters[c1].anchor, &state->clusters[c2].anchor, -1, -1.0, -1.0, config, state);
-                 state->dccarray[c1 * config->maxnbclust + c2] = d_c1_c2;
-                 state->dccarray[c2 * config->maxnbclust + c1] = d_c1_c2;
-            }
+            double d_c1_c2 = get_dcc(config, state, c1, c2);
 
-            double d_c1_c3 = state->dccarray[c1 * config->maxnbclust + c3];
-            if (d_c1_c3 < 0) {
-                    d_c1_c3 = get_dist(&state->clusters[c1].anchor, &state->clusters[c3].anchor, -1, -1.0, -1.0, config, state);
-                    state->dccarray[c1 * config->maxnbclust + c3] = d_c1_c3;
-                    state->dccarray[c3 * config->maxnbclust + c1] = d_c1_c3;
-            }
+            double d_c1_c3 = get_dcc(config, state, c1, c3);
 
-            double d_c2_c3 = state->dccarray[c2 * config->maxnbclust + c3];
-            if (d_c2_c3 < 0) {
-                    d_c2_c3 = get_dist(&state->clusters[c2].anchor, &state->clusters[c3].anchor, -1, -1.0, -1.0, config, state);
-                    state->dccarray[c2 * config->maxnbclust + c3] = d_c2_c3;
-                    state->dccarray[c3 * config->maxnbclust + c2] = d_c2_c3;
-            }
+            double d_c2_c3 = get_dcc(config, state, c2, c3);
 
             long local_pruned_te5 = 0;
             #ifdef _OPENMP
-            #pragma omp parallel for reduction(+:local_pruned_te5)
+            #pragma omp parallel for reduction(+:local_pruned_te5) if(prune_parallel(config, state))
             #endif
-            for (int k = 0; k < state->num_clusters; k++) {
-                if (!state->clmembflag[k]) continue;
-                if (k == c1 || k == c2 || k == c3) continue;
-
-                // Lazy load k distances
-                double d_k_c1 = state->dccarray[k * config->maxnbclust + c1];
-                if (d_k_c1 < 0) {
-                        d_k_c1 = get_dist(&state->clusters[k].anchor, &state->clusters[c1].anchor, -1, -1.0, -1.0, config, state);
-                        state->dccarray[k * config->maxnbclust + c1] = d_k_c1;
-                        state->dccarray[c1 * config->maxnbclust + k] = d_k_c1;
-                }
+            for (int w = 0; w < cand_mask_words(&state->clmemb); w++) {
+                for (uint64_t b = cand_mask_word(&state->clmemb, w); b; b &= b - 1) {
+                    int k = (w << 6) + cand_mask_ctz(b);
+                    if (k == c1 || k == c2 || k == c3) continue;
 
-                double d_k_c2 = state->dccarray[k * config->maxnbclust + c2];
-                if (d_k_c2 < 0) {
-                        d_k_c2 = get_dist(&state->clusters[k].anchor, &state->clusters[c2].anchor, -1, -1.0, -1.0, config, state);
-                        state->dccarray[k * config->maxnbclust + c2] = d_k_c2;
-                        state->dccarray[c2 * config->maxnbclust + k] = d_k_c2;
-                }
+                    // Lazy load k distances
+                    double d_k_c1 = get_dcc(config, state, k, c1);
 
-                double d_k_c3 = state->dccarray[k * config->maxnbclust + c3];
-                if (d_k_c3 < 0) {
-                        d_k_c3 = get_dist(&state->clusters[k].anchor, &state->clusters[c3].anchor, -1, -1.0, -1.0, config, state);
-                        state->dccarray[k * config->maxnbclust + c3] = d_k_c3;
-                        state->dccarray[c3 * config->maxnbclust + k] = d_k_c3;
-                }
+                    double d_k_c2 = get_dcc(config, state, k, c2);
+
+                    double d_k_c3 = get_dcc(config, state, k, c3);
 
-                double min_d = calc_min_dist_5pt(d_f_c1, d_f_c2, d_f_c3,
-                                                 d_k_c1, d_k_c2, d_k_c3,
-                                                 d_c1_c2, d_c1_c3, d_c2_c3);
+                    double min_d = calc_min_dist_5pt(d_f_c1, d_f_c2, d_f_c3,
+                                                     d_k_c1, d_k_c2, d_k_c3,
+                                                     d_c1_c2, d_c1_c3, d_c2_c3);
 
-                if (min_d > config->rlim) {
-                    state->clmembflag[k] = 0;
-                    local_pruned_te5++;
+                    if (min_d > config->rlim) {
+                        cand_mask_clear_owned(&state->clmemb, k);
+                        local_pruned_te5++;
+                    }
                 }
             }
             state->clusters_pruned += local_pruned_te5;
+            cand_mask_recount(&state->clmemb);
+        }
+    }
+}
+
+// Copy a new anchor into the anchor matrix and release the frame (struct and
+// pixels). If the matrix cannot take it, the anchor keeps the frame buffer.
+// A sparse pixel list and lower-bound summary, if any, move to the anchor.
+static void set_anchor(ClusterConfig *config, ClusterState *state, int idx, Frame *frame) {
+    AnchorMatrix *m = &state->anchor_matrix;
+    if (config->lbound_mode && !frame->lbsum) framedist_summarize(frame);
+    if (state->pca.ready && !frame->pca) pca_basis_project(&state->pca, frame);
+    if (config->sketch_dim > 0 && !frame->sketch) sketch_frame(frame);
+    if (!m->free_slots && anchor_matrix_init(m, frame->width * frame->height, frame->dtype, config->maxnbclust) == 0 &&
+        config->spill_filename && anchor_matrix_spill(m, config->spill_filename) != 0) {
+        fprintf(stderr, "Warning: anchors kept in memory\n");
+    }
+
+    // The anchor is the frame being processed
+    coherence_note(state, idx, 0.0, 1);
+
+    unsigned char *old_base = m->data;
+    int slot = m->free_slots ? anchor_matrix_store(m, frame) : -1;
+    state->clusters[idx].anchor = *frame;
+    state->clusters[idx].slot = slot;
+    if (slot >= 0) {
+        state->clusters[idx].anchor.data = anchor_matrix_row(m, slot);
+        state->clusters[idx].anchor.norm2 = m->norm2[slot];
+        free(frame->data);
+        if (m->data != old_base) {
+            // The matrix grew and moved: refresh the other anchors' rows
+            for (int i = 0; i < state->num_clusters; i++) {
+                if (i != idx && state->clusters[i].slot >= 0) {
+                    state->clusters[i].anchor.data = anchor_matrix_row(m, state->clusters[i].slot);
+                }
+            }
         }
     }
+    free(frame);
+    pq_encode_anchor(state, idx);
+}
+
+// Anchors per framedist_batch call of a new dcc row. A multiple of the
+// batch kernels' group sizes, so each distance comes out as in a single call.
+#define DCC_ROW_CHUNK 256
+
+// Map new cluster 'idx' in the dcc store and fill its distances to clusters
+// 0..idx-1 with batched passes over the anchors, chunks split across threads.
+static void fill_new_dcc_row(ClusterConfig *config, ClusterState *state, int idx) {
+    dcc_store_add(&state->dcc, idx);
+    int n = idx;
+    if (n > 0) {
+        Frame **others = (Frame **)malloc(n * sizeof(Frame *));
+        double *norms = (double *)malloc(n * sizeof(double));
+        double *dists = (double *)malloc(n * sizeof(double));
+        if (!others || !norms || !dists) {
+            perror("Memory allocation failed for dcc row");
+            free(others);
+            free(norms);
+            free(dists);
+            return;
+        }
+
+        int nchunks = (n + DCC_ROW_CHUNK - 1) / DCC_ROW_CHUNK;
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(static) if(config->ncpu > 1 && nchunks > 1)
+        #endif
+        for (int c = 0; c < nchunks; c++) {
+            int i0 = c * DCC_ROW_CHUNK;
+            int cn = (n - i0 < DCC_ROW_CHUNK) ? n - i0 : DCC_ROW_CHUNK;
+            for (int i = i0; i < i0 + cn; i++) {
+                others[i] = &state->clusters[i].anchor;
+                int slot = state->clusters[i].slot;
+                norms[i] = (slot >= 0) ? state->anchor_matrix.norm2[slot] : framedist_norm2(others[i]);
+            }
+            framedist_batch(&state->clusters[idx].anchor, others + i0, norms + i0, cn, dists + i0);
+        }
+        state->framedist_calls += n;
+
+        for (int i = 0; i < n; i++) {
+            double d = dists[i];
+            if (config->distall_mode && state->distall_out) {
+                double ratio = (config->rlim > 0.0) ? d / config->rlim : -1.0;
+                fprintf(state->distall_out, "%-8d %-8d %-12.6f %-12.6f %-8d %-12.6f %-12.6f\n", state->clusters[idx].anchor.id, others[i]->id, d, ratio, -1, -1.0, -1.0);
+            }
+            dcc_store_put(&state->dcc, idx, i, d);
+        }
+        free(others);
+        free(norms);
+        free(dists);
+    }
+    dcc_store_put(&state->dcc, idx, idx, 0.0);
 }
 
 static void remove_cluster(ClusterState *state, ClusterConfig *config, int index_to_remove, int index_target) {
@@ -402,9 +1282,15 @@ static void remove_cluster(ClusterState *state, ClusterConfig *config, int index
     }
 
     // 3. Shift Clusters Array
-    if (state->clusters[index_to_remove].anchor.data) {
+    if (state->clusters[index_to_remove].slot >= 0) {
+        anchor_matrix_release(&state->anchor_matrix, state->clusters[index_to_remove].slot);
+    } else if (state->clusters[index_to_remove].anchor.data) {
         free(state->clusters[index_to_remove].anchor.data);
     }
+    framedist_drop_sparse(&state->clusters[index_to_remove].anchor);
+    framedist_drop_summary(&state->clusters[index_to_remove].anchor);
+    pca_basis_drop(&state->clusters[index_to_remove].anchor);
+    sketch_drop(&state->clusters[index_to_remove].anchor);
     // Shift clusters down
     for (int i = index_to_remove; i < state->num_clusters - 1; i++) {
         state->clusters[i] = state->clusters[i+1];
@@ -421,36 +1307,11 @@ static void remove_cluster(ClusterState *state, ClusterConfig *config, int index
     // Zero out the last one (moved)
     memset(&state->cluster_visitors[state->num_clusters - 1], 0, sizeof(VisitorList));
 
-    // 5. Shift DCC Array (Rows and Cols)
-    // Row shift: move rows i+1..N to i..N-1
-    // Col shift: for each row, move cols j+1..N to j..N-1
-    // Easier to just rebuild? No, expensive.
-    // Move rows:
-    int N = config->maxnbclust; // Stride is fixed maxnbclust
+    // 5. Free the cluster's DCC slot; the others keep theirs
+    dcc_store_remove(&state->dcc, index_to_remove);
+    int N = config->maxnbclust; // Transition matrix stride
 
-    // Shift Rows up
-    for (int r = index_to_remove; r < state->num_clusters - 1; r++) {
-        // Copy row r+1 to r
-        // memcpy(dest, src, size)
-        // Dest: &dcc[r*N], Src: &dcc[(r+1)*N], Size: N doubles? No, we copy full width
-        memcpy(&state->dccarray[r * N], &state->dccarray[(r + 1) * N], config->maxnbclust * sizeof(double));
-    }
-    // Now rows are shifted. Row 'index_to_remove' is gone (overwritten).
-    // Now shift Columns left for ALL rows (including the ones we just moved)
-    // Actually we only care about rows 0..num_clusters-2
-    for (int r = 0; r < state->num_clusters - 1; r++) {
-        // Shift cols in row r
-        // Move &dcc[r*N + index_to_remove + 1] to &dcc[r*N + index_to_remove]
-        // Count: num_clusters - 1 - index_to_remove
-        int dest_idx = r * N + index_to_remove;
-        int src_idx = r * N + index_to_remove + 1;
-        int count = config->maxnbclust - 1 - index_to_remove; // safe upper bound
-        if (count > 0) {
-            memmove(&state->dccarray[dest_idx], &state->dccarray[src_idx], count * sizeof(double));
-        }
-    }
-
-    // 6. Shift Transition Matrix (Same logic as DCC)
+    // 6. Shift Transition Matrix
     // Shift Rows
     for (int r = index_to_remove; r < state->num_clusters - 1; r++) {
         memcpy(&state->transition_matrix[r * N], &state->transition_matrix[(r + 1) * N], config->maxnbclust * sizeof(long));
@@ -522,6 +1383,15 @@ static void remove_cluster(ClusterState *state, ClusterConfig *config, int index
 
     // 8. Decrement Num Clusters
     state->num_clusters--;
+    state->finfo_valid_from = state->total_frames_processed + 1;
+    delta_invalidate(config, state);
+    coherence_remove(state, index_to_remove);
+    pq_remove(state, index_to_remove);
+    prob_remove(state, index_to_remove);
+    pivot_invalidate(config, state);
+    vptree_remove(&state->vptree, index_to_remove);
+    nsw_remove(&state->nsw, index_to_remove);
+    grid_index_remove(&state->grid, index_to_remove);
 }
 
 
@@ -535,6 +1405,29 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
     long actual_frames = get_num_frames();
     if (actual_frames > config->maxnbfr) actual_frames = config->maxnbfr;
 
+    framedist_set_guard(config->rlim);
+    framedist_order_setup(config->varorder_frames);
+    // Room for as many removed nodes as live ones between rebuilds
+    if (config->index_mode == ANCHOR_INDEX_VPTREE && vptree_init(&state->vptree, 2 * config->maxnbclust) != 0) {
+        config->index_mode = ANCHOR_INDEX_LINEAR;
+    }
+    if (config->index_mode == ANCHOR_INDEX_HNSW) {
+        if (nsw_init(&state->nsw, config->maxnbclust) != 0) config->index_mode = ANCHOR_INDEX_LINEAR;
+        state->nsw_ef = config->index_ef;
+    }
+    if (config->index_mode == ANCHOR_INDEX_GRID) {
+        int dim = (int)(get_frame_width() * get_frame_height());
+        if (grid_index_init(&state->grid, dim, config->rlim, config->maxnbclust) != 0) {
+            config->index_mode = ANCHOR_INDEX_LINEAR;
+        } else if (config->verbose_level >= 1) {
+            printf("Grid index: %d-D cells of side %g\n", dim, config->rlim);
+        }
+    }
+    if (config->pca_k > 0) {
+        pca_basis_init(&state->pca, config->pca_k, config->pca_frames, get_frame_width() * get_frame_height(), get_frame_dtype());
+    }
+    if (config->pq_m > 0) pq_setup(config, state);
+
     // Allocate assignments array
     state->assignments = (int *)malloc(actual_frames * sizeof(int));
     state->frame_infos = (FrameInfo *)calloc(actual_frames, sizeof(FrameInfo));
@@ -550,7 +1443,8 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
     int *temp_indices = (int *)malloc(config->maxnbclust * sizeof(int));
     double *temp_dists = (double *)malloc(config->maxnbclust * sizeof(double));
-    if (!temp_indices || !temp_dists) {
+    unsigned char *temp_exact = (unsigned char *)malloc(config->maxnbclust * sizeof(unsigned char));
+    if (!temp_indices || !temp_dists || !temp_exact) {
         perror("Memory allocation failed for temp buffers");
         return;
     }
@@ -563,6 +1457,37 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
     // For sorting candidates when transition matrix is used
     Candidate *sorting_candidates = (Candidate *)malloc(config->maxnbclust * sizeof(Candidate));
 
+    // Probability order of the walk, produced as far as the walk goes
+    ProbOrder prob_order;
+    memset(&prob_order, 0, sizeof(ProbOrder));
+    prob_order.tm = (Candidate *)malloc(config->maxnbclust * sizeof(Candidate));
+    prob_order.tm_mark = (unsigned char *)calloc(config->maxnbclust, sizeof(unsigned char));
+    if (!sorting_candidates || !prob_order.tm || !prob_order.tm_mark || prob_heap_init(&state->prob_heap, config->maxnbclust) != 0) {
+        perror("Memory allocation failed for candidate order");
+        return;
+    }
+    if (config->gprob_mode && tournament_init(&state->gprob_tree, config->maxnbclust) != 0) return;
+
+    #ifdef _OPENMP
+    state->nthread_counters = omp_get_max_threads();
+    state->thread_counters = (ThreadCounters *)calloc(state->nthread_counters, sizeof(ThreadCounters));
+    if (!state->thread_counters) state->nthread_counters = 0;
+    #endif
+
+    // Sketch distances of the current frame to each anchor, and rejections
+    double *sketch_d = NULL;
+    unsigned char *sketch_rej = NULL;
+    double sketch_radius = -1.0;
+    if (config->sketch_dim > 0) {
+        sketch_d = (double *)malloc(config->maxnbclust * sizeof(double));
+        sketch_rej = (unsigned char *)calloc(config->maxnbclust, sizeof(unsigned char));
+        if (!sketch_d || !sketch_rej) {
+            perror("Memory allocation failed for sketch buffers");
+            return;
+        }
+        sketch_radius = sketch_reject_radius(config->rlim, config->sketch_conf);
+    }
+
     FILE *ascii_out = NULL;
     if (config->output_membership) {
         char out_path[1024];
@@ -600,24 +1525,56 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
             printf("\n  [VV] Processing Frame %5ld (Clusters: %4d)\n", state->total_frames_processed, state->num_clusters);
         }
 
+        if (config->varorder_frames > 1 && !framedist_order_ready()) {
+            framedist_order_add(current_frame);
+        }
+        if (config->pca_k > 0 && !state->pca.ready && pca_basis_add(&state->pca, current_frame)) {
+            // Anchors created while learning get their coefficients now
+            for (int i = 0; i < state->num_clusters; i++) pca_basis_project(&state->pca, &state->clusters[i].anchor);
+            printf("PCA basis: %d components from %ld frames (%.1f%% of variance)\n",
+                   state->pca.k, state->pca.ntrain, 100.0 * state->pca.explained);
+        }
+        if (config->pq_m > 0 && !state->pq.ready && pq_codebook_add(&state->pq, current_frame)) {
+            for (int i = 0; i < state->num_clusters; i++) pq_encode_anchor(state, i);
+            printf("PQ codebook: %d sub-vectors x %d centroids from %ld frames\n", state->pq.m, state->pq.k, state->pq.ntrain);
+        }
+        delta_begin_frame(config, state, current_frame);
+        coherence_begin_frame(config, state, current_frame);
+        // -gprob rescales clusters by fmatch of the visitors' stored distances,
+        // which needs them exact: a lower bound would change the order
+        int can_abandon = config->abandon_mode && !config->gprob_mode && framedist_num_blocks(current_frame->width * current_frame->height) > 1;
+        // 3-point pruning needs the triangle inequality
+        int triangle_ok = metric_is_metric(framedist_get_metric());
+        // Lower-bound rejection, from the second candidate on (the first one
+        // usually matches). The distance dump needs every value, -gprob exact ones.
+        int lbound_ok = config->lbound_mode && !config->gprob_mode && !(config->distall_mode && state->distall_out);
+        // Pivot distances are computed ahead of the search, out of the dump order
+        int pivots_usable = config->pivots > 0 && !(config->distall_mode && state->distall_out);
+        // The VP-tree replaces the probability walk and its per-step O(N)
+        // pruning; -gprob keeps the linear path
+        int index_ok = !config->gprob_mode &&
+                       ((config->index_mode == ANCHOR_INDEX_VPTREE && triangle_ok) || config->index_mode == ANCHOR_INDEX_HNSW ||
+                        config->index_mode == ANCHOR_INDEX_GRID);
+
         int assigned_cluster = -1;
         int temp_count = 0;
         long start_pruned_val = state->clusters_pruned;
 
         if (state->num_clusters == 0) {
             // Step 0
-            state->clusters[0].anchor = *current_frame;
+            set_anchor(config, state, 0, current_frame);
             state->clusters[0].id = 0;
-            state->clusters[0].prob = 1.0;
+            prob_add_cluster(state, 0);
             state->num_clusters = 1;
             assigned_cluster = 0;
-            state->dccarray[0] = 0.0;
-            free(current_frame); // Struct only, data transferred
+            fill_new_dcc_row(config, state, 0);
+            index_cluster_created(config, state, 0, 0);
 
             add_visitor(&state->cluster_visitors[0], state->total_frames_processed);
 
             temp_indices[0] = 0;
             temp_dists[0] = 0.0;
+            temp_exact[0] = 1;
             temp_count = 1;
 
             if (config->verbose_level >= 2) {
@@ -625,70 +1582,136 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
             }
         } else {
             // Step 1
-            double sum_prob = 0.0;
-            for (int i = 0; i < state->num_clusters; i++) sum_prob += state->clusters[i].prob;
-            if (sum_prob > 0) {
-                for (int i = 0; i < state->num_clusters; i++) state->clusters[i].prob /= sum_prob;
-            }
+            prob_begin_frame(state);
+            gprob_reset(state, config->maxnbclust);
+            cand_mask_fill(&state->clmemb, state->num_clusters);
+            pivot_begin_frame(state);
 
-            for (int i = 0; i < state->num_clusters; i++) state->current_gprobs[i] = 1.0;
-            for (int i = 0; i < state->num_clusters; i++) state->clmembflag[i] = 1;
+            // PCA pre-pass: drop anchors whose subspace lower bound exceeds rlim
+            if (state->pca.ready && pca_basis_project(&state->pca, current_frame)) {
+                for (int i = 0; i < state->num_clusters; i++) {
+                    const double *ca = state->clusters[i].anchor.pca;
+                    if (ca && pca_basis_lower_bound(&state->pca, current_frame->pca, ca) > config->rlim) {
+                        cand_mask_clear(&state->clmemb, i);
+                        state->pca_rejected++;
+                    }
+                }
+            }
 
-            // Calculate mixed probabilities
-            double trans_prob_sum = 0.0;
-            if (config->tm_mixing_coeff > 0.0 && prev_assigned_cluster != -1) {
+            // Sketch pre-pass: sketch distances rank the candidates and reject
+            // anchors that are unlikely to be within rlim
+            int sketch_ok = config->sketch_dim > 0 && (current_frame->sketch || sketch_frame(current_frame));
+            if (sketch_ok) {
                 for (int i = 0; i < state->num_clusters; i++) {
-                    trans_prob_sum += (double)state->transition_matrix[prev_assigned_cluster * config->maxnbclust + i];
+                    sketch_rej[i] = 0;
+                    sketch_d[i] = state->clusters[i].anchor.sketch ? sketch_dist(current_frame, &state->clusters[i].anchor) : 0.0;
+                    if (sketch_radius >= 0.0 && cand_mask_test(&state->clmemb, i) && sketch_d[i] > sketch_radius) {
+                        cand_mask_clear(&state->clmemb, i);
+                        sketch_rej[i] = 1;
+                        state->sketch_rejected++;
+                    }
                 }
             }
 
-            for (int i = 0; i < state->num_clusters; i++) {
-                double prior = state->clusters[i].prob;
-                double tp = 0.0;
-                if (config->tm_mixing_coeff > 0.0 && prev_assigned_cluster != -1 && trans_prob_sum > 0.0) {
-                    tp = (double)state->transition_matrix[prev_assigned_cluster * config->maxnbclust + i] / trans_prob_sum;
-                    state->mixed_probs[i] = (1.0 - config->tm_mixing_coeff) * prior + config->tm_mixing_coeff * tp;
-                } else {
-                    state->mixed_probs[i] = prior;
+            // Grid lookup under -gprob: anchors outside the cells around the
+            // frame are out of range
+            if (config->index_mode == ANCHOR_INDEX_GRID && config->gprob_mode) {
+                GridIndex *g = &state->grid;
+                int n = grid_index_query(g, current_frame);
+                for (int i = 0; i < n; i++) g->mark[g->hits[i]] = 1;
+                for (int i = 0; i < state->num_clusters; i++) {
+                    if (!g->mark[i]) cand_mask_clear(&state->clmemb, i);
                 }
+                for (int i = 0; i < n; i++) g->mark[g->hits[i]] = 0;
             }
 
-            if (!config->gprob_mode) {
-                // Sort based on mixed_probs
-                for(int i=0; i<state->num_clusters; i++) {
-                    sorting_candidates[i].id = i;
-                    sorting_candidates[i].p = state->mixed_probs[i];
+            // Calculate mixed probabilities, for the consumers that read them
+            // per cluster; the probability walk gets its order from the heap
+            if (config->gprob_mode || index_ok || state->coherence.lo || verbose_candidates) {
+                double trans_prob_sum = 0.0;
+                if (config->tm_mixing_coeff > 0.0 && prev_assigned_cluster != -1) {
+                    for (int i = 0; i < state->num_clusters; i++) {
+                        trans_prob_sum += (double)state->transition_matrix[prev_assigned_cluster * config->maxnbclust + i];
+                    }
                 }
-                qsort(sorting_candidates, state->num_clusters, sizeof(Candidate), compare_candidates);
-                for(int i=0; i<state->num_clusters; i++) {
-                    state->probsortedclindex[i] = sorting_candidates[i].id;
+
+                for (int i = 0; i < state->num_clusters; i++) {
+                    double prior = prob_prior(state, i);
+                    double tp = 0.0;
+                    if (config->tm_mixing_coeff > 0.0 && prev_assigned_cluster != -1 && trans_prob_sum > 0.0) {
+                        tp = (double)state->transition_matrix[prev_assigned_cluster * config->maxnbclust + i] / trans_prob_sum;
+                        state->mixed_probs[i] = (1.0 - config->tm_mixing_coeff) * prior + config->tm_mixing_coeff * tp;
+                    } else {
+                        state->mixed_probs[i] = prior;
+                    }
+                }
+            }
+
+            // Bounds carried over from the previous frame
+            int coherent = coherence_match(config, state);
+
+            // Under -gprob, the candidates are taken in probability order
+            // until a gprob is updated (all are 1.0 until then); the
+            // tournament tree takes over from the first update
+            int gprob_tree_live = 0;
+
+            if (!index_ok && coherent < 0) {
+                prob_order_begin(config, state, &prob_order, prev_assigned_cluster);
+                if (sketch_ok && !config->gprob_mode) {
+                    // Sketch distances rank every candidate: sort them all
+                    for(int i=0; i<state->num_clusters; i++) {
+                        sorting_candidates[i].id = i;
+                        sorting_candidates[i].p = -sketch_d[i];
+                    }
+                    qsort(sorting_candidates, state->num_clusters, sizeof(Candidate), compare_candidates);
+                    for(int i=0; i<state->num_clusters; i++) {
+                        state->probsortedclindex[i] = sorting_candidates[i].id;
+                    }
+                    prob_order.filled = state->num_clusters;
                 }
             }
 
             int k = 0;
             int found = 0;
 
-            if (config->pred_mode && state->total_frames_processed >= config->pred_len) {
+            if (coherent >= 0) {
+                // Within rlim by the triangle inequality: no distance needed
+                assigned_cluster = coherent;
+                prob_reward(config, state, coherent);
+                add_visitor(&state->cluster_visitors[coherent], state->total_frames_processed);
+                state->coherence_assigned++;
+                found = 1;
+                if (config->verbose_level >= 2) {
+                    printf(ANSI_COLOR_GREEN "  [VV] Frame %ld assigned to Cluster %d (Coherence, d < %12.5e)\n" ANSI_COLOR_RESET,
+                           state->total_frames_processed, coherent, state->coherence.hi[coherent]);
+                }
+            }
+
+            if (!found && config->pred_mode && state->total_frames_processed >= config->pred_len) {
                 int *pred_candidates = (int*)malloc(config->pred_n * sizeof(int));
                 if (pred_candidates) {
                     int num_preds = get_prediction_candidates(state, config, pred_candidates, config->pred_n);
 
                     for (int p = 0; p < num_preds; p++) {
                         int cj = pred_candidates[p];
-                        if (cj >= state->num_clusters || !state->clmembflag[cj]) continue;
+                        if (!cand_mask_test(&state->clmemb, cj)) continue;
 
                         if (temp_count < state->max_steps_recorded && state->num_clusters > 0) {
-                            int pruned_cnt = 0;
-                            for(int pc=0; pc<state->num_clusters; pc++) if(state->clmembflag[pc] == 0) pruned_cnt++;
+                            int pruned_cnt = state->num_clusters - state->clmemb.count;
                             state->pruned_fraction_sum[temp_count] += (double)pruned_cnt / state->num_clusters;
                             state->step_counts[temp_count]++;
                         }
 
-                        double dfc = get_dist(current_frame, &state->clusters[cj].anchor, state->clusters[cj].id, state->clusters[cj].prob, state->current_gprobs[cj], config, state);
+                        double bound = can_abandon ? dfc_abandon_bound(config, state, cj) : -1.0;
+                        double lb_reject = (lbound_ok && temp_count > 0) ? config->rlim : -1.0;
+                        int dfc_exact;
+                        double dfc = get_dfc(current_frame, cj, bound, lb_reject, &dfc_exact, config, state);
+                        coherence_note(state, cj, dfc, dfc_exact);
 
                         if (temp_count < config->maxnbclust) {
                             temp_indices[temp_count] = cj;
                             temp_dists[temp_count] = dfc;
+                            temp_exact[temp_count] = dfc_exact;
                             temp_count++;
                         }
 
@@ -696,7 +1719,7 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                         if (dfc < config->rlim) {
                             assigned_cluster = cj;
-                            state->clusters[cj].prob += config->deltaprob;
+                            prob_reward(config, state, cj);
                             found = 1;
                             if (config->verbose_level >= 2) {
                                 printf(ANSI_COLOR_GREEN "  [VV] Frame %ld assigned to Cluster %d (Prediction)\n" ANSI_COLOR_RESET, state->total_frames_processed, assigned_cluster);
@@ -705,98 +1728,134 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
                         }
 
                         long local_pruned = 0;
-                        #ifdef _OPENMP
-                        #pragma omp parallel for reduction(+:local_pruned)
-                        #endif
-                        for (int cl = 0; cl < state->num_clusters; cl++) {
-                            if (state->clmembflag[cl] == 0) continue;
-
-                            double dcc = state->dccarray[cj * config->maxnbclust + cl];
-                            if (dcc < 0) {
-                                dcc = get_dist(&state->clusters[cj].anchor, &state->clusters[cl].anchor, -1, -1.0, -1.0, config, state);
-                                state->dccarray[cj * config->maxnbclust + cl] = dcc;
-                                state->dccarray[cl * config->maxnbclust + cj] = dcc;
-                            }
-
-                            if (dcc - dfc > config->rlim) {
-                                state->clmembflag[cl] = 0;
-                                local_pruned++;
-                            } else if (dfc - dcc > config->rlim) {
-                                state->clmembflag[cl] = 0;
-                                local_pruned++;
+                        if (triangle_ok) {
+                            #ifdef _OPENMP
+                            #pragma omp parallel for reduction(+:local_pruned) if(prune_parallel(config, state))
+                            #endif
+                            for (int w = 0; w < cand_mask_words(&state->clmemb); w++) {
+                                for (uint64_t b = cand_mask_word(&state->clmemb, w); b; b &= b - 1) {
+                                    int cl = (w << 6) + cand_mask_ctz(b);
+
+                                    int dcc_exact;
+                                    double dcc = get_dcc_bounded(config, state, cj, cl, &dcc_exact);
+                                    // A saturated dcc is a lower bound: it only settles the first test
+                                    if (!dcc_exact && !(dfc_exact && dcc - dfc > config->rlim)) dcc = get_dcc(config, state, cj, cl);
+
+                                    // An abandoned or rejected dfc is only a lower bound: the first test needs it exact
+                                    if (dfc_exact && dcc - dfc > config->rlim) {
+                                        cand_mask_clear_owned(&state->clmemb, cl);
+                                        local_pruned++;
+                                    } else if (dfc - dcc > config->rlim) {
+                                        cand_mask_clear_owned(&state->clmemb, cl);
+                                        local_pruned++;
+                                    }
+                                }
                             }
+                            state->clusters_pruned += local_pruned;
+                            cand_mask_recount(&state->clmemb);
                         }
-                        state->clusters_pruned += local_pruned;
 
                         // TE4 Pruning
-                        if (config->te4_mode && temp_count > 1) {
+                        if (config->te4_mode && temp_count > 1 && dfc_exact) {
                             for (int p = 0; p < temp_count - 1; p++) {
+                                if (!temp_exact[p]) continue;
                                 int cprev = temp_indices[p];
                                 double d_m_cprev = temp_dists[p];
-                                double d_ci_cprev = state->dccarray[cj * config->maxnbclust + cprev];
-
-                                if (d_ci_cprev < 0) {
-                                     d_ci_cprev = get_dist(&state->clusters[cj].anchor, &state->clusters[cprev].anchor, -1, -1.0, -1.0, config, state);
-                                     state->dccarray[cj * config->maxnbclust + cprev] = d_ci_cprev;
-                                     state->dccarray[cprev * config->maxnbclust + cj] = d_ci_cprev;
-                                }
+                                double d_ci_cprev = get_dcc(config, state, cj, cprev);
 
                                 long local_pruned_te4 = 0;
                                 #ifdef _OPENMP
-                                #pragma omp parallel for reduction(+:local_pruned_te4)
+                                #pragma omp parallel for reduction(+:local_pruned_te4) if(prune_parallel(config, state))
                                 #endif
-                                for (int k = 0; k < state->num_clusters; k++) {
-                                    if (!state->clmembflag[k]) continue;
-                                    if (k == cj || k == cprev) continue;
-
-                                    double d_ci_ck = state->dccarray[cj * config->maxnbclust + k];
-                                    if (d_ci_ck < 0) {
-                                         d_ci_ck = get_dist(&state->clusters[cj].anchor, &state->clusters[k].anchor, -1, -1.0, -1.0, config, state);
-                                         state->dccarray[cj * config->maxnbclust + k] = d_ci_ck;
-                                         state->dccarray[k * config->maxnbclust + cj] = d_ci_ck;
-                                    }
+                                for (int w = 0; w < cand_mask_words(&state->clmemb); w++) {
+                                    for (uint64_t b = cand_mask_word(&state->clmemb, w); b; b &= b - 1) {
+                                        int k = (w << 6) + cand_mask_ctz(b);
+                                        if (k == cj || k == cprev) continue;
 
-                                    double d_cprev_ck = state->dccarray[cprev * config->maxnbclust + k];
-                                    if (d_cprev_ck < 0) {
-                                         d_cprev_ck = get_dist(&state->clusters[cprev].anchor, &state->clusters[k].anchor, -1, -1.0, -1.0, config, state);
-                                         state->dccarray[cprev * config->maxnbclust + k] = d_cprev_ck;
-                                         state->dccarray[k * config->maxnbclust + cprev] = d_cprev_ck;
-                                    }
+                                        double d_ci_ck = get_dcc(config, state, cj, k);
+
+                                        double d_cprev_ck = get_dcc(config, state, cprev, k);
 
-                                    double min_d = calc_min_dist_4pt(dfc, d_m_cprev, d_ci_cprev, d_ci_ck, d_cprev_ck);
-                                    if (min_d > config->rlim) {
-                                        state->clmembflag[k] = 0;
-                                        local_pruned_te4++;
+                                        double min_d = calc_min_dist_4pt(dfc, d_m_cprev, d_ci_cprev, d_ci_ck, d_cprev_ck);
+                                        if (min_d > config->rlim) {
+                                            cand_mask_clear_owned(&state->clmemb, k);
+                                            local_pruned_te4++;
+                                        }
                                     }
                                 }
                                 state->clusters_pruned += local_pruned_te4;
+                                cand_mask_recount(&state->clmemb);
                             }
                         }
 
                         // TE5 Pruning
                         if (config->te5_mode) {
-                            prune_candidates_te5(config, state, temp_indices, temp_dists, temp_count);
+                            prune_candidates_te5(config, state, temp_indices, temp_dists, temp_exact, temp_count);
                         }
 
-                        state->clmembflag[cj] = 0;
+                        cand_mask_clear(&state->clmemb, cj);
                     }
                     free(pred_candidates);
                 }
             }
 
+            if (index_ok && !found) index_begin(config, state, current_frame, temp_indices, temp_dists, temp_count, sorting_candidates);
+
+            int pivot_done = !pivots_usable;
+            int pq_done = !state->pq.ready;
             while (!found) {
+                // Pivot pass, once the first candidate has missed (it usually
+                // matches): one sweep over the pivot table bounds every anchor,
+                // and the remaining candidates are tried by increasing bound
+                if (!pivot_done && temp_count > 0) {
+                    pivot_done = 1;
+                    if (pivot_sweep(config, state, current_frame)) {
+                        for (int i = cand_mask_next(&state->clmemb, 0); i >= 0; i = cand_mask_next(&state->clmemb, i + 1)) {
+                            if (state->pivots.lb[i] > config->rlim) {
+                                cand_mask_clear(&state->clmemb, i);
+                                state->pivot_pruned++;
+                            }
+                        }
+                        if (!config->gprob_mode && !index_ok) {
+                            prob_order_fill(state, &prob_order, state->num_clusters);
+                            int m = 0;
+                            for (int i = k; i < state->num_clusters; i++) {
+                                sorting_candidates[m].id = state->probsortedclindex[i];
+                                sorting_candidates[m].p = -state->pivots.lb[sorting_candidates[m].id];
+                                m++;
+                            }
+                            qsort(sorting_candidates, m, sizeof(Candidate), compare_candidates);
+                            for (int i = 0; i < m; i++) state->probsortedclindex[k + i] = sorting_candidates[i].id;
+                        }
+                    }
+                }
+                // PQ pass, also deferred: the table costs about one distance per
+                // centroid. The remaining candidates are tried nearest first.
+                if (!pq_done && temp_count > 0) {
+                    pq_done = 1;
+                    if (pq_sweep(config, state, current_frame) && !config->gprob_mode && !index_ok) {
+                        prob_order_fill(state, &prob_order, state->num_clusters);
+                        int m = 0;
+                        for (int i = k; i < state->num_clusters; i++) {
+                            sorting_candidates[m].id = state->probsortedclindex[i];
+                            sorting_candidates[m].p = -state->pq_est[sorting_candidates[m].id];
+                            m++;
+                        }
+                        qsort(sorting_candidates, m, sizeof(Candidate), compare_candidates);
+                        for (int i = 0; i < m; i++) state->probsortedclindex[k + i] = sorting_candidates[i].id;
+                    }
+                }
+
                 if (config->verbose_level >= 2 && verbose_candidates) {
                     int vcount = 0;
-                    for (int i = 0; i < state->num_clusters; i++) {
-                        if (state->clmembflag[i]) {
-                            double p = state->mixed_probs[i];
-                            if (config->gprob_mode) {
-                                p *= state->current_gprobs[i];
-                            }
-                            verbose_candidates[vcount].id = i;
-                            verbose_candidates[vcount].p = p;
-                            vcount++;
+                    for (int i = cand_mask_next(&state->clmemb, 0); i >= 0; i = cand_mask_next(&state->clmemb, i + 1)) {
+                        double p = state->mixed_probs[i];
+                        if (config->gprob_mode) {
+                            p *= gprob_get(state, i);
                         }
+                        verbose_candidates[vcount].id = i;
+                        verbose_candidates[vcount].p = p;
+                        vcount++;
                     }
 
                     if (vcount > 0) {
@@ -812,41 +1871,50 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                 int cj = -1;
 
-                if (!config->gprob_mode) {
-                    while (k < state->num_clusters && state->clmembflag[state->probsortedclindex[k]] == 0) k++;
-                    if (k >= state->num_clusters) break;
+                if (index_ok) {
+                    if (temp_count == 0 && config->index_mode != ANCHOR_INDEX_GRID) cj = index_first(state);
+                    else cj = index_next(config, state, temp_indices, temp_dists, temp_exact, temp_count);
+                    if (cj < 0) break;
+                } else if (!gprob_tree_live) {
+                    // No candidate left: the rest of the order is never produced
+                    if (state->clmemb.count == 0) break;
+                    while (k < state->num_clusters) {
+                        if (k == prob_order.filled) prob_order_fill(state, &prob_order, k + 1);
+                        if (k == prob_order.filled || cand_mask_test(&state->clmemb, state->probsortedclindex[k])) break;
+                        k++;
+                    }
+                    if (k >= prob_order.filled) break;
                     cj = state->probsortedclindex[k];
                     k++;
                 } else {
-                    double max_p = -1.0;
-                    cj = -1;
-                    for (int i = 0; i < state->num_clusters; i++) {
-                        if (state->clmembflag[i]) {
-                            double p = state->mixed_probs[i] * state->current_gprobs[i];
-                            if (p > max_p) {
-                                max_p = p;
-                                cj = i;
-                            }
-                        }
+                    // Highest mixed_probs x gprob among the candidates; pruned
+                    // clusters leave the tree once they reach the top
+                    cj = tournament_top(&state->gprob_tree);
+                    while (cj >= 0 && !cand_mask_test(&state->clmemb, cj)) {
+                        tournament_remove(&state->gprob_tree, cj);
+                        cj = tournament_top(&state->gprob_tree);
                     }
                     if (cj == -1) break;
                 }
 
                 // Track pruning stats
-                if (temp_count < state->max_steps_recorded && state->num_clusters > 0) {
-                    int pruned_cnt = 0;
-                    for(int pc=0; pc<state->num_clusters; pc++) {
-                        if(state->clmembflag[pc] == 0) pruned_cnt++;
-                    }
+                if (!index_ok && temp_count < state->max_steps_recorded && state->num_clusters > 0) {
+                    int pruned_cnt = state->num_clusters - state->clmemb.count;
                     state->pruned_fraction_sum[temp_count] += (double)pruned_cnt / state->num_clusters;
                     state->step_counts[temp_count]++;
                 }
 
-                double dfc = get_dist(current_frame, &state->clusters[cj].anchor, state->clusters[cj].id, state->clusters[cj].prob, state->current_gprobs[cj], config, state);
+                double bound = (can_abandon && !index_ok) ? dfc_abandon_bound(config, state, cj) : -1.0;
+                double lb_reject = (lbound_ok && temp_count > 0) ? config->rlim : -1.0;
+                int dfc_exact;
+                double dfc = get_dfc(current_frame, cj, bound, lb_reject, &dfc_exact, config, state);
+                if (index_ok) index_report(config, state, cj, dfc, dfc_exact);
+                coherence_note(state, cj, dfc, dfc_exact);
 
                 if (temp_count < config->maxnbclust) {
                     temp_indices[temp_count] = cj;
                     temp_dists[temp_count] = dfc;
+                    temp_exact[temp_count] = dfc_exact;
                     temp_count++;
                 }
 
@@ -854,7 +1922,7 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                 if (dfc < config->rlim) {
                     assigned_cluster = cj;
-                    state->clusters[cj].prob += config->deltaprob;
+                    prob_reward(config, state, cj);
                     found = 1;
                     if (config->verbose_level >= 2) {
                         printf(ANSI_COLOR_GREEN "  [VV] Frame %ld assigned to Cluster %d\n" ANSI_COLOR_RESET, state->total_frames_processed, assigned_cluster);
@@ -863,89 +1931,82 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
                 }
 
                 long local_pruned = 0;
-                #ifdef _OPENMP
-                #pragma omp parallel for reduction(+:local_pruned)
-                #endif
-                for (int cl = 0; cl < state->num_clusters; cl++) {
-                    if (state->clmembflag[cl] == 0) continue;
-
-                    double dcc = state->dccarray[cj * config->maxnbclust + cl];
-                    if (dcc < 0) {
-                        dcc = get_dist(&state->clusters[cj].anchor, &state->clusters[cl].anchor, -1, -1.0, -1.0, config, state);
-                        state->dccarray[cj * config->maxnbclust + cl] = dcc;
-                        state->dccarray[cl * config->maxnbclust + cj] = dcc;
-                    }
-
-                    if (dcc - dfc > config->rlim) {
-                        state->clmembflag[cl] = 0;
-                        local_pruned++;
-                    } else if (dfc - dcc > config->rlim) {
-                        state->clmembflag[cl] = 0;
-                        local_pruned++;
+                if (triangle_ok && !index_ok) {
+                    #ifdef _OPENMP
+                    #pragma omp parallel for reduction(+:local_pruned) if(prune_parallel(config, state))
+                    #endif
+                    for (int w = 0; w < cand_mask_words(&state->clmemb); w++) {
+                        for (uint64_t b = cand_mask_word(&state->clmemb, w); b; b &= b - 1) {
+                            int cl = (w << 6) + cand_mask_ctz(b);
+
+                            int dcc_exact;
+                            double dcc = get_dcc_bounded(config, state, cj, cl, &dcc_exact);
+                            // A saturated dcc is a lower bound: it only settles the first test
+                            if (!dcc_exact && !(dfc_exact && dcc - dfc > config->rlim)) dcc = get_dcc(config, state, cj, cl);
+
+                            // An abandoned or rejected dfc is only a lower bound: the first test needs it exact
+                            if (dfc_exact && dcc - dfc > config->rlim) {
+                                cand_mask_clear_owned(&state->clmemb, cl);
+                                local_pruned++;
+                            } else if (dfc - dcc > config->rlim) {
+                                cand_mask_clear_owned(&state->clmemb, cl);
+                                local_pruned++;
+                            }
+                        }
                     }
+                    state->clusters_pruned += local_pruned;
+                    cand_mask_recount(&state->clmemb);
                 }
-                state->clusters_pruned += local_pruned;
 
                 // TE4 Pruning
-                if (config->te4_mode && temp_count > 1) {
+                if (config->te4_mode && temp_count > 1 && dfc_exact) {
                     for (int p = 0; p < temp_count - 1; p++) {
+                        if (!temp_exact[p]) continue;
                         int cprev = temp_indices[p];
                         double d_m_cprev = temp_dists[p];
-                        double d_ci_cprev = state->dccarray[cj * config->maxnbclust + cprev];
-
-                        if (d_ci_cprev < 0) {
-                             d_ci_cprev = get_dist(&state->clusters[cj].anchor, &state->clusters[cprev].anchor, -1, -1.0, -1.0, config, state);
-                             state->dccarray[cj * config->maxnbclust + cprev] = d_ci_cprev;
-                             state->dccarray[cprev * config->maxnbclust + cj] = d_ci_cprev;
-                        }
+                        double d_ci_cprev = get_dcc(config, state, cj, cprev);
 
                         long local_pruned_te4 = 0;
                         #ifdef _OPENMP
-                        #pragma omp parallel for reduction(+:local_pruned_te4)
+                        #pragma omp parallel for reduction(+:local_pruned_te4) if(prune_parallel(config, state))
                         #endif
-                        for (int k = 0; k < state->num_clusters; k++) {
-                            if (!state->clmembflag[k]) continue;
-                            if (k == cj || k == cprev) continue;
-
-                            double d_ci_ck = state->dccarray[cj * config->maxnbclust + k];
-                            if (d_ci_ck < 0) {
-                                 d_ci_ck = get_dist(&state->clusters[cj].anchor, &state->clusters[k].anchor, -1, -1.0, -1.0, config, state);
-                                 state->dccarray[cj * config->maxnbclust + k] = d_ci_ck;
-                                 state->dccarray[k * config->maxnbclust + cj] = d_ci_ck;
-                            }
+                        for (int w = 0; w < cand_mask_words(&state->clmemb); w++) {
+                            for (uint64_t b = cand_mask_word(&state->clmemb, w); b; b &= b - 1) {
+                                int k = (w << 6) + cand_mask_ctz(b);
+                                if (k == cj || k == cprev) continue;
 
-                            double d_cprev_ck = state->dccarray[cprev * config->maxnbclust + k];
-                            if (d_cprev_ck < 0) {
-                                 d_cprev_ck = get_dist(&state->clusters[cprev].anchor, &state->clusters[k].anchor, -1, -1.0, -1.0, config, state);
-                                 state->dccarray[cprev * config->maxnbclust + k] = d_cprev_ck;
-                                 state->dccarray[k * config->maxnbclust + cprev] = d_cprev_ck;
-                            }
+                                double d_ci_ck = get_dcc(config, state, cj, k);
 
-                            double min_d = calc_min_dist_4pt(dfc, d_m_cprev, d_ci_cprev, d_ci_ck, d_cprev_ck);
-                            if (min_d > config->rlim) {
-                                state->clmembflag[k] = 0;
-                                local_pruned_te4++;
+                                double d_cprev_ck = get_dcc(config, state, cprev, k);
+
+                                double min_d = calc_min_dist_4pt(dfc, d_m_cprev, d_ci_cprev, d_ci_ck, d_cprev_ck);
+                                if (min_d > config->rlim) {
+                                    cand_mask_clear_owned(&state->clmemb, k);
+                                    local_pruned_te4++;
+                                }
                             }
                         }
                         state->clusters_pruned += local_pruned_te4;
+                        cand_mask_recount(&state->clmemb);
                     }
                 }
 
                 // TE5 Pruning
                 if (config->te5_mode) {
-                    prune_candidates_te5(config, state, temp_indices, temp_dists, temp_count);
+                    prune_candidates_te5(config, state, temp_indices, temp_dists, temp_exact, temp_count);
                 }
 
-                if (state->clmembflag[cj]) {
-                    state->clmembflag[cj] = 0;
-                }
-
-                int active_cluster_count = 0;
-                for (int i = 0; i < state->num_clusters; i++) {
-                    if (state->clmembflag[i]) active_cluster_count++;
-                }
-
-                if ((config->gprob_mode || (config->distall_mode && state->distall_out) || config->verbose_level >= 2) && active_cluster_count > 1) {
+                cand_mask_clear(&state->clmemb, cj);
+                int active_cluster_count = state->clmemb.count;
+
+                // Visitor scan: gprob update and visitor-history pruning. A
+                // visitor k of cj assigned to T with d(k, T) known bounds
+                // d(frame, T) >= d(frame, k) - d(k, T) >= |dfc - d(k, cj)| - d(k, T).
+                int gprob_scan = config->gprob_mode || (config->distall_mode && state->distall_out) || config->verbose_level >= 2;
+                // The graph search steers on measured distances: pruned anchors
+                // would only be routed through blindly
+                int visit_scan = config->visitprune_mode && triangle_ok && !(index_ok && config->index_mode == ANCHOR_INDEX_HNSW);
+                if (((gprob_scan && active_cluster_count > 1) || (visit_scan && active_cluster_count > 0)) && dfc_exact) {
                     int match_count = state->cluster_visitors[cj].count;
                     if (match_count > 0) match_count--;
 
@@ -963,7 +2024,7 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                         int target_cl = state->frame_infos[k_idx].assignment;
                         if (target_cl < 0 || target_cl >= state->num_clusters) continue; // Skip discarded/invalid
-                        int is_active = state->clmembflag[target_cl];
+                        int is_active = cand_mask_test(&state->clmemb, target_cl);
 
                         if (config->verbose_level >= 2) {
                             if (is_active) {
@@ -977,14 +2038,41 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                         if (!is_active) continue;
 
+                        // Cluster indices of frames before the last removal are stale
+                        int visit_k = visit_scan && k_idx >= state->finfo_valid_from;
                         double dist_k = -1.0;
+                        int exact_k = 1;
+                        double dist_kt = -1.0;
                         for (int d_idx = 0; d_idx < state->frame_infos[k_idx].num_dists; d_idx++) {
-                            if (state->frame_infos[k_idx].cluster_indices[d_idx] == cj) {
+                            int ci = state->frame_infos[k_idx].cluster_indices[d_idx];
+                            if (ci == cj && dist_k < 0.0) {
                                 dist_k = state->frame_infos[k_idx].distances[d_idx];
-                                break;
+                                exact_k = state->frame_infos[k_idx].exact[d_idx];
+                                if (!visit_k) break;
+                            }
+                            if (visit_k && ci == target_cl && state->frame_infos[k_idx].exact[d_idx]) {
+                                dist_kt = state->frame_infos[k_idx].distances[d_idx];
                             }
                         }
 
+                        if (visit_k && dist_k >= 0.0 && dist_kt >= 0.0) {
+                            // An abandoned dist_k only bounds d(frame, k) from one side
+                            double lb = exact_k ? fabs(dfc - dist_k) : dist_k - dfc;
+                            if (lb - dist_kt > config->rlim) {
+                                cand_mask_clear(&state->clmemb, target_cl);
+                                state->visitor_pruned++;
+                                if (config->verbose_level >= 2) {
+                                    printf("    Cluster %4d pruned by visitor frame %5d: distance > %12.5e\n", target_cl, k_idx, lb - dist_kt);
+                                }
+                                continue;
+                            }
+                        }
+                        if (!gprob_scan) continue;
+
+                        // An abandoned dist_k is a lower bound: it only settles
+                        // fmatch when it already puts dr beyond 2 (fmatch = 0).
+                        if (dist_k >= 0 && !exact_k && dist_k - dfc <= 2.0 * config->rlim) continue;
+
                         if (dist_k >= 0) {
                             double dr = fabs(dfc - dist_k) / config->rlim;
                             double val = fmatch(dr, config->fmatch_a, config->fmatch_b);
@@ -995,11 +2083,18 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
                                        k_idx, state->clusters[cj].anchor.id, dist_k,
                                        val,
                                        target_cl,
-                                       state->current_gprobs[target_cl],
-                                       state->current_gprobs[target_cl] * val);
+                                       gprob_get(state, target_cl),
+                                       gprob_get(state, target_cl) * val);
                             }
 
-                            state->current_gprobs[target_cl] *= val;
+                            gprob_scale(state, target_cl, val);
+                            if (config->gprob_mode) {
+                                if (!gprob_tree_live) {
+                                    tournament_build(&state->gprob_tree, state->num_clusters, state->mixed_probs);
+                                    gprob_tree_live = 1;
+                                }
+                                tournament_set(&state->gprob_tree, target_cl, state->mixed_probs[target_cl] * gprob_get(state, target_cl));
+                            }
                         }
                     }
                 }
@@ -1008,16 +2103,28 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
             if (!found) {
                 if (state->num_clusters < config->maxnbclust) {
                     assigned_cluster = state->num_clusters;
-                    state->clusters[state->num_clusters].anchor = *current_frame;
+                    set_anchor(config, state, state->num_clusters, current_frame);
                     state->clusters[state->num_clusters].id = state->num_clusters;
-                    state->clusters[state->num_clusters].prob = 1.0;
+                    prob_add_cluster(state, state->num_clusters);
 
-                    for (int i = 0; i < state->num_clusters; i++) {
-                        double d = get_dist(&state->clusters[state->num_clusters].anchor, &state->clusters[i].anchor, -1, -1.0, -1.0, config, state);
-                        state->dccarray[state->num_clusters * config->maxnbclust + i] = d;
-                        state->dccarray[i * config->maxnbclust + state->num_clusters] = d;
+                    fill_new_dcc_row(config, state, state->num_clusters);
+                    index_cluster_created(config, state, state->num_clusters, index_ok);
+
+                    if (sketch_ok) {
+                        // The new dcc row holds this frame's exact distance to every
+                        // anchor: check the sketch rejections against it
+                        int missed = 0;
+                        for (int i = 0; i < state->num_clusters; i++) {
+                            if (!sketch_rej[i]) continue;
+                            state->sketch_audited++;
+                            double d = dcc_store_get(&state->dcc, state->num_clusters, i);
+                            if (d >= 0.0 && d < config->rlim) {
+                                state->sketch_false_rejects++;
+                                missed = 1;
+                            }
+                        }
+                        state->sketch_extra_clusters += missed;
                     }
-                    state->dccarray[state->num_clusters * config->maxnbclust + state->num_clusters] = 0.0;
 
                     if (config->verbose_level >= 2) {
                         printf(ANSI_COLOR_GREEN "  [VV] Frame %5ld assigned to Cluster %4d\n" ANSI_COLOR_RESET, state->total_frames_processed, assigned_cluster);
@@ -1029,11 +2136,11 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
                     if (temp_count < config->maxnbclust) {
                         temp_indices[temp_count] = state->num_clusters;
                         temp_dists[temp_count] = 0.0;
+                        temp_exact[temp_count] = 1;
                         temp_count++;
                     }
 
                     state->num_clusters++;
-                    free(current_frame);
                 } else {
                     // Max clusters reached - apply strategy
                     if (config->maxcl_strategy == MAXCL_STOP) {
@@ -1075,27 +2182,23 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
                             // Actually, simplest is:
 
                             assigned_cluster = state->num_clusters;
-                            state->clusters[state->num_clusters].anchor = *current_frame;
+                            set_anchor(config, state, state->num_clusters, current_frame);
                             state->clusters[state->num_clusters].id = state->num_clusters;
-                            state->clusters[state->num_clusters].prob = 1.0;
+                            prob_add_cluster(state, state->num_clusters);
 
-                            for (int i = 0; i < state->num_clusters; i++) {
-                                double d = get_dist(&state->clusters[state->num_clusters].anchor, &state->clusters[i].anchor, -1, -1.0, -1.0, config, state);
-                                state->dccarray[state->num_clusters * config->maxnbclust + i] = d;
-                                state->dccarray[i * config->maxnbclust + state->num_clusters] = d;
-                            }
-                            state->dccarray[state->num_clusters * config->maxnbclust + state->num_clusters] = 0.0;
+                            fill_new_dcc_row(config, state, state->num_clusters);
+                            index_cluster_created(config, state, state->num_clusters, index_ok);
 
                             add_visitor(&state->cluster_visitors[state->num_clusters], state->total_frames_processed);
 
                             if (temp_count < config->maxnbclust) {
                                 temp_indices[temp_count] = state->num_clusters;
                                 temp_dists[temp_count] = 0.0;
+                                temp_exact[temp_count] = 1;
                                 temp_count++;
                             }
 
                             state->num_clusters++;
-                            free(current_frame);
                         } else {
                             // Should not happen
                             free_frame(current_frame);
@@ -1108,7 +2211,7 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                         for (int i = 0; i < state->num_clusters; i++) {
                             for (int j = i + 1; j < state->num_clusters; j++) {
-                                double d = state->dccarray[i * config->maxnbclust + j];
+                                double d = dcc_store_get(&state->dcc, i, j);
                                 if (d >= 0 && (min_d < 0 || d < min_d)) {
                                     min_d = d;
                                     best_i = i;
@@ -1132,27 +2235,23 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
                             // Now create new cluster for current frame
                             assigned_cluster = state->num_clusters;
-                            state->clusters[state->num_clusters].anchor = *current_frame;
+                            set_anchor(config, state, state->num_clusters, current_frame);
                             state->clusters[state->num_clusters].id = state->num_clusters;
-                            state->clusters[state->num_clusters].prob = 1.0;
+                            prob_add_cluster(state, state->num_clusters);
 
-                            for (int i = 0; i < state->num_clusters; i++) {
-                                double d = get_dist(&state->clusters[state->num_clusters].anchor, &state->clusters[i].anchor, -1, -1.0, -1.0, config, state);
-                                state->dccarray[state->num_clusters * config->maxnbclust + i] = d;
-                                state->dccarray[i * config->maxnbclust + state->num_clusters] = d;
-                            }
-                            state->dccarray[state->num_clusters * config->maxnbclust + state->num_clusters] = 0.0;
+                            fill_new_dcc_row(config, state, state->num_clusters);
+                            index_cluster_created(config, state, state->num_clusters, index_ok);
 
                             add_visitor(&state->cluster_visitors[state->num_clusters], state->total_frames_processed);
 
                             if (temp_count < config->maxnbclust) {
                                 temp_indices[temp_count] = state->num_clusters;
                                 temp_dists[temp_count] = 0.0;
+                                temp_exact[temp_count] = 1;
                                 temp_count++;
                             }
 
                             state->num_clusters++;
-                            free(current_frame);
                         } else {
                             free_frame(current_frame);
                             break;
@@ -1184,15 +2283,20 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
         if (temp_count > 0) {
             state->frame_infos[state->total_frames_processed].cluster_indices = (int *)malloc(temp_count * sizeof(int));
             state->frame_infos[state->total_frames_processed].distances = (double *)malloc(temp_count * sizeof(double));
-            if (state->frame_infos[state->total_frames_processed].cluster_indices && state->frame_infos[state->total_frames_processed].distances) {
+            state->frame_infos[state->total_frames_processed].exact = (unsigned char *)malloc(temp_count * sizeof(unsigned char));
+            if (state->frame_infos[state->total_frames_processed].cluster_indices && state->frame_infos[state->total_frames_processed].distances && state->frame_infos[state->total_frames_processed].exact) {
                 memcpy(state->frame_infos[state->total_frames_processed].cluster_indices, temp_indices, temp_count * sizeof(int));
                 memcpy(state->frame_infos[state->total_frames_processed].distances, temp_dists, temp_count * sizeof(double));
+                memcpy(state->frame_infos[state->total_frames_processed].exact, temp_exact, temp_count * sizeof(unsigned char));
             }
         } else {
             state->frame_infos[state->total_frames_processed].cluster_indices = NULL;
             state->frame_infos[state->total_frames_processed].distances = NULL;
+            state->frame_infos[state->total_frames_processed].exact = NULL;
         }
 
+        coherence_end_frame(state, temp_count > 0);
+        merge_thread_counters(state);
         state->total_frames_processed++;
 
         if (state->dist_counts && temp_count <= config->maxnbclust) {
@@ -1234,6 +2338,7 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
     }
 
     if (config->progress_mode) printf("\n");
+    merge_thread_counters(state);
 
     clock_gettime(CLOCK_MONOTONIC, &end);
     double elapsed_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
@@ -1246,6 +2351,41 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
     printf("Total clusters: %d\n", state->num_clusters);
     printf("Processing time: %.3f ms\n", elapsed_ms);
     printf("Framedist calls: %ld\n", state->framedist_calls);
+    if (state->framedist_abandoned > 0) {
+        printf("Early-abandoned distances: %ld\n", state->framedist_abandoned);
+    }
+    if (state->framedist_lbound > 0) {
+        printf("Lower-bound skipped distances: %ld\n", state->framedist_lbound);
+    }
+    if (config->pca_k > 0) {
+        printf("PCA-rejected anchors: %ld\n", state->pca_rejected);
+    }
+    if (config->sketch_dim > 0) {
+        printf("Sketch-rejected anchors: %ld (false rejects: %ld of %ld checked, %ld extra clusters)\n",
+               state->sketch_rejected, state->sketch_false_rejects, state->sketch_audited, state->sketch_extra_clusters);
+    }
+    if (config->index_mode == ANCHOR_INDEX_HNSW) {
+        printf("hnsw duplicate clusters: %ld of %ld checked (beam width %d)\n", state->nsw_duplicates, state->nsw_checked, state->nsw_ef);
+    }
+    if (config->pivots > 0) {
+        printf("Pivot-pruned anchors: %ld\n", state->pivot_pruned);
+    }
+    if (config->pq_m > 0) {
+        printf("PQ-rejected anchors: %ld\n", state->pq_rejected);
+    }
+    if (config->visitprune_mode) {
+        printf("Visitor-pruned anchors: %ld\n", state->visitor_pruned);
+    }
+    if (config->coherence_mode) {
+        printf("Coherence: %ld frames assigned without a distance, %ld anchors pruned\n",
+               state->coherence_assigned, state->coherence_pruned);
+    }
+    if (config->sparse_fill > 0.0) {
+        printf("Sparse frames: %ld\n", get_sparse_frames());
+    }
+    if (config->delta_period > 0) {
+        printf("Delta-updated distances: %ld\n", state->framedist_delta);
+    }
 
     if (ascii_out) fclose(ascii_out);
 
@@ -1260,6 +2400,23 @@ void run_clustering(ClusterConfig *config, ClusterState *state) {
 
     free(temp_indices);
     free(temp_dists);
+    free(temp_exact);
+    delta_free(&state->delta);
+    coherence_free(&state->coherence);
+    pivot_free(&state->pivots);
+    pq_free(state);
+    vptree_free(&state->vptree);
+    nsw_free(&state->nsw);
+    grid_index_free(&state->grid);
     if (verbose_candidates) free(verbose_candidates);
     if (sorting_candidates) free(sorting_candidates);
+    free(prob_order.tm);
+    free(prob_order.tm_mark);
+    prob_heap_free(&state->prob_heap);
+    tournament_free(&state->gprob_tree);
+    free(state->thread_counters);
+    state->thread_counters = NULL;
+    state->nthread_counters = 0;
+    free(sketch_d);
+    free(sketch_rej);
 }
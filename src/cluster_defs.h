@@ -4,6 +4,16 @@
 #include <stdio.h>
 #include <signal.h>
 #include "common.h"
+#include "anchor_matrix.h"
+#include "cand_mask.h"
+#include "dcc_store.h"
+#include "prob_heap.h"
+#include "tournament_tree.h"
+#include "pca_basis.h"
+#include "pq_codebook.h"
+#include "vptree.h"
+#include "nsw_graph.h"
+#include "grid_index.h"
 
 // Max Cluster Strategy Enum
 typedef enum {
@@ -12,6 +22,15 @@ typedef enum {
     MAXCL_MERGE = 2
 } MaxClustStrategy;
 
+// Anchor search index
+typedef enum {
+    ANCHOR_INDEX_LINEAR = 0, // Candidates in probability order, 3-point pruning
+    ANCHOR_INDEX_VPTREE = 1, // Best-first VP-tree search
+    ANCHOR_INDEX_HNSW = 2,   // Approximate beam search on a small-world graph
+    ANCHOR_INDEX_GRID = 3,   // Exact hash-grid lookup (low-dimensional frames)
+    ANCHOR_INDEX_AUTO = 4    // grid for low-dimensional frames, else linear
+} AnchorIndexMode;
+
 // Configuration structure
 typedef struct {
     double rlim;
@@ -46,6 +65,29 @@ typedef struct {
     double tm_mixing_coeff;
     MaxClustStrategy maxcl_strategy;
     double discard_fraction;
+    int simd_level; // SimdLevel for framedist (-1 = auto)
+    FrameDType precision; // Frame/anchor storage type
+    int abandon_mode; // Early-abandon frame-to-anchor distances
+    long varorder_frames; // Frames used to train the variance-first block order (0 = off)
+    int metric; // DistMetric used by framedist
+    char *weights_filename; // Per-pixel weight map for the wl2 metric
+    double sparse_fill; // Max nonzero fraction for sparse frames (0 = off)
+    int delta_period; // Delta mode: incremental updates before a full recompute (0 = off)
+    int lbound_mode; // Skip frame-to-anchor distances whose lower bound exceeds rlim
+    int pca_k; // PCA pre-pass components (0 = off)
+    long pca_frames; // Frames the PCA basis is learned from
+    int sketch_dim; // JL sketch size (0 = off)
+    double sketch_conf; // Sketch rejection confidence (>= 1: ordering only)
+    int pivots; // Pivot (LAESA) index size (0 = off)
+    AnchorIndexMode index_mode;
+    int index_ef; // hnsw beam width
+    double index_recall; // hnsw target recall: widen the beam when duplicates exceed 1 - recall (0 = fixed ef)
+    int visitprune_mode; // Triangle pruning from the visitor history of each tested anchor
+    int coherence_mode; // Carry distance bounds over from the last frame that measured distances
+    int pq_m; // Product-quantizer sub-vectors for anchor lower bounds (0 = off)
+    long pq_frames; // Frames the PQ codebook is learned from
+    char *spill_filename; // Memory-mapped file backing the anchor matrix (NULL = heap)
+    DccType dcc_type; // Entry type of the anchor-to-anchor distance cache
     
     // Output control flags
     int output_dcc;
@@ -65,16 +107,109 @@ typedef struct {
     int capacity;
 } VisitorList;
 
+// Delta mode: previous frame pixels and its squared distances to anchors.
+// d2[c] is usable for the current frame when stamp[c] == seq - 1.
+typedef struct {
+    void *prev;          // Previous frame pixels
+    void *next;          // Current frame pixels (becomes prev)
+    size_t frame_bytes;
+    int have_prev;
+    int active;          // changed[] is valid for the current frame
+    uint32_t *changed;   // Pixels that differ from the previous frame
+    long nchanged;
+    long max_changed;    // Above this, full distances are cheaper
+    long seq;            // Processed-frame counter
+    double *d2;          // Per cluster
+    long *stamp;         // seq at which d2 was computed
+    int *age;            // Incremental updates since the last full distance
+} DeltaCache;
+
+// Temporal coherence: bounds on the distance from each anchor to a reference
+// frame, the last frame that measured distances. Once d(ref, frame) is known,
+// the triangle inequality carries them over to the current frame.
+typedef struct {
+    Frame ref;           // Reference frame (data owned, no caches)
+    Frame next;          // Copy of the current frame (becomes ref)
+    size_t frame_bytes;
+    int have_ref;
+    double *lo;          // Per cluster: lower bound on d(ref, anchor) (0: none)
+    double *hi;          // Per cluster: upper bound (INFINITY: none)
+    double *cur_lo;      // Same for the current frame
+    double *cur_hi;
+} CoherenceCache;
+
+// Pivot (LAESA) index: distances from a few well-spread pivot anchors to
+// every anchor, copied from the dcc store into one contiguous table so that the
+// lower bounds of all anchors come out of a single pass.
+typedef struct {
+    int count;           // Pivots in use (0 = select on the next frame)
+    int *idx;            // Pivot cluster indices
+    double *table;       // count rows of maxnbclust: d(pivot, anchor)
+    int cols;            // Anchors copied into the table
+    int selected_at;     // num_clusters when the pivots were selected
+    double *dfp;         // Current frame to each pivot
+    double *lb;          // Per anchor: max_p |d(f, p) - d(p, anchor)|
+    double *dist;        // Per anchor: exact distance to the current frame (pivots only, else -1)
+} PivotIndex;
+
+// Distance counters of one OpenMP thread, padded to a cache line. Parallel
+// loops count here and the totals are merged into ClusterState after them.
+typedef struct {
+    long framedist_calls;
+    long framedist_abandoned;
+    char pad[64 - 2 * sizeof(long)];
+} ThreadCounters;
+
 // State structure
 typedef struct {
     Cluster *clusters;
+    AnchorMatrix anchor_matrix; // Contiguous storage for cluster anchors
     VisitorList *cluster_visitors;
-    double *current_gprobs;
-    double *dccarray; // 1D array simulating 2D: [i*maxNcl + j]
+    double *current_gprobs; // Valid where gprob_stamp == gprob_epoch, 1.0 elsewhere
+    unsigned int *gprob_stamp;
+    unsigned int gprob_epoch; // Advanced every frame instead of resetting current_gprobs
+    TournamentTree gprob_tree; // -gprob: clusters by mixed_probs x gprob (pruned ones dropped when they win)
+    DccStore dcc; // Anchor-to-anchor distances
     int *probsortedclindex;
-    int *clmembflag;
+    ProbHeap prob_heap; // Clusters by prior weight (clusters[i].prob)
+    double prob_total; // Sum of the prior weights
+    double prob_unit; // Weight of a prior of 1.0 this frame (prob_total at frame start)
+    CandMask clmemb; // Clusters still candidates for the current frame
     int num_clusters;
     long framedist_calls;
+    long framedist_abandoned; // framedist calls stopped at their bound (lower bound only)
+    ThreadCounters *thread_counters; // Per thread, merged once per frame
+    int nthread_counters;
+    long framedist_delta; // Frame-to-anchor distances updated incrementally (delta mode)
+    long framedist_lbound; // Frame-to-anchor distances skipped on a lower bound (not in framedist_calls)
+    PcaBasis pca; // PCA pre-pass basis
+    long pca_rejected; // Anchors rejected by the PCA pre-pass
+    long sketch_rejected; // Anchors rejected on their sketch distance
+    long sketch_audited; // Rejections checked against an exact distance (new-cluster frames)
+    long sketch_false_rejects; // Audited rejections that were within rlim
+    long sketch_extra_clusters; // Clusters created only because of a false rejection
+    DeltaCache delta;
+    CoherenceCache coherence;
+    long visitor_pruned; // Anchors rejected on a visitor-history bound
+    long finfo_valid_from; // frame_infos cluster indices are current from this frame on
+    long coherence_assigned; // Frames assigned on a carried upper bound
+    long coherence_pruned; // Anchors rejected on a carried lower bound
+    PqCodebook pq;
+    unsigned char *pq_codes; // maxnbclust x pq.m anchor codes, by cluster index
+    double *pq_resid; // ||anchor - decoded anchor|| (< 0: not coded)
+    double *pq_table; // Per-frame distance table
+    double *pq_est; // Per-frame ||frame - decoded anchor||
+    long pq_rejected; // Anchors rejected on their PQ lower bound
+    PivotIndex pivots;
+    long pivot_pruned; // Anchors rejected on their pivot lower bound
+    VpTree vptree; // Anchor index (index_mode == ANCHOR_INDEX_VPTREE)
+    NswGraph nsw; // Anchor index (index_mode == ANCHOR_INDEX_HNSW)
+    GridIndex grid; // Anchor index (index_mode == ANCHOR_INDEX_GRID)
+    int nsw_ef; // Current beam width
+    long nsw_checked; // New clusters checked against their exact dcc row
+    long nsw_duplicates; // Checked clusters that had an anchor within rlim
+    long nsw_window_checked; // Since the last beam width update
+    long nsw_window_duplicates;
     long clusters_pruned;
     int *assignments;
     FrameInfo *frame_infos;
@@ -7,7 +7,9 @@
 #include <fitsio.h>
 #endif
 #include "cluster_io.h"
+#include "config_utils.h"
 #include "frameread.h"
+#include "framedistance.h"
 
 // Forward decl for PNG writing
 #ifdef USE_PNG
@@ -23,6 +25,14 @@ void write_png_frame(const char *filename, double *data, int width, int height);
 #define ANSI_BOLD          "\x1b[1m"
 #define ANSI_UNDERLINE     "\x1b[4m"
 
+// Frame pixels as doubles: the frame buffer itself for double storage,
+// otherwise converted into 'scratch' (nelements doubles)
+static double *frame_doubles(const Frame *f, double *scratch, long nelements) {
+    if (f->dtype == FRAME_DTYPE_DOUBLE) return (double *)f->data;
+    for (long k = 0; k < nelements; k++) scratch[k] = frame_value(f, k);
+    return scratch;
+}
+
 char* create_output_dir_name(const char* input_file) {
     const char *base = strrchr(input_file, '/');
     if (base) { base++; } else { base = input_file; }
@@ -89,8 +99,9 @@ void print_help_keyword(const char *keyword) {
     else if (strcmp(key, "maxcl") == 0) {
         printf("%sRole:%s Resource Limiting\n", ANSI_BOLD, ANSI_COLOR_RESET);
         printf("%sFunction:%s Sets the maximum number of clusters allowed (Default: 1000).\n", ANSI_BOLD, ANSI_COLOR_RESET);
-        printf("%sImplementation:%s Defines the size of static arrays (clusters, visitors) and the N*N distance\n", ANSI_BOLD, ANSI_COLOR_RESET);
-        printf("                cache (dccarray). Affects memory usage (O(N^2) for dccarray).\n");
+        printf("%sImplementation:%s Defines the size of static arrays (clusters, visitors, transition matrix).\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("                The distance cache between clusters grows with the clusters created\n");
+        printf("                (O(N^2) for N clusters, see -dcctype).\n");
         printf("                When this limit is reached, the behavior is controlled by -maxcl_strategy.\n");
         printf("%sUse:%s -maxcl 5000\n", ANSI_BOLD, ANSI_COLOR_RESET);
         found = 1;
@@ -100,7 +111,12 @@ void print_help_keyword(const char *keyword) {
         printf("%sFunction:%s Sets the number of OpenMP threads (Default: 1).\n", ANSI_BOLD, ANSI_COLOR_RESET);
         printf("%sImplementation:%s Used to parallelize the 'pruning' loops. When checking if a candidate cluster\n", ANSI_BOLD, ANSI_COLOR_RESET);
         printf("                is valid, the algorithm checks triangle inequalities against all other clusters.\n");
-        printf("                This loop is split across 'ncpu' threads. Also used in batch distance calculations.\n");
+        printf("                This loop is split across 'ncpu' threads. Also used in batch distance calculations,\n");
+        printf("                such as the distances from a new cluster's anchor to all other anchors.\n");
+        printf("                Anchor-to-anchor distances are each computed once, by one thread; with -distall,\n");
+        printf("                pruning runs single-threaded so the dump is in the same order at any 'ncpu'.\n");
+        printf("                Frames of 256K pixels or more also split each distance into blocks computed by\n");
+        printf("                'ncpu' threads and summed in a fixed order (results do not depend on 'ncpu').\n");
         printf("%sUse:%s -ncpu 4\n", ANSI_BOLD, ANSI_COLOR_RESET);
         found = 1;
     }
@@ -194,6 +210,207 @@ void print_help_keyword(const char *keyword) {
         printf("%sUse:%s -te5 (Recommended for high-dimensional vectors)\n", ANSI_BOLD, ANSI_COLOR_RESET);
         found = 1;
     }
+    else if (strcmp(key, "noabandon") == 0 || strcmp(key, "varorder") == 0) {
+        printf("%sRole:%s Early-Abandon Distances\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Stops a frame-to-anchor distance once it is known to be too large to matter.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s Frames are summed in blocks of >= 1024 pixels. The partial sum is checked\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           against rlim + max d(anchor, active cluster) after each block: past that value\n");
+        printf("           the triangle inequality prunes every remaining cluster anyway.\n");
+        printf("           Abandoned distances are kept as lower bounds; TE4/TE5 only use them where a\n");
+        printf("           lower bound is sufficient. Off under -gprob, whose update needs the exact\n");
+        printf("           distances of past frames. Cluster-to-cluster distances are always exact.\n");
+        printf("           -varorder N visits blocks in decreasing pixel variance (measured on the first\n");
+        printf("           N frames) so large differences are seen first. Enabled by default;\n");
+        printf("           -noabandon always computes full distances.\n");
+        printf("%sUse:%s -varorder 100\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "nolbound") == 0 || strcmp(key, "lbound") == 0) {
+        printf("%sRole:%s Lower-Bound Rejection\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Skips frame-to-anchor distances that cheap bounds already place beyond rlim.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s Frames and anchors carry their norm and 16x16 / 4x4 block sums. Before a full\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           distance, |norm(a) - norm(b)| and the distance between block means (times\n");
+        printf("           sqrt(block size)) are checked, coarse to fine. If one exceeds rlim the anchor is\n");
+        printf("           rejected and the bound is kept as an inexact distance, like an abandoned one.\n");
+        printf("           Tried from the second candidate of each frame, l2 metric and frames of\n");
+        printf("           256 pixels or more only, not under -gprob (its update reads past distances as\n");
+        printf("           exact). Skipped distances are counted separately.\n");
+        printf("           Enabled by default; -nolbound always computes the distance.\n");
+        printf("%sUse:%s -nolbound\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "pca") == 0 || strcmp(key, "pcaframes") == 0) {
+        printf("%sRole:%s PCA Pre-Pass\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Rejects anchors in a k-dimensional subspace before any full-resolution distance.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s The top k principal components are learned from the first N frames\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           (-pcaframes, default 32). Each frame and anchor keeps its k coefficients and\n");
+        printf("           the norm of its residual outside the subspace. Since the basis is orthonormal,\n");
+        printf("           d^2 >= |c_frame - c_anchor|^2 + (r_frame - r_anchor)^2 exactly: anchors whose\n");
+        printf("           bound exceeds rlim are pruned without losing any match.\n");
+        printf("           Projecting a frame costs about k distances, so it pays off when frames are\n");
+        printf("           large and typically tested against many anchors. l2 metric only.\n");
+        printf("%sUse:%s -pca 8 -pcaframes 64\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "pq") == 0 || strcmp(key, "pqframes") == 0 || strcmp(key, "spill") == 0) {
+        printf("%sRole:%s Product-Quantized Anchor Bounds\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Rejects and orders anchors from compact codes, so full-resolution anchors\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           are only read to confirm a match.\n");
+        printf("%sAlgorithm:%s Frames are cut into m sub-vectors, each coded as the nearest of up to 256\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           centroids learned by k-means from the first N frames (-pqframes, default 256).\n");
+        printf("           Each anchor keeps its m-byte code and the exact norm r of its coding error.\n");
+        printf("           Once the first candidate of a frame has missed, one table of sub-vector\n");
+        printf("           distances gives ||frame - coded anchor|| for every anchor by m lookups, and\n");
+        printf("           anchors with ||frame - coded anchor|| - r > rlim are pruned (triangle\n");
+        printf("           inequality): assignments stay exact. The other candidates are tried by\n");
+        printf("           increasing coded distance. The table costs about 256 distances per frame, so\n");
+        printf("           it pays off with many anchors. l2 metric only.\n");
+        printf("           -spill <file> keeps the full anchors in a memory-mapped file (unlinked on\n");
+        printf("           creation) that the kernel can page out, instead of heap memory.\n");
+        printf("%sUse:%s -pq 16 -pqframes 512 -spill /scratch/anchors.bin\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "dcctype") == 0) {
+        printf("%sRole:%s Distance Cache Size\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Sets how distances between cluster anchors are stored.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sImplementation:%s One triangle of the matrix is kept, in 64x64 tiles allocated as clusters\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("                are created; a removed cluster frees its slot for the next one.\n");
+        printf("                double (default): exact, 8 bytes per pair.\n");
+        printf("                float: 4 bytes per pair, rounded to single precision.\n");
+        printf("                q16: 2 bytes per pair, in steps of rlim/256 up to 256*rlim. Larger\n");
+        printf("                distances saturate: the entry is then only a lower bound, used by the\n");
+        printf("                3-point test where that suffices; other reads recompute the distance.\n");
+        printf("                float and q16 make the triangle-inequality tests approximate to that\n");
+        printf("                rounding: a cluster at the edge of a test can be pruned or kept wrongly.\n");
+        printf("%sUse:%s -maxcl 100000 -dcctype q16\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "sketch") == 0 || strcmp(key, "sketchconf") == 0) {
+        printf("%sRole:%s Random-Projection Sketches\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Orders and prefilters candidates with cheap approximate distances.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s Frames are projected to m dimensions as they are read, by a fixed seeded\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           sparse random matrix (Johnson-Lindenstrauss). Candidates are tried by increasing\n");
+        printf("           sketch distance instead of probability (unless -gprob is set), and anchors whose\n");
+        printf("           sketch distance makes d < rlim unlikely at the -sketchconf confidence (default\n");
+        printf("           0.999, 1 = never reject) are skipped. Assignments are always confirmed with the\n");
+        printf("           exact distance: a false rejection can only create an extra cluster. Frames that\n");
+        printf("           create a cluster are checked against their exact dcc row, giving the false-reject\n");
+        printf("           rate reported in the run log. l2 metric only.\n");
+        printf("%sUse:%s -sketch 128 -sketchconf 0.9999\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "pivots") == 0) {
+        printf("%sRole:%s Pivot Table (LAESA) Anchor Index\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Bounds the distance to every anchor from a few exact distances.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s P well-spread pivot anchors are picked by farthest-first traversal of the\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           anchor-to-anchor distances, and their rows are kept in a contiguous P x N table.\n");
+        printf("           Each frame computes its P pivot distances first; one pass over the table then\n");
+        printf("           gives max_p |d(f,p) - d(p,k)| <= d(f,k) for every anchor k. Anchors whose bound\n");
+        printf("           exceeds rlim are pruned, and the others are tried by increasing bound (unless\n");
+        printf("           -gprob is set). Pivots are chosen once there are 4P anchors and chosen again\n");
+        printf("           each time the number of anchors doubles. Requires a metric.\n");
+        printf("%sUse:%s -pivots 8\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "visitprune") == 0) {
+        printf("%sRole:%s Visitor-History Pruning\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Exact pruning from the distances earlier frames measured.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s When anchor cj is out of range, each earlier frame k that measured d(k,cj) and\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           was assigned to cluster T with a measured d(k,T) gives\n");
+        printf("           d(cur,T) >= |dfc - d(k,cj)| - d(k,T); T is pruned when this exceeds rlim. The scan\n");
+        printf("           is the one -gprob uses (last -maxvis visitors of cj) and needs no new distance.\n");
+        printf("           Frames processed before the last cluster removal are skipped. The bound is never\n");
+        printf("           tighter than the 3-point test when it runs; it pays off with -index vptree or grid,\n");
+        printf("           which skip that test. Not used with -index hnsw. Requires a metric.\n");
+        printf("%sUse:%s -visitprune, -gprob -visitprune\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "coherence") == 0) {
+        printf("%sRole:%s Temporal Coherence Bounds\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Reuses earlier frames' distances on slowly changing streams.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s Each frame first computes d(ref, cur) to a reference frame, the last frame\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           that measured frame-to-anchor distances (usually the previous one). Every bound\n");
+        printf("           the reference has on an anchor A carries over: d(ref,A) - d(ref,cur) <= d(cur,A)\n");
+        printf("           <= d(ref,A) + d(ref,cur). Anchors whose lower bound exceeds rlim are pruned; if\n");
+        printf("           an upper bound is below rlim, the frame is assigned to the most probable such\n");
+        printf("           anchor without any frame-to-anchor distance, and the reference is kept, so the\n");
+        printf("           bounds loosen with the drift from it rather than with the sum of the steps.\n");
+        printf("           The assignment is always within rlim but may differ from the most probable\n");
+        printf("           matching anchor. Costs one extra distance per frame. Requires a metric.\n");
+        printf("%sUse:%s -coherence\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "index") == 0 || strcmp(key, "ef") == 0 || strcmp(key, "recall") == 0) {
+        printf("%sRole:%s Anchor Search Index\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Selects how candidate anchors are searched for each frame.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s linear: anchors are tried in probability order, and each distance\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           prunes the others with a 3-point test over all of them.\n");
+        printf("           vptree: a vantage-point tree over the anchors, built from the anchor-to-anchor\n");
+        printf("           distances (no extra distance computations), is searched best-first on its\n");
+        printf("           triangle-inequality bounds, probability breaking ties. The search is exact and\n");
+        printf("           stops at the first anchor within rlim; per-frame work grows sublinearly with the\n");
+        printf("           number of anchors. New anchors are inserted at the leaves, and the tree is\n");
+        printf("           rebuilt when the dictionary doubles or routing nodes of removed clusters\n");
+        printf("           outnumber live ones. Non-metric distances fall back to linear.\n");
+        printf("           hnsw: approximate search on a navigable small-world graph. Each new cluster is\n");
+        printf("           linked to up to 16 diverse near anchors taken from its dcc row. After the most\n");
+        printf("           probable anchor, a beam search of width -ef (default 32) walks the graph until\n");
+        printf("           an anchor within rlim is found or the beam stops improving. A missed in-range\n");
+        printf("           anchor creates a duplicate cluster: every new cluster is checked against its\n");
+        printf("           exact dcc row and the duplicate rate is reported in the run log. With -recall p,\n");
+        printf("           the beam width doubles whenever duplicates exceed 1 - p over 50 new clusters.\n");
+        printf("           -gprob uses linear.\n");
+        printf("           grid: exact lookup for frames of up to 8 pixels (l2, l1, linf). Anchors are\n");
+        printf("           hashed by cell on a uniform grid of side rlim, so any anchor within rlim lies\n");
+        printf("           in one of the 3^dim cells around the frame; only those are tried, in\n");
+        printf("           probability order. Only occupied cells are stored, memory is bounded by -maxcl.\n");
+        printf("           With -gprob the lookup restricts which anchors enter the probability update.\n");
+        printf("           auto (default): grid for frames of up to %d pixels, linear otherwise. Also\n", GRID_AUTO_DIM);
+        printf("           linear under -gprob and -maxcl_strategy discard or merge: they rank clusters\n");
+        printf("           by visitor history, which depends on how many distances the search measured.\n");
+        printf("%sUse:%s -index vptree -maxcl 100000, -index hnsw -ef 64 -recall 0.99\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "metric") == 0 || strcmp(key, "weights") == 0) {
+        printf("%sRole:%s Distance Metric\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Selects how frame-to-frame distances (and rlim) are measured.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sOptions:%s\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("  l2      : Euclidean distance (default).\n");
+        printf("  l1      : Sum of absolute pixel differences.\n");
+        printf("  linf    : Largest absolute pixel difference.\n");
+        printf("  wl2     : Euclidean distance with per-pixel weights from -weights <file>\n");
+        printf("            (FITS image or ASCII values). Zero weights mask pixels out.\n");
+        printf("  angular : Angle between frames (radians), insensitive to overall flux.\n");
+        printf("  cosine  : 1 - cos(angle). Not a metric: triangle-inequality pruning and\n");
+        printf("            early-abandon are disabled.\n");
+        printf("%sNote:%s TE4/TE5 assume Euclidean geometry and are only used with l2 and wl2.\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sUse:%s -metric wl2 -weights mask.fits\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "sparse") == 0) {
+        printf("%sRole:%s Sparse Frames\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Speeds up distances for mostly-zero images (e.g. a spot on a dark background).\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sAlgorithm:%s Frames with at most the given fraction of nonzero pixels also keep a list of\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           their nonzero pixels and their squared norm. An L2 distance involving such a frame\n");
+        printf("           only visits the listed pixels: d^2 = sum_S (a-b)^2 + ||b||^2 - sum_S b^2.\n");
+        printf("           Anchors keep their dense copy, so lookups into them stay direct.\n");
+        printf("           Integer frames give exactly the dense result. Other metrics ignore the lists.\n");
+        printf("%sUse:%s -sparse 0.05 (frames with <= 5%% nonzero pixels)\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "delta") == 0) {
+        printf("%sRole:%s Incremental Distances\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Reuses the previous frame's distances when consecutive frames differ in few pixels\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           (video, static-background cameras).\n");
+        printf("%sAlgorithm:%s Each frame is compared with the previous one in 64-pixel blocks to list the\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("           changed pixels. For an anchor A also measured on the previous frame P:\n");
+        printf("             d^2(F,A) = d^2(P,A) + sum_changed (F-P)(F+P-2A)\n");
+        printf("           A full distance is computed again after N incremental updates. Frames with more\n");
+        printf("           than 25%% changed pixels use full distances. L2 metric and integer frames only\n");
+        printf("           (uint8, uint16, int16), where the update is exact.\n");
+        printf("%sUse:%s -delta 50\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
     else if (strcmp(key, "scandist") == 0) {
         printf("%sRole:%s Data Analysis (Pre-run)\n", ANSI_BOLD, ANSI_COLOR_RESET);
         printf("%sFunction:%s Measures distance statistics without clustering.\n", ANSI_BOLD, ANSI_COLOR_RESET);
@@ -285,6 +502,33 @@ void print_help_keyword(const char *keyword) {
         printf("%sFunction:%s Writes individual files (or directories) for each cluster containing its member frames.\n", ANSI_BOLD, ANSI_COLOR_RESET);
         found = 1;
     }
+    else if (strcmp(key, "simd") == 0) {
+        printf("%sRole:%s Distance Kernel Selection\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Overrides the SIMD kernel used by framedist (Default: auto).\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sImplementation:%s The CPU is probed at startup and framedist is bound to the best available\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("                kernel: avx512 (masked tails), avx2 (FMA, 4 accumulators), sse2 or scalar.\n");
+        printf("                Requesting a kernel the CPU does not support falls back to the best one below it.\n");
+        printf("                Run gric-info to see which kernel is selected on this host.\n");
+        printf("%sUse:%s -simd sse2 (Reproduce results of an older node)\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
+    else if (strcmp(key, "precision") == 0) {
+        printf("%sRole:%s Frame Storage Precision\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sFunction:%s Selects how frames and cluster anchors are stored in memory (Default: auto).\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("%sOptions:%s\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        printf("  auto   : Keep the source's native sample type. 8-bit PNG/MP4 frames, 8/16-bit\n");
+        printf("           FITS and uint8/uint16/int16 streams are stored as-is and compared with\n");
+        printf("           exact integer kernels (SSE2/AVX2 saturating |a-b|, madd into 32/64-bit\n");
+        printf("           accumulators). Other sources (ASCII, float FITS/streams) use double.\n");
+        printf("  double : 64-bit storage, double-precision distance kernels.\n");
+        printf("  float  : 32-bit storage. Halves frame/anchor memory and framedist bandwidth.\n");
+        printf("           Distances use 8-wide (AVX2) / 16-wide (AVX-512) float kernels with\n");
+        printf("           blockwise double accumulation. Results within 1e-4 (relative) of rlim are\n");
+        printf("           recomputed in double, so assignments match the double path whenever the\n");
+        printf("           input values are exactly representable in float (8/16-bit, float streams).\n");
+        printf("%sUse:%s -precision float\n", ANSI_BOLD, ANSI_COLOR_RESET);
+        found = 1;
+    }
     else if (strcmp(key, "tm") == 0) {
         printf("%sRole:%s Transition Matrix Mixing\n", ANSI_BOLD, ANSI_COLOR_RESET);
         printf("%sFunction:%s Uses transition history to predict next cluster.\n", ANSI_BOLD, ANSI_COLOR_RESET);
@@ -340,6 +584,29 @@ void print_help(char *progname) {
     printf("                            n: number of prediction candidates to return\n");
     printf("    %s%s-te4%s                     Use 4-point triangle inequality pruning\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
     printf("    %s%s-te5%s                     Use 5-point triangle inequality pruning\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-precision <str>%s         Frame/anchor storage (auto|double|float) (default: auto)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-simd <str>%s              Distance kernel (auto|scalar|sse2|avx2|avx512) (default: auto)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-noabandon%s               Disable early-abandon of frame-to-anchor distances\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-nolbound%s                Disable norm/block-sum lower-bound rejection of anchors\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-pca <k>%s                 PCA pre-pass with k components (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-pcaframes <N>%s           Frames the PCA basis is learned from (default: 32)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-pq <m>%s                  Product-quantized anchor bounds with m sub-vectors (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-pqframes <N>%s            Frames the PQ codebook is learned from (default: 256)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-spill <file>%s            Keep anchors in a memory-mapped spill file (default: heap)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-dcctype <str>%s           Cluster distance cache entries (double|float|q16) (default: double)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-sketch <m>%s              Rank/reject candidates with m-D random-projection sketches (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-sketchconf <p>%s          Sketch rejection confidence, 1 = ordering only (default: 0.999)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-pivots <P>%s              Pivot-table anchor index with P pivots (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-visitprune%s              Prune with bounds from the visitor history of tested anchors\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-coherence%s               Carry distance bounds over from earlier frames\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-index <str>%s             Anchor search index (linear|vptree|hnsw|grid|auto) (default: auto)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-ef <N>%s                  hnsw beam width (default: 32)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-recall <p>%s              hnsw target recall, widens the beam on duplicates (default: 0, fixed)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-varorder <N>%s            High-variance-first pixel order from first N frames (default: off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-metric <str>%s            Distance metric (l2|l1|linf|wl2|angular|cosine) (default: l2)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-weights <file>%s          Per-pixel weight map for -metric wl2\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-sparse <frac>%s           Sparse frames if nonzero fraction <= frac (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
+    printf("    %s%s-delta <N>%s               Incremental distances vs previous frame, full every N (default: 0, off)\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
     printf("    %s%s-conf <file>%s             Read options from configuration file\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
     printf("    %s%s-confw <file>%s            Write current options to configuration file\n", ANSI_BOLD, ANSI_UNDERLINE, ANSI_COLOR_RESET);
 
@@ -390,7 +657,9 @@ void write_results(ClusterConfig *config, ClusterState *state) {
         if (dcc_out) {
             for (int i = 0; i < state->num_clusters; i++) {
                 for (int j = 0; j < state->num_clusters; j++) {
-                    double d = state->dccarray[i * config->maxnbclust + j];
+                    double d = dcc_store_get(&state->dcc, i, j);
+                    // Saturated q16 entries only hold a lower bound: write the exact distance
+                    if (d < 0 && dcc_store_saturated(&state->dcc, i, j)) d = framedist(&state->clusters[i].anchor, &state->clusters[j].anchor);
                     if (d >= 0) fprintf(dcc_out, "%d %d %.6f\n", i, j, d);
                 }
             }
@@ -420,6 +689,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
     long width = get_frame_width();
     long height = get_frame_height();
     long nelements = width * height;
+    double *pix_buffer = (double *)malloc(nelements * sizeof(double));
 
     if (config->output_anchors) {
         printf("Writing anchors\n");
@@ -427,7 +697,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
             #ifdef USE_PNG
             for (int i = 0; i < state->num_clusters; i++) {
                 snprintf(out_path, sizeof(out_path), "%s/anchor_%04d.png", out_dir, i);
-                write_png_frame(out_path, state->clusters[i].anchor.data, width, height);
+                write_png_frame(out_path, frame_doubles(&state->clusters[i].anchor, pix_buffer, nelements), width, height);
             }
             #else
             fprintf(stderr, "Warning: PNG output requested but not compiled in.\n");
@@ -437,7 +707,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
             FILE *afptr = fopen(out_path, "w");
             if (afptr) {
                 for (int i = 0; i < state->num_clusters; i++) {
-                    for (long k = 0; k < nelements; k++) fprintf(afptr, "%f ", state->clusters[i].anchor.data[k]);
+                    for (long k = 0; k < nelements; k++) fprintf(afptr, "%f ", frame_value(&state->clusters[i].anchor, k));
                     fprintf(afptr, "\n");
                 }
                 fclose(afptr);
@@ -452,7 +722,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
             fits_create_img(afptr, DOUBLE_IMG, 3, naxes, &status);
             for (int i = 0; i < state->num_clusters; i++) {
                 long fpixel[3] = {1, 1, i + 1};
-                fits_write_pix(afptr, TDOUBLE, fpixel, nelements, state->clusters[i].anchor.data, &status);
+                fits_write_pix(afptr, TDOUBLE, fpixel, nelements, frame_doubles(&state->clusters[i].anchor, pix_buffer, nelements), &status);
             }
             fits_close_file(afptr, &status);
             #else
@@ -463,7 +733,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
             FILE *afptr = fopen(out_path, "w");
             if (afptr) {
                 for (int i = 0; i < state->num_clusters; i++) {
-                    for (long k = 0; k < nelements; k++) fprintf(afptr, "%f ", state->clusters[i].anchor.data[k]);
+                    for (long k = 0; k < nelements; k++) fprintf(afptr, "%f ", frame_value(&state->clusters[i].anchor, k));
                     fprintf(afptr, "\n");
                 }
                 fclose(afptr);
@@ -522,13 +792,14 @@ void write_results(ClusterConfig *config, ClusterState *state) {
                 if (state->assignments[f] == c) {
                     Frame *fr = getframe_at(f);
                     if (fr) {
+                        double *pix = frame_doubles(fr, pix_buffer, nelements);
                         if (config->output_clusters) {
                             char cluster_dir[1024];
                             snprintf(cluster_dir, sizeof(cluster_dir), "%s/cluster_%04d", out_dir, c);
                             snprintf(out_path, sizeof(out_path), "%s/frame%05ld.png", cluster_dir, f);
-                            write_png_frame(out_path, fr->data, width, height);
+                            write_png_frame(out_path, pix, width, height);
                         }
-                        if (config->average_mode) for (long k=0; k<nelements; k++) avg_buffer[k] += fr->data[k];
+                        if (config->average_mode) for (long k=0; k<nelements; k++) avg_buffer[k] += pix[k];
                         free_frame(fr);
                     }
                 }
@@ -566,8 +837,9 @@ void write_results(ClusterConfig *config, ClusterState *state) {
                     Frame *fr = getframe_at(f);
                     if (fr) {
                         for(long k=0; k<nelements; k++) {
-                            if(cfptr) fprintf(cfptr, "%f ", fr->data[k]);
-                            if(config->average_mode) avg_buffer[k] += fr->data[k];
+                            double v = frame_value(fr, k);
+                            if(cfptr) fprintf(cfptr, "%f ", v);
+                            if(config->average_mode) avg_buffer[k] += v;
                         }
                         if(cfptr) fprintf(cfptr, "\n");
                         free_frame(fr);
@@ -610,11 +882,12 @@ void write_results(ClusterConfig *config, ClusterState *state) {
                 if (state->assignments[f] == c) {
                     Frame *fr = getframe_at(f);
                     if (fr) {
+                        double *pix = frame_doubles(fr, pix_buffer, nelements);
                         if (cfptr) {
                             long fpixel[3] = {1, 1, fr_count + 1};
-                            fits_write_pix(cfptr, TDOUBLE, fpixel, nelements, fr->data, &status);
+                            fits_write_pix(cfptr, TDOUBLE, fpixel, nelements, pix, &status);
                         }
-                        if(config->average_mode) for(long k=0; k<nelements; k++) avg_buffer[k] += fr->data[k];
+                        if(config->average_mode) for(long k=0; k<nelements; k++) avg_buffer[k] += pix[k];
                         free_frame(fr);
                         fr_count++;
                     }
@@ -635,6 +908,7 @@ void write_results(ClusterConfig *config, ClusterState *state) {
     }
 
     if (avg_buffer) free(avg_buffer);
+    if (pix_buffer) free(pix_buffer);
 
     if (config->output_clustered) {
         printf("Writing clustered output file\n");
@@ -684,14 +958,14 @@ void write_results(ClusterConfig *config, ClusterState *state) {
                 int assigned = state->assignments[i];
                 if (assigned == next_new_cluster) {
                     fprintf(clustered_out, "# NEWCLUSTER %d %ld ", assigned, i);
-                    for (long k = 0; k < nelements; k++) fprintf(clustered_out, "%f ", state->clusters[assigned].anchor.data[k]);
+                    for (long k = 0; k < nelements; k++) fprintf(clustered_out, "%f ", frame_value(&state->clusters[assigned].anchor, k));
                     fprintf(clustered_out, "\n");
                     next_new_cluster++;
                 }
                 Frame *fr = getframe_at(i);
                 if (fr) {
                     fprintf(clustered_out, "%ld %d ", i, assigned);
-                    for (long k = 0; k < nelements; k++) fprintf(clustered_out, "%f ", fr->data[k]);
+                    for (long k = 0; k < nelements; k++) fprintf(clustered_out, "%f ", frame_value(fr, k));
                     fprintf(clustered_out, "\n");
                     free_frame(fr);
                 }
@@ -733,6 +1007,27 @@ void write_run_log(ClusterConfig *config, ClusterState *state, const char *cmdli
         fprintf(f, "PARAM_FMATCHB: %f\n", config->fmatch_b);
         fprintf(f, "PARAM_TE4: %d\n", config->te4_mode);
         fprintf(f, "PARAM_TE5: %d\n", config->te5_mode);
+        fprintf(f, "PARAM_PRECISION: %s\n", frame_dtype_name(get_frame_dtype()));
+        fprintf(f, "DIST_KERNEL: %s\n", framedist_kernel_name());
+        fprintf(f, "PARAM_METRIC: %s\n", metric_name(framedist_get_metric()));
+        fprintf(f, "PARAM_SPARSE: %f\n", config->sparse_fill);
+        fprintf(f, "PARAM_DELTA: %d\n", config->delta_period);
+        fprintf(f, "PARAM_LBOUND: %d\n", config->lbound_mode);
+        fprintf(f, "PARAM_PCA: %d\n", config->pca_k);
+        fprintf(f, "PARAM_PQ: %d\n", config->pq_m);
+        if (config->pq_m > 0) fprintf(f, "PARAM_PQFRAMES: %ld\n", config->pq_frames);
+        if (config->spill_filename) fprintf(f, "PARAM_SPILL: %s\n", config->spill_filename);
+        fprintf(f, "PARAM_DCCTYPE: %s\n", dcc_type_name(config->dcc_type));
+        fprintf(f, "PARAM_SKETCH: %d\n", config->sketch_dim);
+        if (config->sketch_dim > 0) fprintf(f, "PARAM_SKETCHCONF: %f\n", config->sketch_conf);
+        fprintf(f, "PARAM_PIVOTS: %d\n", config->pivots);
+        fprintf(f, "PARAM_VISITPRUNE: %d\n", config->visitprune_mode);
+        fprintf(f, "PARAM_COHERENCE: %d\n", config->coherence_mode);
+        fprintf(f, "PARAM_INDEX: %s\n", anchor_index_name(config->index_mode));
+        if (config->index_mode == ANCHOR_INDEX_HNSW) {
+            fprintf(f, "PARAM_EF: %d\n", config->index_ef);
+            fprintf(f, "PARAM_RECALL: %f\n", config->index_recall);
+        }
         
         if (config->output_dcc) fprintf(f, "OUTPUT_FILE: %s/dcc.txt\n", out_dir);
         if (config->output_tm) fprintf(f, "OUTPUT_FILE: %s/transition_matrix.txt\n", out_dir);
@@ -755,6 +1050,35 @@ void write_run_log(ClusterConfig *config, ClusterState *state, const char *cmdli
         fprintf(f, "STATS_FRAMES: %ld\n", state->total_frames_processed);
         fprintf(f, "STATS_DISTS: %ld\n", state->framedist_calls);
         fprintf(f, "STATS_PRUNED: %ld\n", state->clusters_pruned);
+        fprintf(f, "STATS_DIST_ABANDONED: %ld\n", state->framedist_abandoned);
+        fprintf(f, "STATS_DIST_LBOUND: %ld\n", state->framedist_lbound);
+        if (config->pca_k > 0) fprintf(f, "STATS_PCA_REJECTED: %ld\n", state->pca_rejected);
+        if (config->pq_m > 0) fprintf(f, "STATS_PQ_REJECTED: %ld\n", state->pq_rejected);
+        fprintf(f, "STATS_DCC_BYTES: %zu\n", state->dcc.bytes);
+        if (config->sketch_dim > 0) {
+            fprintf(f, "STATS_SKETCH_REJECTED: %ld\n", state->sketch_rejected);
+            fprintf(f, "STATS_SKETCH_AUDITED: %ld\n", state->sketch_audited);
+            fprintf(f, "STATS_SKETCH_FALSE_REJECTS: %ld\n", state->sketch_false_rejects);
+            fprintf(f, "STATS_SKETCH_FALSE_REJECT_RATE: %f\n",
+                    state->sketch_audited > 0 ? (double)state->sketch_false_rejects / state->sketch_audited : 0.0);
+            fprintf(f, "STATS_SKETCH_EXTRA_CLUSTERS: %ld\n", state->sketch_extra_clusters);
+        }
+        if (config->index_mode == ANCHOR_INDEX_HNSW) {
+            fprintf(f, "STATS_HNSW_CHECKED: %ld\n", state->nsw_checked);
+            fprintf(f, "STATS_HNSW_DUPLICATES: %ld\n", state->nsw_duplicates);
+            fprintf(f, "STATS_HNSW_DUPLICATE_RATE: %f\n",
+                    state->nsw_checked > 0 ? (double)state->nsw_duplicates / state->nsw_checked : 0.0);
+            fprintf(f, "STATS_HNSW_EF: %d\n", state->nsw_ef);
+        }
+        if (config->pivots > 0) fprintf(f, "STATS_PIVOT_PRUNED: %ld\n", state->pivot_pruned);
+        if (config->visitprune_mode) fprintf(f, "STATS_VISITOR_PRUNED: %ld\n", state->visitor_pruned);
+        if (config->coherence_mode) {
+            fprintf(f, "STATS_COHERENCE_ASSIGNED: %ld\n", state->coherence_assigned);
+            fprintf(f, "STATS_COHERENCE_PRUNED: %ld\n", state->coherence_pruned);
+        }
+        if (config->sparse_fill > 0.0) fprintf(f, "STATS_SPARSE_FRAMES: %ld\n", get_sparse_frames());
+        if (config->delta_period > 0) fprintf(f, "STATS_DIST_DELTA: %ld\n", state->framedist_delta);
+        if (get_frame_dtype() == FRAME_DTYPE_FLOAT) fprintf(f, "STATS_DIST_REFINED: %ld\n", framedist_refine_calls());
         fprintf(f, "STATS_MAX_RSS_KB: %ld\n", max_rss);
 
         fprintf(f, "STATS_DIST_HIST_START\n");
@@ -5,19 +5,40 @@
 #include <stdint.h>
 #include <time.h>
 
+// Element type of Frame.data
+typedef enum {
+    FRAME_DTYPE_AUTO = -1, // Requested precision only: native type for integer sources, else double
+    FRAME_DTYPE_DOUBLE = 0,
+    FRAME_DTYPE_FLOAT = 1,
+    FRAME_DTYPE_UINT8 = 2,
+    FRAME_DTYPE_UINT16 = 3,
+    FRAME_DTYPE_INT16 = 4
+} FrameDType;
+
 typedef struct {
-    double *data;
+    void *data; // Pixel buffer, element type given by dtype
+    FrameDType dtype;
     long width;
     long height;
     int id;
     uint64_t cnt0;
     struct timespec atime;
+    // Sparse copy of the nonzero pixels (nnz < 0: dense only). The dense
+    // buffer is always kept; sp_* only accelerate distances.
+    long nnz;
+    uint32_t *sp_idx;
+    double *sp_val;
+    double norm2; // ||frame||^2, < 0 when unknown
+    double *lbsum; // Lower-bound summary (framedist_summarize), NULL if none
+    double *pca; // PCA coefficients (pca_basis_project), NULL if none
+    double *sketch; // JL sketch (sketch_frame), NULL if none
 } Frame;
 
 typedef struct {
     Frame anchor;
     int id;
     double prob;
+    int slot; // Anchor matrix slot holding anchor.data (-1: own allocation)
 } Cluster;
 
 typedef struct {
@@ -25,8 +46,45 @@ typedef struct {
     int num_dists;
     int *cluster_indices;
     double *distances;
+    unsigned char *exact; // 1 = exact distance, 0 = lower bound (early-abandoned)
 } FrameInfo;
 
 int is_ascii_input_mode();
 
+static inline size_t frame_dtype_size(FrameDType dtype) {
+    switch (dtype) {
+        case FRAME_DTYPE_FLOAT:  return sizeof(float);
+        case FRAME_DTYPE_UINT8:  return sizeof(uint8_t);
+        case FRAME_DTYPE_UINT16: return sizeof(uint16_t);
+        case FRAME_DTYPE_INT16:  return sizeof(int16_t);
+        default:                 return sizeof(double);
+    }
+}
+
+static inline const char *frame_dtype_name(FrameDType dtype) {
+    switch (dtype) {
+        case FRAME_DTYPE_AUTO:   return "auto";
+        case FRAME_DTYPE_FLOAT:  return "float";
+        case FRAME_DTYPE_UINT8:  return "uint8";
+        case FRAME_DTYPE_UINT16: return "uint16";
+        case FRAME_DTYPE_INT16:  return "int16";
+        default:                 return "double";
+    }
+}
+
+static inline int frame_dtype_is_integer(FrameDType dtype) {
+    return dtype == FRAME_DTYPE_UINT8 || dtype == FRAME_DTYPE_UINT16 || dtype == FRAME_DTYPE_INT16;
+}
+
+// Pixel value as double, whatever the storage type
+static inline double frame_value(const Frame *f, long i) {
+    switch (f->dtype) {
+        case FRAME_DTYPE_FLOAT:  return (double)((const float *)f->data)[i];
+        case FRAME_DTYPE_UINT8:  return (double)((const uint8_t *)f->data)[i];
+        case FRAME_DTYPE_UINT16: return (double)((const uint16_t *)f->data)[i];
+        case FRAME_DTYPE_INT16:  return (double)((const int16_t *)f->data)[i];
+        default:                 return ((const double *)f->data)[i];
+    }
+}
+
 #endif // COMMON_H
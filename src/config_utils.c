@@ -3,6 +3,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "config_utils.h"
+#include "framedistance.h"
 
 // Helper to match options with or without leading dash
 static int matches(const char *key, const char *opt) {
@@ -12,6 +13,16 @@ static int matches(const char *key, const char *opt) {
     return 0;
 }
 
+const char *anchor_index_name(AnchorIndexMode mode) {
+    switch (mode) {
+        case ANCHOR_INDEX_VPTREE: return "vptree";
+        case ANCHOR_INDEX_HNSW:   return "hnsw";
+        case ANCHOR_INDEX_GRID:   return "grid";
+        case ANCHOR_INDEX_AUTO:   return "auto";
+        default:                  return "linear";
+    }
+}
+
 int apply_option(ClusterConfig *config, const char *key, const char *value) {
     if (matches(key, "-dprob")) {
         if (!value) return -1;
@@ -99,6 +110,108 @@ int apply_option(ClusterConfig *config, const char *key, const char *value) {
         if (!value) return -1;
         config->discard_fraction = atof(value);
         return 1;
+    } else if (matches(key, "-precision")) {
+        if (!value) return -1;
+        if (strcmp(value, "auto") == 0) config->precision = FRAME_DTYPE_AUTO;
+        else if (strcmp(value, "double") == 0) config->precision = FRAME_DTYPE_DOUBLE;
+        else if (strcmp(value, "float") == 0) config->precision = FRAME_DTYPE_FLOAT;
+        else fprintf(stderr, "Warning: Unknown precision '%s' (auto|double|float)\n", value);
+        return 1;
+    } else if (matches(key, "-simd")) {
+        if (!value) return -1;
+        int level = simd_level_from_name(value);
+        if (level == -2) fprintf(stderr, "Warning: Unknown simd kernel '%s' (auto|scalar|sse2|avx2|avx512)\n", value);
+        else config->simd_level = level;
+        return 1;
+    } else if (matches(key, "-noabandon")) {
+        config->abandon_mode = 0;
+        return 0;
+    } else if (matches(key, "-nolbound")) {
+        config->lbound_mode = 0;
+        return 0;
+    } else if (matches(key, "-pca")) {
+        if (!value) return -1;
+        config->pca_k = atoi(value);
+        return 1;
+    } else if (matches(key, "-pcaframes")) {
+        if (!value) return -1;
+        config->pca_frames = atol(value);
+        return 1;
+    } else if (matches(key, "-pq")) {
+        if (!value) return -1;
+        config->pq_m = atoi(value);
+        return 1;
+    } else if (matches(key, "-pqframes")) {
+        if (!value) return -1;
+        config->pq_frames = atol(value);
+        return 1;
+    } else if (matches(key, "-spill")) {
+        if (!value) return -1;
+        config->spill_filename = strdup(value);
+        return 1;
+    } else if (matches(key, "-dcctype")) {
+        if (!value) return -1;
+        int t = dcc_type_from_name(value);
+        if (t < 0) fprintf(stderr, "Warning: Unknown dcc entry type '%s' (double|float|q16)\n", value);
+        else config->dcc_type = t;
+        return 1;
+    } else if (matches(key, "-sketch")) {
+        if (!value) return -1;
+        config->sketch_dim = atoi(value);
+        return 1;
+    } else if (matches(key, "-sketchconf")) {
+        if (!value) return -1;
+        config->sketch_conf = atof(value);
+        return 1;
+    } else if (matches(key, "-pivots")) {
+        if (!value) return -1;
+        config->pivots = atoi(value);
+        return 1;
+    } else if (matches(key, "-visitprune")) {
+        config->visitprune_mode = 1;
+        return 0;
+    } else if (matches(key, "-coherence")) {
+        config->coherence_mode = 1;
+        return 0;
+    } else if (matches(key, "-index")) {
+        if (!value) return -1;
+        if (strcmp(value, "vptree") == 0) config->index_mode = ANCHOR_INDEX_VPTREE;
+        else if (strcmp(value, "hnsw") == 0) config->index_mode = ANCHOR_INDEX_HNSW;
+        else if (strcmp(value, "linear") == 0) config->index_mode = ANCHOR_INDEX_LINEAR;
+        else if (strcmp(value, "grid") == 0) config->index_mode = ANCHOR_INDEX_GRID;
+        else if (strcmp(value, "auto") == 0) config->index_mode = ANCHOR_INDEX_AUTO;
+        else fprintf(stderr, "Warning: Unknown anchor index '%s' (linear|vptree|hnsw|grid|auto)\n", value);
+        return 1;
+    } else if (matches(key, "-ef")) {
+        if (!value) return -1;
+        config->index_ef = atoi(value);
+        return 1;
+    } else if (matches(key, "-recall")) {
+        if (!value) return -1;
+        config->index_recall = atof(value);
+        return 1;
+    } else if (matches(key, "-varorder")) {
+        if (!value) return -1;
+        config->varorder_frames = atol(value);
+        return 1;
+    } else if (matches(key, "-metric")) {
+        if (!value) return -1;
+        int m = metric_from_name(value);
+        if (m < 0) fprintf(stderr, "Warning: Unknown metric '%s' (l2|l1|linf|wl2|angular|cosine)\n", value);
+        else config->metric = m;
+        return 1;
+    } else if (matches(key, "-weights")) {
+        if (!value) return -1;
+        config->weights_filename = strdup(value);
+        return 1;
+    } else if (matches(key, "-sparse")) {
+        if (!value) return -1;
+        config->sparse_fill = atof(value);
+        return 1;
+    } else if (matches(key, "-delta")) {
+        if (!value) return -1;
+        config->delta_period = atoi(value);
+        return 1;
     } else if (matches(key, "-tm_out")) {
         config->output_tm = 1;
         return 0;
@@ -228,6 +341,25 @@ int write_config_file(const char *filename, ClusterConfig *config) {
     else if (config->maxcl_strategy == MAXCL_MERGE) strat = "merge";
     fprintf(f, "maxcl_strategy %s\n", strat);
     fprintf(f, "discard_frac %f\n", config->discard_fraction);
+    if (config->precision != FRAME_DTYPE_AUTO) fprintf(f, "precision %s\n", frame_dtype_name(config->precision));
+    if (config->simd_level != SIMD_AUTO) fprintf(f, "simd %s\n", simd_level_name(config->simd_level));
+    if (!config->abandon_mode) fprintf(f, "noabandon\n");
+    if (!config->lbound_mode) fprintf(f, "nolbound\n");
+    if (config->pca_k > 0) fprintf(f, "pca %d\npcaframes %ld\n", config->pca_k, config->pca_frames);
+    if (config->pq_m > 0) fprintf(f, "pq %d\npqframes %ld\n", config->pq_m, config->pq_frames);
+    if (config->spill_filename) fprintf(f, "spill %s\n", config->spill_filename);
+    if (config->dcc_type != DCC_DOUBLE) fprintf(f, "dcctype %s\n", dcc_type_name(config->dcc_type));
+    if (config->sketch_dim > 0) fprintf(f, "sketch %d\nsketchconf %f\n", config->sketch_dim, config->sketch_conf);
+    if (config->pivots > 0) fprintf(f, "pivots %d\n", config->pivots);
+    if (config->visitprune_mode) fprintf(f, "visitprune\n");
+    if (config->coherence_mode) fprintf(f, "coherence\n");
+    if (config->index_mode != ANCHOR_INDEX_LINEAR) fprintf(f, "index %s\n", anchor_index_name(config->index_mode));
+    if (config->index_mode == ANCHOR_INDEX_HNSW) fprintf(f, "ef %d\nrecall %f\n", config->index_ef, config->index_recall);
+    if (config->varorder_frames > 0) fprintf(f, "varorder %ld\n", config->varorder_frames);
+    if (config->metric != METRIC_L2) fprintf(f, "metric %s\n", metric_name(config->metric));
+    if (config->weights_filename) fprintf(f, "weights %s\n", config->weights_filename);
+    if (config->sparse_fill > 0.0) fprintf(f, "sparse %f\n", config->sparse_fill);
+    if (config->delta_period > 0) fprintf(f, "delta %d\n", config->delta_period);
     
     if (config->output_tm) fprintf(f, "tm_out\n");
     if (config->output_anchors) fprintf(f, "anchors\n");
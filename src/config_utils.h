@@ -7,6 +7,9 @@
 // Returns 1 if value was consumed, 0 if only key was used (flag), -1 on error/unknown.
 int apply_option(ClusterConfig *config, const char *key, const char *value);
 
+// Option name of an anchor index mode
+const char *anchor_index_name(AnchorIndexMode mode);
+
 // Read configuration from file
 int read_config_file(const char *filename, ClusterConfig *config);
 
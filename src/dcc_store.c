@@ -0,0 +1,117 @@
+#include "dcc_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t entry_size(DccType type) {
+    switch (type) {
+        case DCC_FLOAT: return sizeof(float);
+        case DCC_Q16: return sizeof(uint16_t);
+        default: return sizeof(double);
+    }
+}
+
+const char *dcc_type_name(DccType type) {
+    switch (type) {
+        case DCC_FLOAT: return "float";
+        case DCC_Q16: return "q16";
+        default: return "double";
+    }
+}
+
+int dcc_type_from_name(const char *name) {
+    if (strcmp(name, "double") == 0) return DCC_DOUBLE;
+    if (strcmp(name, "float") == 0) return DCC_FLOAT;
+    if (strcmp(name, "q16") == 0) return DCC_Q16;
+    return -1;
+}
+
+int dcc_store_init(DccStore *s, DccType type, int capacity, double rlim) {
+    memset(s, 0, sizeof(DccStore));
+    if (capacity <= 0) return -1;
+    int max_rows = (capacity + DCC_TILE - 1) / DCC_TILE;
+    s->slot = (int *)malloc(capacity * sizeof(int));
+    s->free_slots = (int *)malloc(capacity * sizeof(int));
+    s->rows = (void **)calloc(max_rows, sizeof(void *));
+    if (!s->slot || !s->free_slots || !s->rows) {
+        perror("Memory allocation failed for dcc store");
+        dcc_store_free(s);
+        return -1;
+    }
+    s->type = type;
+    s->capacity = capacity;
+    s->q_step = ((rlim > 0.0) ? rlim : 1.0) / DCC_Q16_STEPS;
+    return 0;
+}
+
+// Entries of a new block row or of a reused slot: not computed
+static void fill_none(DccType type, void *p, size_t n) {
+    switch (type) {
+        case DCC_FLOAT:
+            for (size_t i = 0; i < n; i++) ((float *)p)[i] = -1.0f;
+            break;
+        case DCC_Q16:
+            memset(p, 0xFF, n * sizeof(uint16_t));
+            break;
+        default:
+            for (size_t i = 0; i < n; i++) ((double *)p)[i] = -1.0;
+            break;
+    }
+}
+
+static int alloc_slot(DccStore *s) {
+    if (s->nfree > 0) return s->free_slots[--s->nfree];
+    int slot = s->next_slot;
+    int row = slot >> DCC_TILE_SHIFT;
+    if (row >= s->nrows) {
+        size_t n = (size_t)(row + 1) << (2 * DCC_TILE_SHIFT);
+        void *p = malloc(n * entry_size(s->type));
+        if (!p) return -1;
+        fill_none(s->type, p, n);
+        s->rows[row] = p;
+        s->nrows = row + 1;
+        s->bytes += n * entry_size(s->type);
+    }
+    s->next_slot++;
+    return slot;
+}
+
+int dcc_store_add(DccStore *s, int idx) {
+    if (idx != s->count || idx >= s->capacity) return -1;
+    int reused = s->nfree > 0;
+    int slot = alloc_slot(s);
+    s->slot[s->count++] = slot;
+    if (slot < 0) {
+        perror("Memory allocation failed for dcc store");
+        return -1;
+    }
+    // A reused slot still holds its previous cluster's distances
+    if (reused) {
+        for (int t = 0; t < s->next_slot; t++) {
+            int a = slot, b = t;
+            if (a < b) {
+                a = t;
+                b = slot;
+            }
+            fill_none(s->type, (char *)s->rows[a >> DCC_TILE_SHIFT] + dcc_store_offset(a, b) * entry_size(s->type), 1);
+        }
+    }
+    return 0;
+}
+
+void dcc_store_remove(DccStore *s, int idx) {
+    if (idx < 0 || idx >= s->count) return;
+    if (s->slot[idx] >= 0) s->free_slots[s->nfree++] = s->slot[idx];
+    memmove(s->slot + idx, s->slot + idx + 1, (s->count - idx - 1) * sizeof(int));
+    s->count--;
+}
+
+void dcc_store_free(DccStore *s) {
+    if (s->rows) {
+        for (int i = 0; i < s->nrows; i++) free(s->rows[i]);
+    }
+    free(s->rows);
+    free(s->slot);
+    free(s->free_slots);
+    memset(s, 0, sizeof(DccStore));
+}
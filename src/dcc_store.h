@@ -0,0 +1,213 @@
+#ifndef DCC_STORE_H
+#define DCC_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Anchor-to-anchor distance cache. Clusters map to slots; removing a
+// cluster frees its slot and shifts the map, not the distances. One triangle
+// is stored, in 64 x 64 tiles grouped by block row, and a block row is
+// allocated when its first slot is: memory follows the number of clusters,
+// not maxnbclust. Entries not computed read as -1.
+//
+// DCC_FLOAT and DCC_Q16 trade precision for memory: the stored distance is
+// rounded (Q16: to rlim / DCC_Q16_STEPS), so the pruning tests that read it
+// are approximate by that much. A Q16 distance of DCC_Q16_SAT steps or more
+// does not fit: its entry only records that it is at least
+// dcc_store_floor(), and reads it as not computed.
+//
+// Parallel loops fill entries with dcc_store_claim() / dcc_store_publish():
+// an entry goes from none (-1) to busy (-2) to ready with atomic accesses,
+// so each distance is computed once, by the thread that claimed it.
+
+typedef enum {
+    DCC_DOUBLE = 0,
+    DCC_FLOAT = 1,
+    DCC_Q16 = 2
+} DccType;
+
+#define DCC_TILE_SHIFT 6
+#define DCC_TILE (1 << DCC_TILE_SHIFT)
+#define DCC_Q16_STEPS 256
+#define DCC_Q16_NONE 0xFFFF
+#define DCC_Q16_BUSY 0xFFFE
+#define DCC_Q16_SAT 0xFFFD
+
+typedef struct {
+    DccType type;
+    int capacity;   // Clusters
+    int count;      // Clusters mapped
+    int *slot;      // Per cluster (-1: no storage, always recomputed)
+    int *free_slots;
+    int nfree;
+    int next_slot;  // Slots used so far
+    int nrows;      // Block rows allocated
+    void **rows;    // Block row I: tiles (I, 0..I)
+    double q_step;  // DCC_Q16: distance per step
+    size_t bytes;
+} DccStore;
+
+int dcc_store_init(DccStore *s, DccType type, int capacity, double rlim);
+
+// Map cluster idx (== s->count), its distances not computed. Returns 0, or -1
+// if no storage could be allocated (the cluster still gets mapped).
+int dcc_store_add(DccStore *s, int idx);
+
+// Unmap cluster idx; clusters above it shift down by one
+void dcc_store_remove(DccStore *s, int idx);
+
+void dcc_store_free(DccStore *s);
+
+const char *dcc_type_name(DccType type);
+int dcc_type_from_name(const char *name); // -1 if unknown
+
+static inline size_t dcc_store_offset(int a, int b) {
+    return ((size_t)(b >> DCC_TILE_SHIFT) << (2 * DCC_TILE_SHIFT)) + ((size_t)(a & (DCC_TILE - 1)) << DCC_TILE_SHIFT) + (b & (DCC_TILE - 1));
+}
+
+// DCC_Q16: lower bound on a saturated distance
+static inline double dcc_store_floor(const DccStore *s) {
+    return (DCC_Q16_SAT - 0.5) * s->q_step;
+}
+
+// Distance between clusters i and j, -1 if not computed (or saturated)
+static inline double dcc_store_get(const DccStore *s, int i, int j) {
+    int a = s->slot[i], b = s->slot[j];
+    if (a < 0 || b < 0) return -1.0;
+    if (a < b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    const void *row = s->rows[a >> DCC_TILE_SHIFT];
+    size_t off = dcc_store_offset(a, b);
+    switch (s->type) {
+        case DCC_FLOAT: return ((const float *)row)[off];
+        case DCC_Q16: {
+            uint16_t q = ((const uint16_t *)row)[off];
+            return (q >= DCC_Q16_SAT) ? -1.0 : q * s->q_step;
+        }
+        default: return ((const double *)row)[off];
+    }
+}
+
+// DCC_Q16: whether the distance between clusters i and j is known only to
+// be at least dcc_store_floor()
+static inline int dcc_store_saturated(const DccStore *s, int i, int j) {
+    if (s->type != DCC_Q16) return 0;
+    int a = s->slot[i], b = s->slot[j];
+    if (a < 0 || b < 0) return 0;
+    if (a < b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    return ((const uint16_t *)s->rows[a >> DCC_TILE_SHIFT])[dcc_store_offset(a, b)] == DCC_Q16_SAT;
+}
+
+static inline void dcc_store_put(DccStore *s, int i, int j, double d) {
+    int a = s->slot[i], b = s->slot[j];
+    if (a < 0 || b < 0) return;
+    if (a < b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    void *row = s->rows[a >> DCC_TILE_SHIFT];
+    size_t off = dcc_store_offset(a, b);
+    switch (s->type) {
+        case DCC_FLOAT: ((float *)row)[off] = (float)d; break;
+        case DCC_Q16: {
+            double q = d / s->q_step + 0.5;
+            ((uint16_t *)row)[off] = (q < DCC_Q16_SAT) ? (uint16_t)q : DCC_Q16_SAT;
+            break;
+        }
+        default: ((double *)row)[off] = d; break;
+    }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define DCC_LOAD(p, v) __atomic_load((p), (v), __ATOMIC_ACQUIRE)
+#define DCC_STORE(p, v) __atomic_store((p), (v), __ATOMIC_RELEASE)
+#define DCC_CAS(p, expect, v) __atomic_compare_exchange((p), (expect), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+#define DCC_LOAD(p, v) (*(v) = *(p))
+#define DCC_STORE(p, v) (*(p) = *(v))
+#define DCC_CAS(p, expect, v) ((*(p) == *(expect)) ? (*(p) = *(v), 1) : (*(expect) = *(p), 0))
+#endif
+
+// Claim entry (i, j): returns its distance if ready, -1 if the caller now
+// owns it and must compute it and call dcc_store_publish(), -2 if the pair
+// has no storage, or -3 if it is saturated (for both: compute it, do not
+// publish). Waits while another thread computes it.
+static inline double dcc_store_claim(DccStore *s, int i, int j) {
+    int a = s->slot[i], b = s->slot[j];
+    if (a < 0 || b < 0) return -2.0;
+    if (a < b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    void *row = s->rows[a >> DCC_TILE_SHIFT];
+    size_t off = dcc_store_offset(a, b);
+    for (;;) {
+        switch (s->type) {
+            case DCC_FLOAT: {
+                float *p = (float *)row + off;
+                float v, none = -1.0f, busy = -2.0f;
+                DCC_LOAD(p, &v);
+                if (v >= 0.0f) return v;
+                if (v == none && DCC_CAS(p, &none, &busy)) return -1.0;
+                break;
+            }
+            case DCC_Q16: {
+                uint16_t *p = (uint16_t *)row + off;
+                uint16_t v, none = DCC_Q16_NONE, busy = DCC_Q16_BUSY;
+                DCC_LOAD(p, &v);
+                if (v < DCC_Q16_SAT) return v * s->q_step;
+                if (v == DCC_Q16_SAT) return -3.0;
+                if (v == none && DCC_CAS(p, &none, &busy)) return -1.0;
+                break;
+            }
+            default: {
+                double *p = (double *)row + off;
+                double v, none = -1.0, busy = -2.0;
+                DCC_LOAD(p, &v);
+                if (v >= 0.0) return v;
+                if (v == none && DCC_CAS(p, &none, &busy)) return -1.0;
+                break;
+            }
+        }
+    }
+}
+
+// Store the distance of a claimed entry and make it visible to other threads
+static inline void dcc_store_publish(DccStore *s, int i, int j, double d) {
+    int a = s->slot[i], b = s->slot[j];
+    if (a < 0 || b < 0) return;
+    if (a < b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    void *row = s->rows[a >> DCC_TILE_SHIFT];
+    size_t off = dcc_store_offset(a, b);
+    switch (s->type) {
+        case DCC_FLOAT: {
+            float v = (float)d;
+            DCC_STORE((float *)row + off, &v);
+            break;
+        }
+        case DCC_Q16: {
+            double q = d / s->q_step + 0.5;
+            uint16_t v = (q < DCC_Q16_SAT) ? (uint16_t)q : DCC_Q16_SAT;
+            DCC_STORE((uint16_t *)row + off, &v);
+            break;
+        }
+        default:
+            DCC_STORE((double *)row + off, &d);
+            break;
+    }
+}
+
+#endif // DCC_STORE_H
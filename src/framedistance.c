@@ -1,50 +1,1950 @@
-#include "common.h"
+#include "framedistance.h"
 #include <math.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
-#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Runtime-dispatched kernels are only built for x86 with GCC/Clang, which
+// allow per-function target attributes. Everything else uses the scalar path.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define GRIC_X86_DISPATCH 1
 #include <immintrin.h>
 #endif
 
-double framedist(Frame *a, Frame *b) {
+// Sum of squared differences over n doubles
+typedef double (*sqdist_f64_fn)(const double *restrict a, const double *restrict b, long n);
+// Sum of squared differences over n floats
+typedef double (*sqdist_f32_fn)(const float *restrict a, const float *restrict b, long n);
+// Exact sums of squared differences over 8-bit and 16-bit integers.
+// 'bias' is XORed into each 16-bit value (0x8000 maps int16 onto uint16 order).
+typedef uint64_t (*sqdist_u8_fn)(const uint8_t *restrict a, const uint8_t *restrict b, long n);
+typedef uint64_t (*sqdist_u16_fn)(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias);
+// Dot products of one uint8 vector with BATCH_K others, accumulated into out[]
+typedef void (*dot_u8xk_fn)(const uint8_t *restrict a, const uint8_t *const *b, long off, long n, uint64_t *out);
+
+// Weighted sum of squared differences over n doubles
+typedef double (*wsqdist_f64_fn)(const double *restrict a, const double *restrict b, const double *restrict w, long n);
+// a.b, a.a and b.b over n doubles
+typedef void (*dot3_f64_fn)(const double *restrict a, const double *restrict b, long n, double *out);
+
+// Weight maps are scanned in chunks of this many elements; chunks whose
+// weights are all zero (masked) are skipped by the weighted kernels.
+#define WEIGHT_CHUNK 64
+
+// Anchors scored together by the fused uint8 batch kernel, and the chunk
+// length per call (keeps its 32-bit madd lanes below 2^32)
+#define BATCH_K 4
+// Anchor rows gathered per packed fixed-dimension batch call
+#define BATCH_FIXED_MAX 256
+#define DOT_U8_CHUNK 65536
+
+// uint8 kernels accumulate madd pairs in 32-bit lanes: flush to 64 bits
+// before a lane can exceed 2^31 (each lane gains at most 4*255^2 per step).
+#define U8_FLUSH_STEPS 8192
+
+// Float kernels accumulate in single precision over blocks of this many
+// elements, then add the block sum into a double total.
+#define F32_BLOCK 256
+
+// Float results within this relative distance of the guard radius (rlim)
+// are recomputed with double arithmetic.
+#define F32_GUARD_EPS 1e-4
+
+// Distances are summed over blocks of at least ABANDON_BLOCK elements (at
+// most ABANDON_MAX_BLOCKS blocks per frame). framedist and framedist_bounded
+// share this blocking, so a bounded call that runs to completion returns
+// exactly the framedist value.
+#define ABANDON_BLOCK 1024
+#define ABANDON_MAX_BLOCKS 1024
+
+static double sqdist_f64_scalar(const double *restrict a, const double *restrict b, long n) {
+    double sum = 0.0;
+    for (long i = 0; i < n; i++) {
+        double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static double sqdist_f32_scalar(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    for (long i0 = 0; i0 < n; i0 += F32_BLOCK) {
+        long i1 = (i0 + F32_BLOCK < n) ? i0 + F32_BLOCK : n;
+        float bsum = 0.0f;
+        for (long i = i0; i < i1; i++) {
+            float diff = a[i] - b[i];
+            bsum += diff * diff;
+        }
+        sum += bsum;
+    }
+    return sum;
+}
+
+// Float inputs, double arithmetic (refinement path)
+static double sqdist_f32w_scalar(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    for (long i = 0; i < n; i++) {
+        double diff = (double)a[i] - (double)b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static uint64_t sqdist_u8_scalar(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    uint64_t sum = 0;
+    for (long i = 0; i < n; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+static uint64_t sqdist_u16_scalar(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias) {
+    uint64_t sum = 0;
+    for (long i = 0; i < n; i++) {
+        int64_t diff = (int64_t)(uint16_t)(a[i] ^ bias) - (int64_t)(uint16_t)(b[i] ^ bias);
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+static void dot_u8xk_scalar(const uint8_t *restrict a, const uint8_t *const *b, long off, long n, uint64_t *out) {
+    for (int k = 0; k < BATCH_K; k++) {
+        const uint8_t *bk = b[k] + off;
+        uint64_t sum = 0;
+        for (long i = 0; i < n; i++) sum += (uint32_t)a[off + i] * bk[i];
+        out[k] += sum;
+    }
+}
+
+static double l1_f64_scalar(const double *restrict a, const double *restrict b, long n) {
+    double sum = 0.0;
+    for (long i = 0; i < n; i++) sum += fabs(a[i] - b[i]);
+    return sum;
+}
+
+static double linf_f64_scalar(const double *restrict a, const double *restrict b, long n) {
+    double m = 0.0;
+    for (long i = 0; i < n; i++) {
+        double d = fabs(a[i] - b[i]);
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+static double l1_f32_scalar(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    for (long i = 0; i < n; i++) sum += fabs((double)a[i] - (double)b[i]);
+    return sum;
+}
+
+static double linf_f32_scalar(const float *restrict a, const float *restrict b, long n) {
+    double m = 0.0;
+    for (long i = 0; i < n; i++) {
+        double d = fabs((double)a[i] - (double)b[i]);
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+static uint64_t l1_u8_scalar(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    uint64_t sum = 0;
+    for (long i = 0; i < n; i++) sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+static uint64_t linf_u8_scalar(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    int m = 0;
+    for (long i = 0; i < n; i++) {
+        int d = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+        if (d > m) m = d;
+    }
+    return (uint64_t)m;
+}
+
+static uint64_t l1_u16(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias) {
+    uint64_t sum = 0;
+    for (long i = 0; i < n; i++) {
+        int32_t d = (int32_t)(uint16_t)(a[i] ^ bias) - (int32_t)(uint16_t)(b[i] ^ bias);
+        sum += (uint64_t)(d < 0 ? -d : d);
+    }
+    return sum;
+}
+
+static uint64_t linf_u16(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias) {
+    int32_t m = 0;
+    for (long i = 0; i < n; i++) {
+        int32_t d = (int32_t)(uint16_t)(a[i] ^ bias) - (int32_t)(uint16_t)(b[i] ^ bias);
+        if (d < 0) d = -d;
+        if (d > m) m = d;
+    }
+    return (uint64_t)m;
+}
+
+static double wsqdist_f64_scalar(const double *restrict a, const double *restrict b, const double *restrict w, long n) {
+    double sum = 0.0;
+    for (long i = 0; i < n; i++) {
+        double diff = a[i] - b[i];
+        sum += w[i] * diff * diff;
+    }
+    return sum;
+}
+
+static void dot3_f64_scalar(const double *restrict a, const double *restrict b, long n, double *out) {
+    double ab = 0.0, aa = 0.0, bb = 0.0;
+    for (long i = 0; i < n; i++) {
+        ab += a[i] * b[i];
+        aa += a[i] * a[i];
+        bb += b[i] * b[i];
+    }
+    out[0] += ab;
+    out[1] += aa;
+    out[2] += bb;
+}
+
+#ifdef GRIC_X86_DISPATCH
+
+__attribute__((target("sse2")))
+static double sqdist_f64_sse2(const double *restrict a, const double *restrict b, long n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d d0 = _mm_sub_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i]));
+        __m128d d1 = _mm_sub_pd(_mm_loadu_pd(&a[i + 2]), _mm_loadu_pd(&b[i + 2]));
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    double sum = _mm_cvtsd_f64(acc0) + _mm_cvtsd_f64(_mm_unpackhi_pd(acc0, acc0));
+    for (; i < n; i++) {
+        double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double sqdist_f64_avx2(const double *restrict a, const double *restrict b, long n) {
+    // Four independent accumulators hide the FMA latency
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(&a[i]),      _mm256_loadu_pd(&b[i]));
+        __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(&a[i + 4]),  _mm256_loadu_pd(&b[i + 4]));
+        __m256d d2 = _mm256_sub_pd(_mm256_loadu_pd(&a[i + 8]),  _mm256_loadu_pd(&b[i + 8]));
+        __m256d d3 = _mm256_sub_pd(_mm256_loadu_pd(&a[i + 12]), _mm256_loadu_pd(&b[i + 12]));
+        acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+        acc2 = _mm256_fmadd_pd(d2, d2, acc2);
+        acc3 = _mm256_fmadd_pd(d3, d3, acc3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+        acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+    }
+    acc0 = _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3));
+    __m128d lo = _mm256_castpd256_pd128(acc0);
+    __m128d hi = _mm256_extractf128_pd(acc0, 1);
+    lo = _mm_add_pd(lo, hi);
+    double sum = _mm_cvtsd_f64(lo) + _mm_cvtsd_f64(_mm_unpackhi_pd(lo, lo));
+    for (; i < n; i++) {
+        double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static double sqdist_f64_avx512(const double *restrict a, const double *restrict b, long n) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512d d0 = _mm512_sub_pd(_mm512_loadu_pd(&a[i]),     _mm512_loadu_pd(&b[i]));
+        __m512d d1 = _mm512_sub_pd(_mm512_loadu_pd(&a[i + 8]), _mm512_loadu_pd(&b[i + 8]));
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm512_fmadd_pd(d1, d1, acc1);
+    }
+    // Masked tail: no scalar cleanup loop
+    while (i < n) {
+        long rem = n - i;
+        __mmask8 m = (rem >= 8) ? (__mmask8)0xFF : (__mmask8)((1u << rem) - 1u);
+        __m512d d0 = _mm512_sub_pd(_mm512_maskz_loadu_pd(m, &a[i]), _mm512_maskz_loadu_pd(m, &b[i]));
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        i += 8;
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+}
+
+__attribute__((target("sse2")))
+static double sqdist_f32_sse2(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    long i = 0;
+    while (i + 8 <= n) {
+        long iend = (i + F32_BLOCK < n) ? i + F32_BLOCK : n;
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        for (; i + 8 <= iend; i += 8) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i]));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(&a[i + 4]), _mm_loadu_ps(&b[i + 4]));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+        }
+        acc0 = _mm_add_ps(acc0, acc1);
+        __m128d lo = _mm_cvtps_pd(acc0);
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(acc0, acc0));
+        lo = _mm_add_pd(lo, hi);
+        sum += _mm_cvtsd_f64(lo) + _mm_cvtsd_f64(_mm_unpackhi_pd(lo, lo));
+    }
+    for (; i < n; i++) {
+        double diff = (double)a[i] - (double)b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static double sqdist_f32w_sse2(const float *restrict a, const float *restrict b, long n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(&a[i]);
+        __m128 vb = _mm_loadu_ps(&b[i]);
+        __m128d d0 = _mm_sub_pd(_mm_cvtps_pd(va), _mm_cvtps_pd(vb));
+        __m128d d1 = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(va, va)), _mm_cvtps_pd(_mm_movehl_ps(vb, vb)));
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    double sum = _mm_cvtsd_f64(acc0) + _mm_cvtsd_f64(_mm_unpackhi_pd(acc0, acc0));
+    for (; i < n; i++) {
+        double diff = (double)a[i] - (double)b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double hsum_ps256_to_pd(__m256 v) {
+    __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+    __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+    __m256d s4 = _mm256_add_pd(lo, hi);
+    __m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(s4), _mm256_extractf128_pd(s4, 1));
+    return _mm_cvtsd_f64(s2) + _mm_cvtsd_f64(_mm_unpackhi_pd(s2, s2));
+}
+
+__attribute__((target("avx2,fma")))
+static double sqdist_f32_avx2(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    long i = 0;
+    while (i + 8 <= n) {
+        long iend = (i + F32_BLOCK < n) ? i + F32_BLOCK : n;
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        for (; i + 32 <= iend; i += 32) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(&a[i]),      _mm256_loadu_ps(&b[i]));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(&a[i + 8]),  _mm256_loadu_ps(&b[i + 8]));
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(&a[i + 16]), _mm256_loadu_ps(&b[i + 16]));
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(&a[i + 24]), _mm256_loadu_ps(&b[i + 24]));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+        }
+        for (; i + 8 <= iend; i += 8) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        }
+        sum += hsum_ps256_to_pd(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    }
+    for (; i < n; i++) {
+        double diff = (double)a[i] - (double)b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double sqdist_f32w_avx2(const float *restrict a, const float *restrict b, long n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[i])),      _mm256_cvtps_pd(_mm_loadu_ps(&b[i])));
+        __m256d d1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[i + 4])),  _mm256_cvtps_pd(_mm_loadu_ps(&b[i + 4])));
+        __m256d d2 = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[i + 8])),  _mm256_cvtps_pd(_mm_loadu_ps(&b[i + 8])));
+        __m256d d3 = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[i + 12])), _mm256_cvtps_pd(_mm_loadu_ps(&b[i + 12])));
+        acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+        acc2 = _mm256_fmadd_pd(d2, d2, acc2);
+        acc3 = _mm256_fmadd_pd(d3, d3, acc3);
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(&a[i])), _mm256_cvtps_pd(_mm_loadu_ps(&b[i])));
+        acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+    }
+    acc0 = _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3));
+    __m128d lo = _mm256_castpd256_pd128(acc0);
+    __m128d hi = _mm256_extractf128_pd(acc0, 1);
+    lo = _mm_add_pd(lo, hi);
+    double sum = _mm_cvtsd_f64(lo) + _mm_cvtsd_f64(_mm_unpackhi_pd(lo, lo));
+    for (; i < n; i++) {
+        double diff = (double)a[i] - (double)b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static double sqdist_f32_avx512(const float *restrict a, const float *restrict b, long n) {
+    double sum = 0.0;
+    long i = 0;
+    while (i < n) {
+        long iend = (i + F32_BLOCK < n) ? i + F32_BLOCK : n;
+        __m512 acc0 = _mm512_setzero_ps();
+        __m512 acc1 = _mm512_setzero_ps();
+        for (; i + 32 <= iend; i += 32) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(&a[i]),      _mm512_loadu_ps(&b[i]));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(&a[i + 16]), _mm512_loadu_ps(&b[i + 16]));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+        }
+        while (i < iend) {
+            long rem = iend - i;
+            __mmask16 m = (rem >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << rem) - 1u);
+            __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, &a[i]), _mm512_maskz_loadu_ps(m, &b[i]));
+            acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+            i += (rem >= 16) ? 16 : rem;
+        }
+        acc0 = _mm512_add_ps(acc0, acc1);
+        __m512d lo = _mm512_cvtps_pd(_mm512_castps512_ps256(acc0));
+        __m512d hi = _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc0), 1)));
+        sum += _mm512_reduce_add_pd(_mm512_add_pd(lo, hi));
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static double sqdist_f32w_avx512(const float *restrict a, const float *restrict b, long n) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512d d0 = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(&a[i])),     _mm512_cvtps_pd(_mm256_loadu_ps(&b[i])));
+        __m512d d1 = _mm512_sub_pd(_mm512_cvtps_pd(_mm256_loadu_ps(&a[i + 8])), _mm512_cvtps_pd(_mm256_loadu_ps(&b[i + 8])));
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        acc1 = _mm512_fmadd_pd(d1, d1, acc1);
+    }
+    while (i < n) {
+        long rem = n - i;
+        __mmask16 m = (rem >= 8) ? (__mmask16)0xFF : (__mmask16)((1u << rem) - 1u);
+        __m256 va = _mm512_castps512_ps256(_mm512_maskz_loadu_ps(m, &a[i]));
+        __m256 vb = _mm512_castps512_ps256(_mm512_maskz_loadu_ps(m, &b[i]));
+        __m512d d0 = _mm512_sub_pd(_mm512_cvtps_pd(va), _mm512_cvtps_pd(vb));
+        acc0 = _mm512_fmadd_pd(d0, d0, acc0);
+        i += 8;
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+}
+
+__attribute__((target("sse2")))
+static uint64_t sqdist_u8_sse2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc64 = _mm_setzero_si128();
+    long i = 0;
+    while (i + 16 <= n) {
+        __m128i acc32 = _mm_setzero_si128();
+        for (long step = 0; step < U8_FLUSH_STEPS && i + 16 <= n; step++, i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+            __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+            __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i lo = _mm_unpacklo_epi8(d, zero);
+            __m128i hi = _mm_unpackhi_epi8(d, zero);
+            acc32 = _mm_add_epi32(acc32, _mm_madd_epi16(lo, lo));
+            acc32 = _mm_add_epi32(acc32, _mm_madd_epi16(hi, hi));
+        }
+        acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(acc32, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc64);
+    uint64_t sum = lanes[0] + lanes[1];
+    for (; i < n; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static uint64_t sqdist_u16_sse2(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vbias = _mm_set1_epi16((short)bias);
+    __m128i acc64 = _mm_setzero_si128();
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i va = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&a[i]), vbias);
+        __m128i vb = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&b[i]), vbias);
+        __m128i d = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+        // |d|^2 < 2^32: assemble the 32-bit products from low/high halves
+        __m128i plo = _mm_mullo_epi16(d, d);
+        __m128i phi = _mm_mulhi_epu16(d, d);
+        __m128i p0 = _mm_unpacklo_epi16(plo, phi);
+        __m128i p1 = _mm_unpackhi_epi16(plo, phi);
+        acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(p0, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(p0, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(p1, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(p1, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc64);
+    uint64_t sum = lanes[0] + lanes[1];
+    for (; i < n; i++) {
+        int64_t diff = (int64_t)(uint16_t)(a[i] ^ bias) - (int64_t)(uint16_t)(b[i] ^ bias);
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t hsum_epi64_256(__m256i v) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static uint64_t sqdist_u8_avx2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc64 = _mm256_setzero_si256();
+    long i = 0;
+    while (i + 32 <= n) {
+        __m256i acc32 = _mm256_setzero_si256();
+        for (long step = 0; step < U8_FLUSH_STEPS && i + 32 <= n; step++, i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+            __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+            __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i lo = _mm256_unpacklo_epi8(d, zero);
+            __m256i hi = _mm256_unpackhi_epi8(d, zero);
+            acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(lo, lo));
+            acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(hi, hi));
+        }
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(acc32, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t sum = hsum_epi64_256(acc64);
+    for (; i < n; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t sqdist_u16_avx2(const uint16_t *restrict a, const uint16_t *restrict b, long n, uint16_t bias) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i vbias = _mm256_set1_epi16((short)bias);
+    __m256i acc64 = _mm256_setzero_si256();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&a[i]), vbias);
+        __m256i vb = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&b[i]), vbias);
+        __m256i d = _mm256_or_si256(_mm256_subs_epu16(va, vb), _mm256_subs_epu16(vb, va));
+        __m256i plo = _mm256_mullo_epi16(d, d);
+        __m256i phi = _mm256_mulhi_epu16(d, d);
+        __m256i p0 = _mm256_unpacklo_epi16(plo, phi);
+        __m256i p1 = _mm256_unpackhi_epi16(plo, phi);
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(p0, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(p0, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(p1, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(p1, zero));
+    }
+    uint64_t sum = hsum_epi64_256(acc64);
+    for (; i < n; i++) {
+        int64_t diff = (int64_t)(uint16_t)(a[i] ^ bias) - (int64_t)(uint16_t)(b[i] ^ bias);
+        sum += (uint64_t)(diff * diff);
+    }
+    return sum;
+}
+
+// Fused dot products: each 16/32-byte chunk of 'a' is widened once and
+// multiplied with the matching chunk of all BATCH_K anchors. Callers keep
+// n <= DOT_U8_CHUNK so the 32-bit madd lanes cannot overflow.
+__attribute__((target("sse2")))
+static void dot_u8xk_sse2(const uint8_t *restrict a, const uint8_t *const *b, long off, long n, uint64_t *out) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc[BATCH_K];
+    for (int k = 0; k < BATCH_K; k++) acc[k] = _mm_setzero_si128();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[off + i]);
+        __m128i alo = _mm_unpacklo_epi8(va, zero);
+        __m128i ahi = _mm_unpackhi_epi8(va, zero);
+        for (int k = 0; k < BATCH_K; k++) {
+            __m128i vb = _mm_loadu_si128((const __m128i *)&b[k][off + i]);
+            acc[k] = _mm_add_epi32(acc[k], _mm_madd_epi16(alo, _mm_unpacklo_epi8(vb, zero)));
+            acc[k] = _mm_add_epi32(acc[k], _mm_madd_epi16(ahi, _mm_unpackhi_epi8(vb, zero)));
+        }
+    }
+    for (int k = 0; k < BATCH_K; k++) {
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc[k]);
+        uint64_t sum = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (long j = i; j < n; j++) sum += (uint32_t)a[off + j] * b[k][off + j];
+        out[k] += sum;
+    }
+}
+
+__attribute__((target("avx2")))
+static void dot_u8xk_avx2(const uint8_t *restrict a, const uint8_t *const *b, long off, long n, uint64_t *out) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc[BATCH_K];
+    for (int k = 0; k < BATCH_K; k++) acc[k] = _mm256_setzero_si256();
+    long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[off + i]);
+        __m256i alo = _mm256_unpacklo_epi8(va, zero);
+        __m256i ahi = _mm256_unpackhi_epi8(va, zero);
+        for (int k = 0; k < BATCH_K; k++) {
+            __m256i vb = _mm256_loadu_si256((const __m256i *)&b[k][off + i]);
+            acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(alo, _mm256_unpacklo_epi8(vb, zero)));
+            acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(ahi, _mm256_unpackhi_epi8(vb, zero)));
+        }
+    }
+    for (int k = 0; k < BATCH_K; k++) {
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *)lanes, acc[k]);
+        uint64_t sum = 0;
+        for (int l = 0; l < 8; l++) sum += lanes[l];
+        for (long j = i; j < n; j++) sum += (uint32_t)a[off + j] * b[k][off + j];
+        out[k] += sum;
+    }
+}
+
+// L1 / Linf kernels. Float inputs are widened to double, so results are
+// exact up to the final accumulation.
+__attribute__((target("sse2")))
+static double l1_f64_sse2(const double *restrict a, const double *restrict b, long n) {
+    const __m128d signmask = _mm_set1_pd(-0.0);
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d d0 = _mm_sub_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i]));
+        __m128d d1 = _mm_sub_pd(_mm_loadu_pd(&a[i + 2]), _mm_loadu_pd(&b[i + 2]));
+        acc0 = _mm_add_pd(acc0, _mm_andnot_pd(signmask, d0));
+        acc1 = _mm_add_pd(acc1, _mm_andnot_pd(signmask, d1));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += fabs(a[i] - b[i]);
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static double linf_f64_sse2(const double *restrict a, const double *restrict b, long n) {
+    const __m128d signmask = _mm_set1_pd(-0.0);
+    __m128d vmax = _mm_setzero_pd();
+    long i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i]));
+        vmax = _mm_max_pd(vmax, _mm_andnot_pd(signmask, d));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, vmax);
+    double m = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+    for (; i < n; i++) {
+        double d = fabs(a[i] - b[i]);
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+__attribute__((target("sse2")))
+static uint64_t l1_u8_sse2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    __m128i acc = _mm_setzero_si128();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    uint64_t sum = lanes[0] + lanes[1];
+    for (; i < n; i++) sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+__attribute__((target("sse2")))
+static uint64_t linf_u8_sse2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    __m128i vmax = _mm_setzero_si128();
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+        __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+        vmax = _mm_max_epu8(vmax, _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va)));
+    }
+    uint8_t lanes[16];
+    _mm_storeu_si128((__m128i *)lanes, vmax);
+    int m = 0;
+    for (int l = 0; l < 16; l++) if (lanes[l] > m) m = lanes[l];
+    for (; i < n; i++) {
+        int d = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+        if (d > m) m = d;
+    }
+    return (uint64_t)m;
+}
+
+__attribute__((target("avx2")))
+static double l1_f64_avx2(const double *restrict a, const double *restrict b, long n) {
+    const __m256d signmask = _mm256_set1_pd(-0.0);
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+        __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(&a[i + 4]), _mm256_loadu_pd(&b[i + 4]));
+        acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(signmask, d0));
+        acc1 = _mm256_add_pd(acc1, _mm256_andnot_pd(signmask, d1));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) sum += fabs(a[i] - b[i]);
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static double linf_f64_avx2(const double *restrict a, const double *restrict b, long n) {
+    const __m256d signmask = _mm256_set1_pd(-0.0);
+    __m256d vmax = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+        vmax = _mm256_max_pd(vmax, _mm256_andnot_pd(signmask, d));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, vmax);
+    double m = 0.0;
+    for (int l = 0; l < 4; l++) if (lanes[l] > m) m = lanes[l];
+    for (; i < n; i++) {
+        double d = fabs(a[i] - b[i]);
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static double l1_f32_avx2(const float *restrict a, const float *restrict b, long n) {
+    const __m256d signmask = _mm256_set1_pd(-0.0);
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(&a[i]);
+        __m256 vb = _mm256_loadu_ps(&b[i]);
+        __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(va)), _mm256_cvtps_pd(_mm256_castps256_ps128(vb)));
+        __m256d d1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(va, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(vb, 1)));
+        acc0 = _mm256_add_pd(acc0, _mm256_andnot_pd(signmask, d0));
+        acc1 = _mm256_add_pd(acc1, _mm256_andnot_pd(signmask, d1));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) sum += fabs((double)a[i] - (double)b[i]);
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static double linf_f32_avx2(const float *restrict a, const float *restrict b, long n) {
+    const __m256d signmask = _mm256_set1_pd(-0.0);
+    __m256d vmax = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(&a[i]);
+        __m256 vb = _mm256_loadu_ps(&b[i]);
+        __m256d d0 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(va)), _mm256_cvtps_pd(_mm256_castps256_ps128(vb)));
+        __m256d d1 = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(va, 1)), _mm256_cvtps_pd(_mm256_extractf128_ps(vb, 1)));
+        vmax = _mm256_max_pd(vmax, _mm256_andnot_pd(signmask, d0));
+        vmax = _mm256_max_pd(vmax, _mm256_andnot_pd(signmask, d1));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, vmax);
+    double m = 0.0;
+    for (int l = 0; l < 4; l++) if (lanes[l] > m) m = lanes[l];
+    for (; i < n; i++) {
+        double d = fabs((double)a[i] - (double)b[i]);
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static uint64_t l1_u8_avx2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    __m256i acc = _mm256_setzero_si256();
+    long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+    uint64_t sum = hsum_epi64_256(acc);
+    for (; i < n; i++) sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static uint64_t linf_u8_avx2(const uint8_t *restrict a, const uint8_t *restrict b, long n) {
+    __m256i vmax = _mm256_setzero_si256();
+    long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+        __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+        vmax = _mm256_max_epu8(vmax, _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va)));
+    }
+    uint8_t lanes[32];
+    _mm256_storeu_si256((__m256i *)lanes, vmax);
+    int m = 0;
+    for (int l = 0; l < 32; l++) if (lanes[l] > m) m = lanes[l];
+    for (; i < n; i++) {
+        int d = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+        if (d > m) m = d;
+    }
+    return (uint64_t)m;
+}
+
+__attribute__((target("avx2,fma")))
+static double wsqdist_f64_avx2(const double *restrict a, const double *restrict b, const double *restrict w, long n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i]));
+        __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(&a[i + 4]), _mm256_loadu_pd(&b[i + 4]));
+        acc0 = _mm256_fmadd_pd(_mm256_mul_pd(_mm256_loadu_pd(&w[i]), d0), d0, acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_mul_pd(_mm256_loadu_pd(&w[i + 4]), d1), d1, acc1);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) {
+        double diff = a[i] - b[i];
+        sum += w[i] * diff * diff;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static void dot3_f64_avx2(const double *restrict a, const double *restrict b, long n, double *out) {
+    __m256d ab = _mm256_setzero_pd();
+    __m256d aa = _mm256_setzero_pd();
+    __m256d bb = _mm256_setzero_pd();
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d va = _mm256_loadu_pd(&a[i]);
+        __m256d vb = _mm256_loadu_pd(&b[i]);
+        ab = _mm256_fmadd_pd(va, vb, ab);
+        aa = _mm256_fmadd_pd(va, va, aa);
+        bb = _mm256_fmadd_pd(vb, vb, bb);
+    }
+    double l_ab[4], l_aa[4], l_bb[4];
+    _mm256_storeu_pd(l_ab, ab);
+    _mm256_storeu_pd(l_aa, aa);
+    _mm256_storeu_pd(l_bb, bb);
+    double s_ab = (l_ab[0] + l_ab[1]) + (l_ab[2] + l_ab[3]);
+    double s_aa = (l_aa[0] + l_aa[1]) + (l_aa[2] + l_aa[3]);
+    double s_bb = (l_bb[0] + l_bb[1]) + (l_bb[2] + l_bb[3]);
+    for (; i < n; i++) {
+        s_ab += a[i] * b[i];
+        s_aa += a[i] * a[i];
+        s_bb += b[i] * b[i];
+    }
+    out[0] += s_ab;
+    out[1] += s_aa;
+    out[2] += s_bb;
+}
+
+#endif // GRIC_X86_DISPATCH
+
+static sqdist_f64_fn sqdist_f64 = sqdist_f64_scalar;
+static sqdist_f32_fn sqdist_f32 = sqdist_f32_scalar;
+static sqdist_f32_fn sqdist_f32w = sqdist_f32w_scalar;
+static sqdist_u8_fn sqdist_u8 = sqdist_u8_scalar;
+static sqdist_u16_fn sqdist_u16 = sqdist_u16_scalar;
+static dot_u8xk_fn dot_u8xk = dot_u8xk_scalar;
+static sqdist_f64_fn l1_f64 = l1_f64_scalar;
+static sqdist_f64_fn linf_f64 = linf_f64_scalar;
+static sqdist_f32_fn l1_f32 = l1_f32_scalar;
+static sqdist_f32_fn linf_f32 = linf_f32_scalar;
+static sqdist_u8_fn l1_u8 = l1_u8_scalar;
+static sqdist_u8_fn linf_u8 = linf_u8_scalar;
+static wsqdist_f64_fn wsqdist_f64 = wsqdist_f64_scalar;
+static dot3_f64_fn dot3_f64 = dot3_f64_scalar;
+static SimdLevel bound_level = SIMD_SCALAR;
+
+static double guard_rlim = -1.0;
+static long refine_calls = 0;
+
+// Threads used inside one distance. Frames of at least PAR_MIN_ELEMS pixels
+// have their blocks split across the OpenMP team; with early abandon, blocks
+// are handed out PAR_WAVE per thread at a time so the bound is still checked.
+#define PAR_MIN_ELEMS (1L << 18)
+#define PAR_WAVE 4
+static int dist_threads = 1;
+
+// Fixed-dimension kernels for short double vectors (ASCII coordinate input).
+// From 64 elements on, the dispatched SIMD kernels are as fast.
+// The trip count is a compile-time constant: loops are fully unrolled, with
+// no tail and no dispatch. Up to 4 elements are summed in order; longer
+// vectors use 8 interleaved partial sums combined pairwise.
+// The summation order is fixed by the source, so results are identical at
+// every SIMD level.
+typedef double (*sqdist_fixed_fn)(const double *restrict a, const double *restrict b);
+typedef void (*batch_fixed_fn)(const double *restrict a, const double *const *b, int k, double *out);
+
+#define DEFINE_SQDIST_FIXED_SEQ(N) \
+static double sqdist_fixed_##N(const double *restrict a, const double *restrict b) { \
+    double sum = 0.0; \
+    for (int i = 0; i < N; i++) { \
+        double diff = a[i] - b[i]; \
+        sum += diff * diff; \
+    } \
+    return sum; \
+}
+
+#define DEFINE_SQDIST_FIXED_LANES(N) \
+static double sqdist_fixed_##N(const double *restrict a, const double *restrict b) { \
+    double s[8] = { 0.0 }; \
+    for (int i = 0; i < N; i += 8) { \
+        for (int l = 0; l < 8; l++) { \
+            double diff = a[i + l] - b[i + l]; \
+            s[l] += diff * diff; \
+        } \
+    } \
+    return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7])); \
+}
+
+// One point against 4 anchors at a time: lane t holds anchor t's running
+// sum, accumulated in the same order as sqdist_fixed_N.
+#define DEFINE_BATCH_FIXED(N) \
+static void batch_fixed_##N(const double *restrict a, const double *const *b, int k, double *out) { \
+    int i = 0; \
+    for (; i + 4 <= k; i += 4) { \
+        double s[4] = { 0.0, 0.0, 0.0, 0.0 }; \
+        for (int j = 0; j < N; j++) { \
+            for (int t = 0; t < 4; t++) { \
+                double diff = a[j] - b[i + t][j]; \
+                s[t] += diff * diff; \
+            } \
+        } \
+        for (int t = 0; t < 4; t++) out[i + t] = s[t]; \
+    } \
+    for (; i < k; i++) out[i] = sqdist_fixed_##N(a, b[i]); \
+}
+
+DEFINE_SQDIST_FIXED_SEQ(2)
+DEFINE_SQDIST_FIXED_SEQ(3)
+DEFINE_SQDIST_FIXED_SEQ(4)
+DEFINE_SQDIST_FIXED_LANES(8)
+DEFINE_SQDIST_FIXED_LANES(16)
+DEFINE_SQDIST_FIXED_LANES(32)
+DEFINE_BATCH_FIXED(2)
+DEFINE_BATCH_FIXED(3)
+DEFINE_BATCH_FIXED(4)
+
+static const struct {
+    long nelem;
+    sqdist_fixed_fn dist;
+    batch_fixed_fn batch;
+} fixed_kernels[] = {
+    { 2, sqdist_fixed_2, batch_fixed_2 },
+    { 3, sqdist_fixed_3, batch_fixed_3 },
+    { 4, sqdist_fixed_4, batch_fixed_4 },
+    { 8, sqdist_fixed_8, NULL },
+    { 16, sqdist_fixed_16, NULL },
+    { 32, sqdist_fixed_32, NULL },
+};
+
+static long fixed_nelem = 0;
+static sqdist_fixed_fn fixed_dist = NULL;
+static batch_fixed_fn fixed_batch = NULL;
+
+// Active metric. Weights (METRIC_WL2) are copied in framedist_set_metric;
+// weight_chunk_active[c] is 0 when chunk c is fully masked.
+static DistMetric cur_metric = METRIC_L2;
+static double *metric_weights = NULL;
+static unsigned char *weight_chunk_active = NULL;
+static long metric_nweights = 0;
+
+static const MetricInfo metric_table[] = {
+    { "l2",      1, 1 },
+    { "l1",      1, 0 },
+    { "linf",    1, 0 },
+    { "wl2",     1, 1 },
+    { "angular", 1, 0 },
+    { "cosine",  0, 0 },
+};
+#define NUM_METRICS ((int)(sizeof(metric_table) / sizeof(metric_table[0])))
+
+static const char *simd_names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+const char *simd_level_name(SimdLevel level) {
+    if (level < SIMD_SCALAR || level > SIMD_AVX512) return "auto";
+    return simd_names[level];
+}
+
+int simd_level_from_name(const char *name) {
+    if (!name) return -2;
+    if (strcmp(name, "auto") == 0) return SIMD_AUTO;
+    for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+        if (strcmp(name, simd_names[i]) == 0) return i;
+    }
+    return -2;
+}
+
+SimdLevel framedist_detect_simd(void) {
+#ifdef GRIC_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+SimdLevel framedist_init(SimdLevel requested) {
+    SimdLevel best = framedist_detect_simd();
+    SimdLevel level = best;
+    if (requested != SIMD_AUTO && requested < best) level = requested;
+
+    switch (level) {
+#ifdef GRIC_X86_DISPATCH
+        case SIMD_AVX512:
+            // Integer kernels stay on AVX2 (512-bit byte/word ops need AVX-512BW)
+            sqdist_f64 = sqdist_f64_avx512;
+            sqdist_f32 = sqdist_f32_avx512;
+            sqdist_f32w = sqdist_f32w_avx512;
+            sqdist_u8 = sqdist_u8_avx2;
+            sqdist_u16 = sqdist_u16_avx2;
+            dot_u8xk = dot_u8xk_avx2;
+            l1_f64 = l1_f64_avx2;
+            linf_f64 = linf_f64_avx2;
+            l1_f32 = l1_f32_avx2;
+            linf_f32 = linf_f32_avx2;
+            l1_u8 = l1_u8_avx2;
+            linf_u8 = linf_u8_avx2;
+            wsqdist_f64 = wsqdist_f64_avx2;
+            dot3_f64 = dot3_f64_avx2;
+            break;
+        case SIMD_AVX2:
+            sqdist_f64 = sqdist_f64_avx2;
+            sqdist_f32 = sqdist_f32_avx2;
+            sqdist_f32w = sqdist_f32w_avx2;
+            sqdist_u8 = sqdist_u8_avx2;
+            sqdist_u16 = sqdist_u16_avx2;
+            dot_u8xk = dot_u8xk_avx2;
+            l1_f64 = l1_f64_avx2;
+            linf_f64 = linf_f64_avx2;
+            l1_f32 = l1_f32_avx2;
+            linf_f32 = linf_f32_avx2;
+            l1_u8 = l1_u8_avx2;
+            linf_u8 = linf_u8_avx2;
+            wsqdist_f64 = wsqdist_f64_avx2;
+            dot3_f64 = dot3_f64_avx2;
+            break;
+        case SIMD_SSE2:
+            sqdist_f64 = sqdist_f64_sse2;
+            sqdist_f32 = sqdist_f32_sse2;
+            sqdist_f32w = sqdist_f32w_sse2;
+            sqdist_u8 = sqdist_u8_sse2;
+            sqdist_u16 = sqdist_u16_sse2;
+            dot_u8xk = dot_u8xk_sse2;
+            l1_f64 = l1_f64_sse2;
+            linf_f64 = linf_f64_sse2;
+            l1_f32 = l1_f32_scalar;
+            linf_f32 = linf_f32_scalar;
+            l1_u8 = l1_u8_sse2;
+            linf_u8 = linf_u8_sse2;
+            wsqdist_f64 = wsqdist_f64_scalar;
+            dot3_f64 = dot3_f64_scalar;
+            break;
+#endif
+        default:
+            sqdist_f64 = sqdist_f64_scalar;
+            sqdist_f32 = sqdist_f32_scalar;
+            sqdist_f32w = sqdist_f32w_scalar;
+            sqdist_u8 = sqdist_u8_scalar;
+            sqdist_u16 = sqdist_u16_scalar;
+            dot_u8xk = dot_u8xk_scalar;
+            l1_f64 = l1_f64_scalar;
+            linf_f64 = linf_f64_scalar;
+            l1_f32 = l1_f32_scalar;
+            linf_f32 = linf_f32_scalar;
+            l1_u8 = l1_u8_scalar;
+            linf_u8 = linf_u8_scalar;
+            wsqdist_f64 = wsqdist_f64_scalar;
+            dot3_f64 = dot3_f64_scalar;
+            level = SIMD_SCALAR;
+            break;
+    }
+    bound_level = level;
+    return level;
+}
+
+const char *framedist_kernel_name(void) {
+    return simd_level_name(bound_level);
+}
+
+void framedist_set_guard(double rlim) {
+    guard_rlim = rlim;
+}
+
+long framedist_refine_calls(void) {
+    return refine_calls;
+}
+
+int metric_from_name(const char *name) {
+    for (int m = 0; m < NUM_METRICS; m++) {
+        if (strcmp(name, metric_table[m].name) == 0) return m;
+    }
+    return -1;
+}
+
+const char *metric_name(DistMetric m) {
+    return (m >= 0 && m < NUM_METRICS) ? metric_table[m].name : "unknown";
+}
+
+int metric_is_metric(DistMetric m) {
+    return (m >= 0 && m < NUM_METRICS) ? metric_table[m].is_metric : 0;
+}
+
+int metric_is_euclidean(DistMetric m) {
+    return (m >= 0 && m < NUM_METRICS) ? metric_table[m].euclidean : 0;
+}
+
+int framedist_set_metric(DistMetric m, const double *weights, long nweights) {
+    if (m < 0 || m >= NUM_METRICS) return -1;
+    free(metric_weights);
+    free(weight_chunk_active);
+    metric_weights = NULL;
+    weight_chunk_active = NULL;
+    metric_nweights = 0;
+
+    if (m == METRIC_WL2) {
+        if (!weights || nweights <= 0) return -1;
+        long nchunks = (nweights + WEIGHT_CHUNK - 1) / WEIGHT_CHUNK;
+        metric_weights = (double *)malloc(nweights * sizeof(double));
+        weight_chunk_active = (unsigned char *)calloc(nchunks, 1);
+        if (!metric_weights || !weight_chunk_active) {
+            free(metric_weights);
+            free(weight_chunk_active);
+            metric_weights = NULL;
+            weight_chunk_active = NULL;
+            return -1;
+        }
+        for (long i = 0; i < nweights; i++) {
+            if (weights[i] < 0.0) {
+                free(metric_weights);
+                free(weight_chunk_active);
+                metric_weights = NULL;
+                weight_chunk_active = NULL;
+                return -1;
+            }
+            metric_weights[i] = weights[i];
+            if (weights[i] != 0.0) weight_chunk_active[i / WEIGHT_CHUNK] = 1;
+        }
+        metric_nweights = nweights;
+    }
+    cur_metric = m;
+    return 0;
+}
+
+DistMetric framedist_get_metric(void) {
+    return cur_metric;
+}
+
+static int weights_usable(long size) {
+    return metric_weights && metric_nweights == size;
+}
+
+// Mixed storage types: slow path through frame_value()
+static double metric_generic(const Frame *a, const Frame *b, long off, long n) {
+    double acc = 0.0;
+    for (long i = off; i < off + n; i++) {
+        double diff = frame_value(a, i) - frame_value(b, i);
+        switch (cur_metric) {
+            case METRIC_L1:
+                acc += fabs(diff);
+                break;
+            case METRIC_LINF:
+                if (fabs(diff) > acc) acc = fabs(diff);
+                break;
+            case METRIC_WL2:
+                acc += metric_weights[i] * diff * diff;
+                break;
+            default:
+                acc += diff * diff;
+                break;
+        }
+    }
+    return acc;
+}
+
+static void dot3_generic(const Frame *a, const Frame *b, long off, long n, double *out) {
+    for (long i = off; i < off + n; i++) {
+        double va = frame_value(a, i);
+        double vb = frame_value(b, i);
+        out[0] += va * vb;
+        out[1] += va * va;
+        out[2] += vb * vb;
+    }
+}
+
+// Sum of squared differences over elements [off, off+n) of same-dtype frames.
+// Integer sums are exact; converting them to double stays exact below 2^53.
+static double sqdist_range(const Frame *a, const Frame *b, long off, long n) {
+    switch (a->dtype) {
+        case FRAME_DTYPE_UINT8:
+            return (double)sqdist_u8((const uint8_t *)a->data + off, (const uint8_t *)b->data + off, n);
+        case FRAME_DTYPE_UINT16:
+            return (double)sqdist_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0);
+        case FRAME_DTYPE_INT16:
+            return (double)sqdist_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0x8000);
+        case FRAME_DTYPE_FLOAT:
+            return sqdist_f32((const float *)a->data + off, (const float *)b->data + off, n);
+        default:
+            return sqdist_f64((const double *)a->data + off, (const double *)b->data + off, n);
+    }
+}
+
+// Weighted squared differences over [off, off+n). Fully masked weight
+// chunks are skipped; consecutive active chunks are handled as one span.
+static double wsqdist_range(const Frame *a, const Frame *b, long off, long n) {
+    double sum = 0.0;
+    long end = off + n;
+    long i = off;
+    while (i < end) {
+        long c = i / WEIGHT_CHUNK;
+        if (!weight_chunk_active[c]) {
+            i = (c + 1) * WEIGHT_CHUNK;
+            continue;
+        }
+        long j = (c + 1) * WEIGHT_CHUNK;
+        while (j < end && weight_chunk_active[j / WEIGHT_CHUNK]) j += WEIGHT_CHUNK;
+        if (j > end) j = end;
+        if (a->dtype == FRAME_DTYPE_DOUBLE) {
+            sum += wsqdist_f64((const double *)a->data + i, (const double *)b->data + i, metric_weights + i, j - i);
+        } else {
+            sum += metric_generic(a, b, i, j - i);
+        }
+        i = j;
+    }
+    return sum;
+}
+
+// Metric partial over elements [off, off+n): a sum for L2/WL2 (squared) and
+// L1, a maximum for Linf. Partials combine with metric_combine().
+static double metric_range(const Frame *a, const Frame *b, long off, long n) {
+    if (a->dtype != b->dtype) return metric_generic(a, b, off, n);
+
+    switch (cur_metric) {
+        case METRIC_L1:
+            switch (a->dtype) {
+                case FRAME_DTYPE_UINT8:
+                    return (double)l1_u8((const uint8_t *)a->data + off, (const uint8_t *)b->data + off, n);
+                case FRAME_DTYPE_UINT16:
+                    return (double)l1_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0);
+                case FRAME_DTYPE_INT16:
+                    return (double)l1_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0x8000);
+                case FRAME_DTYPE_FLOAT:
+                    return l1_f32((const float *)a->data + off, (const float *)b->data + off, n);
+                default:
+                    return l1_f64((const double *)a->data + off, (const double *)b->data + off, n);
+            }
+        case METRIC_LINF:
+            switch (a->dtype) {
+                case FRAME_DTYPE_UINT8:
+                    return (double)linf_u8((const uint8_t *)a->data + off, (const uint8_t *)b->data + off, n);
+                case FRAME_DTYPE_UINT16:
+                    return (double)linf_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0);
+                case FRAME_DTYPE_INT16:
+                    return (double)linf_u16((const uint16_t *)a->data + off, (const uint16_t *)b->data + off, n, 0x8000);
+                case FRAME_DTYPE_FLOAT:
+                    return linf_f32((const float *)a->data + off, (const float *)b->data + off, n);
+                default:
+                    return linf_f64((const double *)a->data + off, (const double *)b->data + off, n);
+            }
+        case METRIC_WL2:
+            return wsqdist_range(a, b, off, n);
+        default:
+            return sqdist_range(a, b, off, n);
+    }
+}
+
+static inline double metric_combine(double acc, double part) {
+    if (cur_metric == METRIC_LINF) return (part > acc) ? part : acc;
+    return acc + part;
+}
+
+// Accumulated partial -> distance
+static inline double metric_finish(double acc) {
+    return (cur_metric == METRIC_L2 || cur_metric == METRIC_WL2) ? sqrt(acc) : acc;
+}
+
+// Angle-based metrics from accumulated (a.b, a.a, b.b)
+static double angular_finish(const double *d3) {
+    if (d3[1] == 0.0 || d3[2] == 0.0) {
+        // A zero frame has no direction: equal only to another zero frame
+        if (d3[1] == d3[2]) return 0.0;
+        return (cur_metric == METRIC_COSINE) ? 1.0 : M_PI / 2.0;
+    }
+    double c = d3[0] / sqrt(d3[1] * d3[2]);
+    if (c > 1.0) c = 1.0;
+    if (c < -1.0) c = -1.0;
+    return (cur_metric == METRIC_COSINE) ? 1.0 - c : acos(c);
+}
+
+static double angular_dist(const Frame *a, const Frame *b, long size) {
+    double d3[3] = { 0.0, 0.0, 0.0 };
+    if (a->dtype == FRAME_DTYPE_DOUBLE && b->dtype == FRAME_DTYPE_DOUBLE) {
+        long blen = framedist_block_len(size);
+        for (long off = 0; off < size; off += blen) {
+            long n = (off + blen < size) ? blen : size - off;
+            dot3_f64((const double *)a->data + off, (const double *)b->data + off, n, d3);
+        }
+    } else {
+        dot3_generic(a, b, 0, size, d3);
+    }
+    return angular_finish(d3);
+}
+
+#define DELTA_CMP_BLOCK 64
+
+long framedist_changed_pixels(const Frame *cur, const void *prev, uint32_t *idx, long max_changed) {
+    long size = cur->width * cur->height;
+    size_t esize = frame_dtype_size(cur->dtype);
+    const unsigned char *pc = (const unsigned char *)cur->data;
+    const unsigned char *pp = (const unsigned char *)prev;
+    long n = 0;
+    for (long off = 0; off < size; off += DELTA_CMP_BLOCK) {
+        long len = (off + DELTA_CMP_BLOCK < size) ? DELTA_CMP_BLOCK : size - off;
+        if (memcmp(pc + off * esize, pp + off * esize, len * esize) == 0) continue;
+        for (long i = off; i < off + len; i++) {
+            if (memcmp(pc + i * esize, pp + i * esize, esize) != 0) {
+                if (n >= max_changed) return -1;
+                idx[n++] = (uint32_t)i;
+            }
+        }
+    }
+    return n;
+}
+
+// (c-a)^2 - (p-a)^2 = (c-p)(c+p-2a), summed over the listed pixels
+#define DELTA_INT_SUM(T, BIAS) do { \
+    const T *c_ = (const T *)cur->data; \
+    const T *p_ = (const T *)prev; \
+    const T *a_ = (const T *)anchor->data; \
+    int64_t s_ = 0; \
+    for (long k = 0; k < n; k++) { \
+        uint32_t i = idx[k]; \
+        int64_t c = (int64_t)(T)(c_[i] ^ (BIAS)), p = (int64_t)(T)(p_[i] ^ (BIAS)), a = (int64_t)(T)(a_[i] ^ (BIAS)); \
+        s_ += (c - p) * (c + p - 2 * a); \
+    } \
+    return (double)s_; \
+} while (0)
+
+double framedist_delta_sqdist(const Frame *cur, const void *prev, const Frame *anchor, const uint32_t *idx, long n) {
+    if (anchor->dtype == cur->dtype) {
+        switch (cur->dtype) {
+            case FRAME_DTYPE_UINT8:  DELTA_INT_SUM(uint8_t, 0);
+            case FRAME_DTYPE_UINT16: DELTA_INT_SUM(uint16_t, 0);
+            case FRAME_DTYPE_INT16:  DELTA_INT_SUM(uint16_t, 0x8000);
+            default: break;
+        }
+    }
+    Frame prev_frame = *cur;
+    prev_frame.data = (void *)prev;
+    double sum = 0.0;
+    for (long k = 0; k < n; k++) {
+        double c = frame_value(cur, idx[k]);
+        double p = frame_value(&prev_frame, idx[k]);
+        double a = frame_value(anchor, idx[k]);
+        sum += (c - p) * (c + p - 2.0 * a);
+    }
+    return sum;
+}
+
+long framedist_block_len(long nelem) {
+    long blen = (nelem + ABANDON_MAX_BLOCKS - 1) / ABANDON_MAX_BLOCKS;
+    blen = (blen + 63) & ~63L;
+    return (blen > ABANDON_BLOCK) ? blen : ABANDON_BLOCK;
+}
+
+long framedist_num_blocks(long nelem) {
+    long blen = framedist_block_len(nelem);
+    return (nelem + blen - 1) / blen;
+}
+
+// Variance-first visiting order (per-pixel Welford accumulators until trained)
+static long order_target = 0;
+static long order_count = 0;
+static long order_nelem = 0;
+static double *order_mean = NULL;
+static double *order_m2 = NULL;
+static long *block_order = NULL;
+static long order_nblocks = 0;
+
+typedef struct {
+    long block;
+    double var;
+} BlockVar;
+
+static int compare_blockvar(const void *a, const void *b) {
+    const BlockVar *ba = (const BlockVar *)a;
+    const BlockVar *bb = (const BlockVar *)b;
+    if (ba->var > bb->var) return -1;
+    if (ba->var < bb->var) return 1;
+    return (ba->block < bb->block) ? -1 : (ba->block > bb->block);
+}
+
+void framedist_order_setup(long nframes) {
+    free(order_mean);
+    free(order_m2);
+    free(block_order);
+    order_mean = NULL;
+    order_m2 = NULL;
+    block_order = NULL;
+    order_target = (nframes > 1) ? nframes : 0;
+    order_count = 0;
+    order_nelem = 0;
+    order_nblocks = 0;
+}
+
+static void order_build(void) {
+    long blen = framedist_block_len(order_nelem);
+    long nblocks = framedist_num_blocks(order_nelem);
+    BlockVar *bv = (BlockVar *)malloc(nblocks * sizeof(BlockVar));
+    long *order = (long *)malloc(nblocks * sizeof(long));
+    if (bv && order) {
+        for (long k = 0; k < nblocks; k++) {
+            long i1 = (k + 1) * blen;
+            if (i1 > order_nelem) i1 = order_nelem;
+            double v = 0.0;
+            for (long i = k * blen; i < i1; i++) v += order_m2[i];
+            bv[k].block = k;
+            bv[k].var = v;
+        }
+        qsort(bv, nblocks, sizeof(BlockVar), compare_blockvar);
+        for (long k = 0; k < nblocks; k++) order[k] = bv[k].block;
+        block_order = order;
+        order_nblocks = nblocks;
+    } else {
+        free(order);
+    }
+    free(bv);
+    free(order_mean);
+    free(order_m2);
+    order_mean = NULL;
+    order_m2 = NULL;
+    order_target = 0;
+}
+
+void framedist_order_add(const Frame *f) {
+    if (order_target == 0) return;
+    long n = f->width * f->height;
+    if (order_count == 0) {
+        order_mean = (double *)calloc(n, sizeof(double));
+        order_m2 = (double *)calloc(n, sizeof(double));
+        if (!order_mean || !order_m2) {
+            framedist_order_setup(0);
+            return;
+        }
+        order_nelem = n;
+    } else if (n != order_nelem) {
+        return;
+    }
+
+    order_count++;
+    for (long i = 0; i < n; i++) {
+        double v = frame_value(f, i);
+        double delta = v - order_mean[i];
+        order_mean[i] += delta / order_count;
+        order_m2[i] += delta * (v - order_mean[i]);
+    }
+    if (order_count >= order_target) order_build();
+}
+
+int framedist_order_ready(void) {
+    return block_order != NULL;
+}
+
+// Near the threshold, single-precision rounding could flip the dfc < rlim
+// test: recompute float distances close to the guard radius in double.
+static double f32_guard(const Frame *a, const Frame *b, double d) {
+    if (a->dtype != FRAME_DTYPE_FLOAT || cur_metric != METRIC_L2) return d;
+    if (guard_rlim > 0.0 && fabs(d - guard_rlim) <= F32_GUARD_EPS * guard_rlim) {
+        #ifdef _OPENMP
+        #pragma omp atomic
+        #endif
+        refine_calls++;
+        d = sqrt(sqdist_f32w(a->data, b->data, a->width * a->height));
+    }
+    return d;
+}
+
+int framedist_sparsify(Frame *f, double max_fill) {
+    framedist_drop_sparse(f);
+    long size = f->width * f->height;
+    if (max_fill <= 0.0 || size <= 0 || size > (long)UINT32_MAX) return 0;
+
+    long max_nnz = (long)(max_fill * size);
+    long nnz = 0;
+    for (long i = 0; i < size; i++) {
+        if (frame_value(f, i) != 0.0 && ++nnz > max_nnz) return 0;
+    }
+
+    f->sp_idx = (uint32_t *)malloc((nnz > 0 ? nnz : 1) * sizeof(uint32_t));
+    f->sp_val = (double *)malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    if (!f->sp_idx || !f->sp_val) {
+        framedist_drop_sparse(f);
+        return 0;
+    }
+    double norm2 = 0.0;
+    long k = 0;
+    for (long i = 0; i < size; i++) {
+        double v = frame_value(f, i);
+        if (v != 0.0) {
+            f->sp_idx[k] = (uint32_t)i;
+            f->sp_val[k] = v;
+            norm2 += v * v;
+            k++;
+        }
+    }
+    f->nnz = nnz;
+    f->norm2 = norm2;
+    return 1;
+}
+
+void framedist_drop_sparse(Frame *f) {
+    free(f->sp_idx);
+    free(f->sp_val);
+    f->sp_idx = NULL;
+    f->sp_val = NULL;
+    f->nnz = -1;
+}
+
+// Lower-bound summary levels (block edge in pixels), coarse to fine. A level
+// is kept only if its blocks average LB_MIN_BLOCK pixels or more and its
+// block sums take at most 1/LB_MIN_SAVING of the frame's bytes (otherwise
+// the bound costs about as much as the distance).
+static const long lb_block_edge[] = {16, 4};
+#define LB_LEVELS ((int)(sizeof(lb_block_edge) / sizeof(lb_block_edge[0])))
+#define LB_MIN_BLOCK 8
+#define LB_MIN_SAVING 4
+#define LB_MIN_ELEMS 256
+// Relative margin absorbing rounding in the bounds
+#define LB_SLACK 1e-9
+
+typedef struct {
+    long bw, bh;   // Block size (clipped to the frame)
+    long nbx, nby; // Blocks per row / column
+} LbLevel;
+
+static int lb_level(long w, long h, FrameDType dtype, int l, LbLevel *g) {
+    g->bw = (lb_block_edge[l] < w) ? lb_block_edge[l] : w;
+    g->bh = (lb_block_edge[l] < h) ? lb_block_edge[l] : h;
+    g->nbx = (w + g->bw - 1) / g->bw;
+    g->nby = (h + g->bh - 1) / g->bh;
+    long n = g->nbx * g->nby;
+    return n * LB_MIN_BLOCK <= w * h &&
+           n * (long)sizeof(double) * LB_MIN_SAVING <= w * h * (long)frame_dtype_size(dtype);
+}
+
+#define LB_LOAD_ROW(T) do { \
+    const T *p = (const T *)f->data + y * w; \
+    for (long x = 0; x < w; x++) row[x] = (double)p[x]; \
+} while (0)
+
+int framedist_summarize(Frame *f) {
+    framedist_drop_summary(f);
+    long w = f->width, h = f->height;
+    if (w * h < LB_MIN_ELEMS) return 0;
+
+    LbLevel lv[LB_LEVELS];
+    long off[LB_LEVELS];
+    long total = 0;
+    for (int l = 0; l < LB_LEVELS; l++) {
+        off[l] = total;
+        if (lb_level(w, h, f->dtype, l, &lv[l])) total += lv[l].nbx * lv[l].nby;
+        else lv[l].nbx = 0;
+    }
+
+    f->lbsum = (double *)calloc(total > 0 ? total : 1, sizeof(double));
+    double *row = (double *)malloc(w * sizeof(double));
+    if (!f->lbsum || !row) {
+        free(row);
+        framedist_drop_summary(f);
+        return 0;
+    }
+    if (f->norm2 < 0.0) f->norm2 = framedist_norm2(f);
+
+    for (long y = 0; y < h; y++) {
+        switch (f->dtype) {
+            case FRAME_DTYPE_UINT8:  LB_LOAD_ROW(uint8_t); break;
+            case FRAME_DTYPE_UINT16: LB_LOAD_ROW(uint16_t); break;
+            case FRAME_DTYPE_INT16:  LB_LOAD_ROW(int16_t); break;
+            case FRAME_DTYPE_FLOAT:  LB_LOAD_ROW(float); break;
+            default:                 LB_LOAD_ROW(double); break;
+        }
+        for (int l = 0; l < LB_LEVELS; l++) {
+            if (lv[l].nbx == 0) continue;
+            double *dst = f->lbsum + off[l] + (y / lv[l].bh) * lv[l].nbx;
+            for (long bx = 0, x0 = 0; bx < lv[l].nbx; bx++, x0 += lv[l].bw) {
+                long x1 = (x0 + lv[l].bw < w) ? x0 + lv[l].bw : w;
+                double sum = 0.0;
+                for (long x = x0; x < x1; x++) sum += row[x];
+                dst[bx] += sum;
+            }
+        }
+    }
+    free(row);
+    // Scale block sums by 1/sqrt(pixels): the L2 distance between scaled
+    // sums is then a lower bound on the frame distance (Cauchy-Schwarz).
+    for (int l = 0; l < LB_LEVELS; l++) {
+        for (long by = 0; by < lv[l].nby && lv[l].nbx > 0; by++) {
+            long bh = (by == lv[l].nby - 1) ? h - by * lv[l].bh : lv[l].bh;
+            for (long bx = 0; bx < lv[l].nbx; bx++) {
+                long bw = (bx == lv[l].nbx - 1) ? w - bx * lv[l].bw : lv[l].bw;
+                f->lbsum[off[l] + by * lv[l].nbx + bx] /= sqrt((double)(bw * bh));
+            }
+        }
+    }
+    return 1;
+}
+
+void framedist_drop_summary(Frame *f) {
+    free(f->lbsum);
+    f->lbsum = NULL;
+}
+
+double framedist_lower_bound(const Frame *a, const Frame *b, double bound) {
+    if (cur_metric != METRIC_L2 || !a->lbsum || !b->lbsum) return 0.0;
+    if (a->width != b->width || a->height != b->height || a->dtype != b->dtype) return 0.0;
+
+    double lb = fabs(sqrt(a->norm2) - sqrt(b->norm2));
+    long off = 0;
+    for (int l = 0; l < LB_LEVELS && lb <= bound; l++) {
+        LbLevel g;
+        if (!lb_level(a->width, a->height, a->dtype, l, &g)) continue;
+        long n = g.nbx * g.nby;
+        const double *sa = a->lbsum + off;
+        const double *sb = b->lbsum + off;
+        double sum = 0.0;
+        for (long i = 0; i < n; i++) {
+            double diff = sa[i] - sb[i];
+            sum += diff * diff;
+        }
+        double d = sqrt(sum);
+        if (d > lb) lb = d;
+        off += n;
+    }
+    return lb * (1.0 - LB_SLACK);
+}
+
+// Squared L2 distance when 'a' is sparse. b_norm2 < 0: compute ||b||^2.
+static double sparse_sqdist(const Frame *a, const Frame *b, double b_norm2) {
+    double sum = 0.0;
+    if (b->nnz >= 0) {
+        // Merge the two sorted supports
+        long i = 0, j = 0;
+        while (i < a->nnz && j < b->nnz) {
+            double diff;
+            if (a->sp_idx[i] == b->sp_idx[j]) diff = a->sp_val[i++] - b->sp_val[j++];
+            else if (a->sp_idx[i] < b->sp_idx[j]) diff = a->sp_val[i++];
+            else diff = b->sp_val[j++];
+            sum += diff * diff;
+        }
+        for (; i < a->nnz; i++) sum += a->sp_val[i] * a->sp_val[i];
+        for (; j < b->nnz; j++) sum += b->sp_val[j] * b->sp_val[j];
+        return sum;
+    }
+
+    if (b_norm2 < 0.0) b_norm2 = (b->norm2 >= 0.0) ? b->norm2 : framedist_norm2(b);
+    double b_on = 0.0;
+    for (long k = 0; k < a->nnz; k++) {
+        double vb = frame_value(b, a->sp_idx[k]);
+        double diff = a->sp_val[k] - vb;
+        sum += diff * diff;
+        b_on += vb * vb;
+    }
+    double b_off = b_norm2 - b_on;
+    return sum + ((b_off > 0.0) ? b_off : 0.0);
+}
+
+int framedist_set_fixed_dim(long nelem) {
+    fixed_nelem = 0;
+    fixed_dist = NULL;
+    fixed_batch = NULL;
+    for (size_t i = 0; i < sizeof(fixed_kernels) / sizeof(fixed_kernels[0]); i++) {
+        if (fixed_kernels[i].nelem == nelem) {
+            fixed_nelem = nelem;
+            fixed_dist = fixed_kernels[i].dist;
+            fixed_batch = fixed_kernels[i].batch;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Both frames are double vectors of the bound fixed dimension, under L2
+static inline int fixed_ok(const Frame *a, const Frame *b) {
+    return fixed_dist && cur_metric == METRIC_L2 &&
+           a->dtype == FRAME_DTYPE_DOUBLE && b->dtype == FRAME_DTYPE_DOUBLE &&
+           a->width == b->width && a->height == b->height && a->width * a->height == fixed_nelem;
+}
+
+void framedist_set_threads(int nthreads) {
+    dist_threads = (nthreads > 1) ? nthreads : 1;
+}
+
+// Abandon threshold for 'bound', in the metric's own units (squared for L2).
+// Float block sums carry single-precision rounding: require a margin.
+static double abandon_limit(const Frame *a, double bound) {
+    double limit = metric_is_euclidean(cur_metric) ? bound * bound : bound;
+    if (a->dtype == FRAME_DTYPE_FLOAT && cur_metric == METRIC_L2) limit *= (1.0 + F32_GUARD_EPS) * (1.0 + F32_GUARD_EPS);
+    return limit;
+}
+
+#ifdef _OPENMP
+// Block partials computed by the thread team. They are combined in natural
+// block order, so the result does not depend on the number of threads and
+// equals the single-threaded one. limit < 0 disables abandoning.
+static double bounded_par(const Frame *a, const Frame *b, long size, long blen, long nblocks, double limit, int *exact) {
+    double part[ABANDON_MAX_BLOCKS];
+    const long *order = (block_order && order_nblocks == nblocks) ? block_order : NULL;
+    long wave = (limit < 0.0) ? nblocks : (long)dist_threads * PAR_WAVE;
+    double partial = 0.0;
+
+    for (long j0 = 0; j0 < nblocks; j0 += wave) {
+        long j1 = (j0 + wave < nblocks) ? j0 + wave : nblocks;
+        #pragma omp parallel for num_threads(dist_threads) schedule(static)
+        for (long j = j0; j < j1; j++) {
+            long k = order ? order[j] : j;
+            long n = (k == nblocks - 1) ? size - k * blen : blen;
+            part[k] = metric_range(a, b, k * blen, n);
+        }
+        if (limit >= 0.0) {
+            for (long j = j0; j < j1; j++) partial = metric_combine(partial, part[order ? order[j] : j]);
+            if (partial > limit && j1 < nblocks) {
+                *exact = 0;
+                return metric_finish(partial);
+            }
+        }
+    }
+
+    double sum = 0.0;
+    for (long k = 0; k < nblocks; k++) sum = metric_combine(sum, part[k]);
+    return metric_finish(sum);
+}
+#endif
+
+double framedist_bounded(Frame *a, Frame *b, double bound, int *exact) {
+    *exact = 1;
+    if (fixed_ok(a, b)) {
+        return sqrt(fixed_dist((const double *)a->data, (const double *)b->data));
+    }
     if (a->width != b->width || a->height != b->height) {
         return -1.0;
     }
 
-    double sum = 0.0;
     long size = a->width * a->height;
 
-    const double *restrict da = a->data;
-    const double *restrict db = b->data;
+    if (cur_metric == METRIC_L2 && (a->nnz >= 0 || b->nnz >= 0)) {
+        return (a->nnz >= 0) ? sqrt(sparse_sqdist(a, b, -1.0)) : sqrt(sparse_sqdist(b, a, -1.0));
+    }
 
-    long i = 0;
+    if (cur_metric == METRIC_ANGULAR || cur_metric == METRIC_COSINE) {
+        // Not a running sum of per-element terms: never abandoned
+        return angular_dist(a, b, size);
+    }
+    if (cur_metric == METRIC_WL2 && !weights_usable(size)) {
+        return -1.0;
+    }
+    if (a->dtype != b->dtype) {
+        return metric_finish(metric_generic(a, b, 0, size));
+    }
+
+    long blen = framedist_block_len(size);
+    long nblocks = (size + blen - 1) / blen;
+    double sum = 0.0;
 
-    // Use AVX2 if supported and on x86
-    #if defined(__AVX__) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
-    // Process 4 doubles at a time
-    if (size >= 4) {
-        __m256d sum_vec = _mm256_setzero_pd();
-        for (; i <= size - 4; i += 4) {
-            __m256d va = _mm256_loadu_pd(&da[i]);
-            __m256d vb = _mm256_loadu_pd(&db[i]);
-            __m256d diff = _mm256_sub_pd(va, vb);
-            #ifdef __FMA__
-            sum_vec = _mm256_fmadd_pd(diff, diff, sum_vec);
-            #else
-            sum_vec = _mm256_add_pd(sum_vec, _mm256_mul_pd(diff, diff));
-            #endif
+    #ifdef _OPENMP
+    if (dist_threads > 1 && size >= PAR_MIN_ELEMS && nblocks > 1 && !omp_in_parallel()) {
+        double d = bounded_par(a, b, size, blen, nblocks, (bound < 0.0) ? -1.0 : abandon_limit(a, bound), exact);
+        return *exact ? f32_guard(a, b, d) : d;
+    }
+    #endif
+
+    if (bound < 0.0 || nblocks < 2) {
+        for (long k = 0; k < nblocks; k++) {
+            long n = (k == nblocks - 1) ? size - k * blen : blen;
+            sum = metric_combine(sum, metric_range(a, b, k * blen, n));
         }
-        // Horizontal add
-        __m256d hsum = _mm256_hadd_pd(sum_vec, sum_vec);
-        sum += ((double*)&hsum)[0] + ((double*)&hsum)[2];
+    } else {
+        double limit = abandon_limit(a, bound);
+
+        if (block_order && order_nblocks == nblocks) {
+            // High-variance blocks first. Block sums are kept so a complete
+            // pass adds them in natural order, matching framedist exactly.
+            double part[ABANDON_MAX_BLOCKS];
+            double partial = 0.0;
+            for (long j = 0; j < nblocks; j++) {
+                long k = block_order[j];
+                long n = (k == nblocks - 1) ? size - k * blen : blen;
+                part[k] = metric_range(a, b, k * blen, n);
+                partial = metric_combine(partial, part[k]);
+                if (partial > limit && j < nblocks - 1) {
+                    *exact = 0;
+                    return metric_finish(partial);
+                }
+            }
+            for (long k = 0; k < nblocks; k++) sum = metric_combine(sum, part[k]);
+        } else {
+            for (long k = 0; k < nblocks; k++) {
+                long n = (k == nblocks - 1) ? size - k * blen : blen;
+                sum = metric_combine(sum, metric_range(a, b, k * blen, n));
+                if (sum > limit && k < nblocks - 1) {
+                    *exact = 0;
+                    return metric_finish(sum);
+                }
+            }
+        }
+    }
+
+    return f32_guard(a, b, metric_finish(sum));
+}
+
+double framedist(Frame *a, Frame *b) {
+    int exact;
+    return framedist_bounded(a, b, -1.0, &exact);
+}
+
+double framedist_norm2(const Frame *a) {
+    long size = a->width * a->height;
+    if (a->dtype == FRAME_DTYPE_UINT8) {
+        const uint8_t *p = (const uint8_t *)a->data;
+        uint64_t sum = 0;
+        for (long i = 0; i < size; i++) sum += (uint32_t)p[i] * p[i];
+        return (double)sum;
+    }
+    double sum = 0.0;
+    for (long i = 0; i < size; i++) {
+        double v = frame_value(a, i);
+        sum += v * v;
     }
+    return sum;
+}
+
+void framedist_batch(Frame *a, Frame **anchors, const double *anchor_norm2, int k, double *out) {
+    long size = a->width * a->height;
+    if (fixed_dist) {
+        int fixed = 1;
+        for (int i = 0; i < k && fixed; i++) fixed = fixed_ok(a, anchors[i]);
+        if (fixed && fixed_batch) {
+            const double *rows[BATCH_FIXED_MAX];
+            for (int g = 0; g < k; g += BATCH_FIXED_MAX) {
+                int n = (k - g < BATCH_FIXED_MAX) ? k - g : BATCH_FIXED_MAX;
+                for (int i = 0; i < n; i++) rows[i] = (const double *)anchors[g + i]->data;
+                fixed_batch((const double *)a->data, rows, n, out + g);
+            }
+            for (int i = 0; i < k; i++) out[i] = sqrt(out[i]);
+            return;
+        }
+        if (fixed) {
+            for (int i = 0; i < k; i++) out[i] = sqrt(fixed_dist((const double *)a->data, (const double *)anchors[i]->data));
+            return;
+        }
+    }
+    int blockwise = (cur_metric != METRIC_ANGULAR && cur_metric != METRIC_COSINE);
+    if (cur_metric == METRIC_WL2 && !weights_usable(size)) blockwise = 0;
+    #ifdef _OPENMP
+    // Large frames: split each distance across the threads instead
+    if (dist_threads > 1 && size >= PAR_MIN_ELEMS && !omp_in_parallel()) blockwise = 0;
     #endif
+    for (int i = 0; i < k; i++) {
+        if (!blockwise || anchors[i]->width != a->width || anchors[i]->height != a->height || anchors[i]->dtype != a->dtype) {
+            // Score anchors one at a time (mismatched anchors are rare)
+            for (int j = 0; j < k; j++) out[j] = framedist(a, anchors[j]);
+            return;
+        }
+    }
 
-    // Handle tail or scalar fallback
-    for (; i < size; i++) {
-        double diff = da[i] - db[i];
-        sum += diff * diff;
+    long blen = framedist_block_len(size);
+    long nblocks = (size + blen - 1) / blen;
+
+    if (cur_metric == METRIC_L2) {
+        int any_sparse = (a->nnz >= 0);
+        for (int i = 0; i < k && !any_sparse; i++) any_sparse = (anchors[i]->nnz >= 0);
+        if (any_sparse) {
+            // Same per-pair paths as framedist, so results stay identical
+            for (int i = 0; i < k; i++) {
+                if (a->nnz >= 0) out[i] = sqrt(sparse_sqdist(a, anchors[i], anchor_norm2 ? anchor_norm2[i] : -1.0));
+                else out[i] = framedist(a, anchors[i]);
+            }
+            return;
+        }
+    }
+
+    if (a->dtype == FRAME_DTYPE_UINT8 && anchor_norm2 && cur_metric == METRIC_L2) {
+        // ||a-b||^2 = ||a||^2 + ||b||^2 - 2 a.b is exact in integer arithmetic
+        // (all terms stay below 2^53), so it equals the difference form.
+        double na = framedist_norm2(a);
+        const uint8_t *pa = (const uint8_t *)a->data;
+        for (int g = 0; g < k; g += BATCH_K) {
+            const uint8_t *pb[BATCH_K];
+            uint64_t dot[BATCH_K] = { 0 };
+            for (int t = 0; t < BATCH_K; t++) {
+                pb[t] = (const uint8_t *)anchors[(g + t < k) ? g + t : g]->data;
+            }
+            for (long off = 0; off < size; off += DOT_U8_CHUNK) {
+                long n = (off + DOT_U8_CHUNK < size) ? DOT_U8_CHUNK : size - off;
+                dot_u8xk(pa, pb, off, n, dot);
+            }
+            for (int t = 0; t < BATCH_K && g + t < k; t++) {
+                out[g + t] = sqrt(na + anchor_norm2[g + t] - 2.0 * (double)dot[t]);
+            }
+        }
+        return;
     }
 
-    return sqrt(sum);
+    // Block-major: each block of 'a' stays in cache while it is compared
+    // with every anchor. Per-anchor block sums are added in the same order
+    // as framedist, so results are identical.
+    for (int i = 0; i < k; i++) out[i] = 0.0;
+    for (long blk = 0; blk < nblocks; blk++) {
+        long n = (blk == nblocks - 1) ? size - blk * blen : blen;
+        for (int i = 0; i < k; i++) {
+            out[i] = metric_combine(out[i], metric_range(a, anchors[i], blk * blen, n));
+        }
+    }
+    for (int i = 0; i < k; i++) out[i] = f32_guard(a, anchors[i], metric_finish(out[i]));
 }
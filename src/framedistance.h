@@ -0,0 +1,144 @@
+#ifndef FRAMEDISTANCE_H
+#define FRAMEDISTANCE_H
+
+#include "common.h"
+
+// SIMD kernel levels, in increasing order of capability
+typedef enum {
+    SIMD_AUTO = -1,
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 1,
+    SIMD_AVX2 = 2,
+    SIMD_AVX512 = 3
+} SimdLevel;
+
+// Probe the CPU and bind framedist() to the best kernel not above 'requested'.
+// SIMD_AUTO selects the best kernel supported by the host. Returns the level bound.
+SimdLevel framedist_init(SimdLevel requested);
+
+// Best level supported by the host CPU (independent of the bound kernel)
+SimdLevel framedist_detect_simd(void);
+
+// Name of the currently bound kernel ("scalar", "sse2", "avx2", "avx512")
+const char *framedist_kernel_name(void);
+
+// Parse/format SIMD level names. Returns -2 on unknown name.
+int simd_level_from_name(const char *name);
+const char *simd_level_name(SimdLevel level);
+
+// Distance metrics. L2 is the default; WL2 is L2 with per-pixel weights
+// (zero weights mask pixels out); ANGULAR is the angle between frames in
+// radians; COSINE is 1 - cos(angle) and does not satisfy the triangle
+// inequality.
+typedef enum {
+    METRIC_L2 = 0,
+    METRIC_L1,
+    METRIC_LINF,
+    METRIC_WL2,
+    METRIC_ANGULAR,
+    METRIC_COSINE
+} DistMetric;
+
+typedef struct {
+    const char *name;
+    int is_metric;  // Satisfies the triangle inequality
+    int euclidean;  // Embeds in a Euclidean space (needed by TE4/TE5)
+} MetricInfo;
+
+// Parse/format metric names. metric_from_name returns -1 on unknown name.
+int metric_from_name(const char *name);
+const char *metric_name(DistMetric m);
+int metric_is_metric(DistMetric m);
+int metric_is_euclidean(DistMetric m);
+
+// Select the metric used by framedist(). METRIC_WL2 requires nweights
+// non-negative weights (copied); they are ignored otherwise. Returns 0 on success.
+int framedist_set_metric(DistMetric m, const double *weights, long nweights);
+DistMetric framedist_get_metric(void);
+
+// Distance between two frames under the selected metric (Euclidean by default). Returns -1.0 on size mismatch.
+// Integer frames (uint8/uint16/int16) use exact integer kernels.
+// Float frames use single-precision kernels; results close to the guard
+// radius are recomputed in double so threshold tests match the double path.
+double framedist(Frame *a, Frame *b);
+
+// Early-abandon variant for threshold tests. The partial sum is compared with
+// bound^2 (L2/WL2) or bound (L1/Linf) after each block; once it is exceeded the call returns the partial
+// distance (a lower bound, > bound) and sets *exact = 0. Otherwise it returns
+// the framedist() value and sets *exact = 1. bound < 0 disables abandoning.
+// Angular metrics are never abandoned.
+double framedist_bounded(Frame *a, Frame *b, double bound, int *exact);
+
+// Distances from 'a' to k anchors, equal to framedist(a, anchors[i]).
+// anchor_norm2[i] = framedist_norm2(anchors[i]) enables the fused norm-form
+// kernel for uint8 frames under L2 (exact in integer arithmetic); pass NULL otherwise.
+// Other dtypes stream 'a' block by block against all anchors.
+void framedist_batch(Frame *a, Frame **anchors, const double *anchor_norm2, int k, double *out);
+
+// Squared norm of a frame (exact for integer dtypes)
+double framedist_norm2(const Frame *a);
+
+// Attach a sparse index/value list to f when at most max_fill of its pixels
+// are nonzero, and record its squared norm. Returns 1 if f is now sparse.
+// While either frame is sparse, L2 distances only visit the listed pixels:
+//   sparse-sparse: sum over the union of both supports,
+//   sparse-dense:  sum over the support + (||b||^2 - ||b on support||^2),
+// which is exact for integer dtypes. Other metrics use the dense buffers.
+int framedist_sparsify(Frame *f, double max_fill);
+
+// Free the sparse list of f (the dense buffer is untouched)
+void framedist_drop_sparse(Frame *f);
+
+// Lower-bound summary: block sums over 16x16 and 4x4 pixel blocks (edge
+// blocks are smaller, levels with too few pixels per block are left out).
+// framedist_summarize attaches it to f and records ||f||^2; frames under 256
+// pixels get none (returns 0). framedist_drop_summary frees it.
+int framedist_summarize(Frame *f);
+void framedist_drop_summary(Frame *f);
+
+// Lower bound on the L2 distance between two summarized frames, from the
+// cheapest to the tightest: | ||a|| - ||b|| |, then the distance between
+// block means (scaled by sqrt(block size)) at each level. Stops as soon as
+// the bound exceeds 'bound'. Returns 0 for other metrics or missing summaries.
+double framedist_lower_bound(const Frame *a, const Frame *b, double bound);
+
+// Delta mode. framedist_changed_pixels lists the pixels where 'cur' differs
+// from 'prev' (raw pixel buffer of a frame with the same size and dtype),
+// skipping unchanged 64-pixel blocks with a block compare. Returns the count,
+// or -1 as soon as it would exceed max_changed.
+long framedist_changed_pixels(const Frame *cur, const void *prev, uint32_t *idx, long max_changed);
+
+// d^2(cur, anchor) - d^2(prev, anchor), evaluated over the changed pixels
+// only. Exact for integer dtypes, the only ones delta mode runs on; others
+// are summed in double and may drift.
+double framedist_delta_sqdist(const Frame *cur, const void *prev, const Frame *anchor, const uint32_t *idx, long n);
+
+// Block length / block count used for nelem-element frames
+long framedist_block_len(long nelem);
+long framedist_num_blocks(long nelem);
+
+// High-variance-first block order for framedist_bounded. Per-pixel variance
+// is accumulated over the first 'nframes' frames passed to framedist_order_add,
+// then blocks are visited in decreasing variance. nframes <= 1 disables it.
+void framedist_order_setup(long nframes);
+void framedist_order_add(const Frame *f);
+int framedist_order_ready(void);
+
+// Bind a fixed-dimension kernel for nelem-element double frames (2, 3, 4,
+// 8, 16 or 32). framedist and framedist_batch then skip block and
+// SIMD dispatch for such frames under L2. Returns 1 if a kernel was bound.
+int framedist_set_fixed_dim(long nelem);
+
+// Threads used within one distance call (default 1). Frames of 256K pixels
+// or more then have their blocks computed in parallel and reduced in a fixed
+// order, so results do not depend on the thread count. Calls made from inside
+// an OpenMP parallel region stay single-threaded.
+void framedist_set_threads(int nthreads);
+
+// Set the guard radius (rlim) for float refinement. <= 0 disables it.
+void framedist_set_guard(double rlim);
+
+// Number of float distances recomputed in double
+long framedist_refine_calls(void);
+
+#endif // FRAMEDISTANCE_H
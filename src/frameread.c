@@ -8,6 +8,9 @@
 #include <semaphore.h>
 #include <errno.h>
 #include "png_io.h"
+#include "framedistance.h"
+#include "pca_basis.h"
+#include "sketch.h"
 
 #ifdef USE_CFITSIO
 #include <fitsio.h>
@@ -68,13 +71,57 @@ static long num_frames = 0;
 static long frame_width = 0;
 static long frame_height = 0;
 static int current_frame_idx = 0;
+static FrameDType requested_dtype = FRAME_DTYPE_AUTO;
+static FrameDType storage_dtype = FRAME_DTYPE_DOUBLE;
+static double sparse_fill = 0.0;
+static long sparse_frames = 0;
 
 Frame* getframe_at(long index);
 
+void set_sparse_fill(double max_fill) {
+    sparse_fill = max_fill;
+}
+
+long get_sparse_frames() {
+    return sparse_frames;
+}
+
 int is_ascii_input_mode() {
     return is_ascii_mode;
 }
 
+void set_frame_dtype(FrameDType dtype) {
+    requested_dtype = dtype;
+}
+
+FrameDType get_frame_dtype() {
+    return storage_dtype;
+}
+
+// Storage type for a source whose native pixel type is 'native':
+// integer sources keep their type unless a precision was requested.
+static FrameDType resolve_dtype(FrameDType native) {
+    if (requested_dtype != FRAME_DTYPE_AUTO) return requested_dtype;
+    return native;
+}
+
+#define STORE_PIXELS_AS(T, frame_ptr, src, n) do { \
+    T *dst_ = (T *)(frame_ptr)->data; \
+    for (long i_ = 0; i_ < (n); i_++) dst_[i_] = (T)(src)[i_]; \
+} while (0)
+
+// Copy n pixels of any C type into the frame buffer, converting to the storage type.
+// Integer storage is only selected for sources of that same type.
+#define STORE_PIXELS(frame_ptr, src, n) do { \
+    switch ((frame_ptr)->dtype) { \
+        case FRAME_DTYPE_FLOAT:  STORE_PIXELS_AS(float, frame_ptr, src, n); break; \
+        case FRAME_DTYPE_UINT8:  STORE_PIXELS_AS(uint8_t, frame_ptr, src, n); break; \
+        case FRAME_DTYPE_UINT16: STORE_PIXELS_AS(uint16_t, frame_ptr, src, n); break; \
+        case FRAME_DTYPE_INT16:  STORE_PIXELS_AS(int16_t, frame_ptr, src, n); break; \
+        default:                 STORE_PIXELS_AS(double, frame_ptr, src, n); break; \
+    } \
+} while (0)
+
 static int init_ascii(char *filename) {
     ascii_ptr = fopen(filename, "r");
     if (!ascii_ptr) {
@@ -84,6 +131,7 @@ static int init_ascii(char *filename) {
 
     is_ascii_mode = 1;
     num_frames = 0;
+    storage_dtype = resolve_dtype(FRAME_DTYPE_DOUBLE);
 
     size_t capacity = 1024;
     ascii_line_offsets = (long *)malloc(capacity * sizeof(long));
@@ -155,6 +203,7 @@ static int init_filelist(char *filename) {
 
     is_filelist_mode = 1;
     num_frames = 0;
+    storage_dtype = resolve_dtype(FRAME_DTYPE_UINT8);
     size_t capacity = 1024;
     file_list = (char **)malloc(capacity * sizeof(char *));
     
@@ -184,7 +233,7 @@ static int init_filelist(char *filename) {
 
     // Read first frame to get dimensions
     int w, h;
-    double *tmp = read_png_frame(file_list[0], &w, &h);
+    unsigned char *tmp = read_png_frame_u8(file_list[0], &w, &h);
     if (!tmp) {
         fprintf(stderr, "Failed to read first frame from list: %s\n", file_list[0]);
         return -1;
@@ -268,6 +317,7 @@ static int init_mp4(char *filename) {
     }
 
     is_mp4_mode = 1;
+    storage_dtype = resolve_dtype(FRAME_DTYPE_UINT8);
 
     // Prepare scaler for RGB24
     sws_ctx = sws_getContext(dec_ctx->width, dec_ctx->height, dec_ctx->pix_fmt,
@@ -298,6 +348,13 @@ static int init_stream(char *stream_name) {
     
     num_frames = LONG_MAX; // Stream is effectively infinite
     is_stream_mode = 1;
+
+    switch (stream_image.md[0].datatype) {
+        case _DATATYPE_UINT8:  storage_dtype = resolve_dtype(FRAME_DTYPE_UINT8); break;
+        case _DATATYPE_UINT16: storage_dtype = resolve_dtype(FRAME_DTYPE_UINT16); break;
+        case _DATATYPE_INT16:  storage_dtype = resolve_dtype(FRAME_DTYPE_INT16); break;
+        default:               storage_dtype = resolve_dtype(FRAME_DTYPE_DOUBLE); break;
+    }
     
     // Initialize state to current stream head
     last_cnt0 = stream_image.md[0].cnt0;
@@ -357,6 +414,15 @@ int init_frameread(char *filename, int stream_mode, int cnt2sync_mode, int filel
         return -1;
     }
 
+    int bitpix = 0;
+    fits_get_img_equivtype(fptr, &bitpix, &status);
+    switch (bitpix) {
+        case BYTE_IMG:   storage_dtype = resolve_dtype(FRAME_DTYPE_UINT8); break;
+        case USHORT_IMG: storage_dtype = resolve_dtype(FRAME_DTYPE_UINT16); break;
+        case SHORT_IMG:  storage_dtype = resolve_dtype(FRAME_DTYPE_INT16); break;
+        default:         storage_dtype = resolve_dtype(FRAME_DTYPE_DOUBLE); break;
+    }
+
     if (naxis == 3) {
         frame_width = naxes[0];
         frame_height = naxes[1];
@@ -401,39 +467,48 @@ Frame* getframe_at(long index) {
     frame_struct->width = frame_width;
     frame_struct->height = frame_height;
     frame_struct->id = index;
-    // We allocate data in switch or below
-    // Actually, other modes allocate it manually or read into it.
-    // Let's allocate it here for consistency if needed, but read_png_frame allocates it.
-    
-    // For file list mode, read_png_frame allocates. For others, we allocate.
-    if (!is_filelist_mode) {
-        frame_struct->data = (double *)malloc(nelements * sizeof(double));
-        if (!frame_struct->data) {
-            free(frame_struct);
-            return NULL;
-        }
-    } else {
-        frame_struct->data = NULL; // Will be set by read_png_frame
+    frame_struct->dtype = storage_dtype;
+
+    frame_struct->data = malloc(nelements * frame_dtype_size(storage_dtype));
+    if (!frame_struct->data) {
+        free(frame_struct);
+        return NULL;
     }
 
     frame_struct->cnt0 = 0;
     frame_struct->atime.tv_sec = 0;
     frame_struct->atime.tv_nsec = 0;
+    frame_struct->nnz = -1;
+    frame_struct->sp_idx = NULL;
+    frame_struct->sp_val = NULL;
+    frame_struct->norm2 = -1.0;
+    frame_struct->lbsum = NULL;
+    frame_struct->pca = NULL;
+    frame_struct->sketch = NULL;
 
     if (is_filelist_mode) {
         int w, h;
-        frame_struct->data = read_png_frame(file_list[index], &w, &h);
-        if (!frame_struct->data) {
+        unsigned char *pixels = read_png_frame_u8(file_list[index], &w, &h);
+        if (!pixels) {
             fprintf(stderr, "Error reading frame %ld: %s\n", index, file_list[index]);
+            free(frame_struct->data);
             free(frame_struct);
             return NULL;
         }
         if (w != frame_width || h != frame_height) {
             fprintf(stderr, "Error: Frame dimension mismatch in file list. Expected %ldx%ld, got %dx%d\n", frame_width, frame_height, w, h);
+            free(pixels);
             free(frame_struct->data);
             free(frame_struct);
             return NULL;
         }
+        if (frame_struct->dtype == FRAME_DTYPE_UINT8) {
+            free(frame_struct->data);
+            frame_struct->data = pixels;
+        } else {
+            STORE_PIXELS(frame_struct, pixels, nelements);
+            free(pixels);
+        }
     }
     else if (is_ascii_mode) {
         if (fseek(ascii_ptr, ascii_line_offsets[index], SEEK_SET) != 0) {
@@ -443,11 +518,14 @@ Frame* getframe_at(long index) {
             return NULL;
         }
         for (long i = 0; i < nelements; i++) {
-            if (fscanf(ascii_ptr, "%lf", &frame_struct->data[i]) != 1) {
+            double v;
+            if (fscanf(ascii_ptr, "%lf", &v) != 1) {
                 free(frame_struct->data);
                 free(frame_struct);
                 return NULL;
             }
+            if (frame_struct->dtype == FRAME_DTYPE_FLOAT) ((float *)frame_struct->data)[i] = (float)v;
+            else ((double *)frame_struct->data)[i] = v;
         }
     }
     #ifdef USE_IMAGESTREAMIO
@@ -540,25 +618,25 @@ Frame* getframe_at(long index) {
         
         switch(dtype) {
             case _DATATYPE_FLOAT:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((float*)stream_image.array.F)[offset + i];
+                STORE_PIXELS(frame_struct, (float*)stream_image.array.F + offset, nelements);
                 break;
             case _DATATYPE_DOUBLE:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = ((double*)stream_image.array.D)[offset + i];
+                STORE_PIXELS(frame_struct, (double*)stream_image.array.D + offset, nelements);
                 break;
             case _DATATYPE_UINT8:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((uint8_t*)stream_image.array.UI8)[offset + i];
+                STORE_PIXELS(frame_struct, (uint8_t*)stream_image.array.UI8 + offset, nelements);
                 break;
             case _DATATYPE_UINT16:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((uint16_t*)stream_image.array.UI16)[offset + i];
+                STORE_PIXELS(frame_struct, (uint16_t*)stream_image.array.UI16 + offset, nelements);
                 break;
             case _DATATYPE_INT16:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((int16_t*)stream_image.array.SI16)[offset + i];
+                STORE_PIXELS(frame_struct, (int16_t*)stream_image.array.SI16 + offset, nelements);
                 break;
             case _DATATYPE_UINT32:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((uint32_t*)stream_image.array.UI32)[offset + i];
+                STORE_PIXELS(frame_struct, (uint32_t*)stream_image.array.UI32 + offset, nelements);
                 break;
             case _DATATYPE_INT32:
-                for(long i=0; i<nelements; i++) frame_struct->data[i] = (double)((int32_t*)stream_image.array.SI32)[offset + i];
+                STORE_PIXELS(frame_struct, (int32_t*)stream_image.array.SI32 + offset, nelements);
                 break;
             default:
                 fprintf(stderr, "Unsupported stream datatype: %d\n", dtype);
@@ -618,25 +696,34 @@ Frame* getframe_at(long index) {
         uint8_t *rgb_data[4] = {NULL};
         int rgb_linesize[4] = {0};
 
-        rgb_data[0] = (uint8_t*)malloc(dec_ctx->width * dec_ctx->height * 3);
+        // uint8 storage: scale straight into the frame buffer
+        if (frame_struct->dtype == FRAME_DTYPE_UINT8) rgb_data[0] = (uint8_t*)frame_struct->data;
+        else rgb_data[0] = (uint8_t*)malloc(dec_ctx->width * dec_ctx->height * 3);
         rgb_linesize[0] = dec_ctx->width * 3;
 
         sws_scale(sws_ctx, (const uint8_t *const *)frame->data, frame->linesize, 0, dec_ctx->height, rgb_data, rgb_linesize);
 
-        uint8_t *src = rgb_data[0];
-        for (long i = 0; i < nelements; i++) {
-            frame_struct->data[i] = (double)src[i];
+        if (frame_struct->dtype != FRAME_DTYPE_UINT8) {
+            uint8_t *src = rgb_data[0];
+            STORE_PIXELS(frame_struct, src, nelements);
+            free(rgb_data[0]);
         }
 
-        free(rgb_data[0]);
-
     }
     #endif
     #ifdef USE_CFITSIO
     else if (fptr) { // Check if fptr is valid, implying FITS mode
         int status = 0;
         long fpixel[3] = {1, 1, index + 1};
-        if (fits_read_pix(fptr, TDOUBLE, fpixel, nelements, NULL, frame_struct->data, NULL, &status)) {
+        int fits_type = TDOUBLE;
+        switch (frame_struct->dtype) {
+            case FRAME_DTYPE_FLOAT:  fits_type = TFLOAT; break;
+            case FRAME_DTYPE_UINT8:  fits_type = TBYTE; break;
+            case FRAME_DTYPE_UINT16: fits_type = TUSHORT; break;
+            case FRAME_DTYPE_INT16:  fits_type = TSHORT; break;
+            default: break;
+        }
+        if (fits_read_pix(fptr, fits_type, fpixel, nelements, NULL, frame_struct->data, NULL, &status)) {
             fits_report_error(stderr, status);
             free(frame_struct->data);
             free(frame_struct);
@@ -651,12 +738,18 @@ Frame* getframe_at(long index) {
         return NULL;
     }
 
+    if (sparse_fill > 0.0 && framedist_sparsify(frame_struct, sparse_fill)) sparse_frames++;
+    if (sketch_dim() > 0) sketch_frame(frame_struct);
     return frame_struct;
 }
 
 void free_frame(Frame *frame) {
     if (frame) {
         if (frame->data) free(frame->data);
+        framedist_drop_sparse(frame);
+        framedist_drop_summary(frame);
+        pca_basis_drop(frame);
+        sketch_drop(frame);
         free(frame);
     }
 }
@@ -777,3 +870,82 @@ long get_stream_lag() { return 0; }
 int is_3d_stream_mode() { return 0; }
 double get_stream_wait_time() { return 0.0; }
 #endif
+
+// Per-pixel weight map for the weighted metric: a 2D FITS image, or ASCII
+// whitespace-separated values in pixel order. Returns a malloc'd array.
+double *read_weight_map(const char *filename, long *nelem) {
+    *nelem = 0;
+    const char *ext = strrchr(filename, '.');
+    if (ext && (strcmp(ext, ".fits") == 0 || strcmp(ext, ".fit") == 0 || strcmp(ext, ".fz") == 0)) {
+        #ifdef USE_CFITSIO
+        fitsfile *wptr = NULL;
+        int status = 0;
+        int naxis = 0;
+        long naxes[2] = { 1, 1 };
+        if (fits_open_file(&wptr, filename, READONLY, &status) ||
+            fits_get_img_dim(wptr, &naxis, &status) ||
+            fits_get_img_size(wptr, 2, naxes, &status)) {
+            fits_report_error(stderr, status);
+            if (wptr) fits_close_file(wptr, &status);
+            return NULL;
+        }
+        if (naxis < 1 || naxis > 2) {
+            fprintf(stderr, "Error: Weight map must be a 2D FITS image.\n");
+            fits_close_file(wptr, &status);
+            return NULL;
+        }
+        long n = naxes[0] * ((naxis == 2) ? naxes[1] : 1);
+        double *w = (double *)malloc(n * sizeof(double));
+        long fpixel[2] = { 1, 1 };
+        if (!w || fits_read_pix(wptr, TDOUBLE, fpixel, n, NULL, w, NULL, &status)) {
+            if (status) fits_report_error(stderr, status);
+            free(w);
+            fits_close_file(wptr, &status);
+            return NULL;
+        }
+        fits_close_file(wptr, &status);
+        *nelem = n;
+        return w;
+        #else
+        fprintf(stderr, "Error: FITS support is not compiled in. Cannot read weight map %s.\n", filename);
+        return NULL;
+        #endif
+    }
+
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror("Failed to open weight map");
+        return NULL;
+    }
+    long capacity = 1024;
+    long n = 0;
+    double *w = (double *)malloc(capacity * sizeof(double));
+    double v;
+    while (w && fscanf(f, "%lf", &v) == 1) {
+        if (n >= capacity) {
+            capacity *= 2;
+            double *nw = (double *)realloc(w, capacity * sizeof(double));
+            if (!nw) {
+                free(w);
+                w = NULL;
+                break;
+            }
+            w = nw;
+        }
+        w[n++] = v;
+    }
+    if (w && !feof(f)) {
+        fprintf(stderr, "Error: Invalid value in weight map %s.\n", filename);
+        free(w);
+        w = NULL;
+    }
+    fclose(f);
+    if (!w) return NULL;
+    if (n == 0) {
+        fprintf(stderr, "Error: Empty weight map %s.\n", filename);
+        free(w);
+        return NULL;
+    }
+    *nelem = n;
+    return w;
+}
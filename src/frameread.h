@@ -19,5 +19,15 @@ double get_stream_wait_time();
 long get_frame_width();
 long get_frame_height();
 int is_ascii_input_mode();
+void set_frame_dtype(FrameDType dtype);
+FrameDType get_frame_dtype();
+
+// Frames with at most max_fill nonzero pixels get a sparse copy (0 = off)
+void set_sparse_fill(double max_fill);
+long get_sparse_frames();
+
+// Load a per-pixel weight map (FITS image or ASCII values). Returns a
+// malloc'd array of *nelem weights, or NULL on error.
+double *read_weight_map(const char *filename, long *nelem);
 
 #endif // FRAMEREAD_H
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include "framedistance.h"
 
 #define ANSI_COLOR_GREEN   "\x1b[32m"
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -55,5 +56,15 @@ int main() {
     print_module_info("OpenMP", 0, NULL, NULL);
 #endif
 
+    printf("\n%sDistance Kernels (framedist)%s\n", ANSI_BOLD, ANSI_COLOR_RESET);
+    printf("=========================================\n\n");
+
+    SimdLevel best = framedist_detect_simd();
+    for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++) {
+        print_module_info(simd_level_name(level), level <= (int)best, NULL, NULL);
+    }
+    framedist_init(SIMD_AUTO);
+    printf("%-20s: %s%s%s\n", "Selected", ANSI_BOLD, framedist_kernel_name(), ANSI_COLOR_RESET);
+
     return 0;
 }
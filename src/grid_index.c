@@ -0,0 +1,119 @@
+#include "grid_index.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cells are widened by this relative amount so that rounding in x / rlim
+// cannot put two points closer than rlim two cells apart
+#define GRID_CELL_SLACK 1e-9
+// Cell coordinates are clamped so that neighbours (+-1) cannot overflow
+#define GRID_COORD_MAX 1000000000.0
+
+int grid_index_init(GridIndex *g, int dim, double rlim, int capacity) {
+    memset(g, 0, sizeof(GridIndex));
+    if (dim <= 0 || dim > GRID_MAX_DIM || rlim <= 0.0 || capacity <= 0) return -1;
+
+    int size = 1;
+    while (size < 2 * capacity) size <<= 1;
+    g->coords = (int32_t *)malloc((size_t)capacity * dim * sizeof(int32_t));
+    g->next = (int *)malloc(capacity * sizeof(int));
+    g->table = (int *)malloc(size * sizeof(int));
+    g->hits = (int *)malloc(capacity * sizeof(int));
+    g->mark = (unsigned char *)calloc(capacity, sizeof(unsigned char));
+    if (!g->coords || !g->next || !g->table || !g->hits || !g->mark) {
+        perror("Memory allocation failed for grid index");
+        grid_index_free(g);
+        return -1;
+    }
+    for (int i = 0; i < size; i++) g->table[i] = -1;
+    g->dim = dim;
+    g->inv_cell = 1.0 / (rlim * (1.0 + GRID_CELL_SLACK));
+    g->capacity = capacity;
+    g->table_mask = size - 1;
+    return 0;
+}
+
+static void grid_cell_of(const GridIndex *g, const Frame *f, int32_t *c) {
+    for (int i = 0; i < g->dim; i++) {
+        double x = floor(frame_value(f, i) * g->inv_cell);
+        if (x > GRID_COORD_MAX) x = GRID_COORD_MAX;
+        if (x < -GRID_COORD_MAX) x = -GRID_COORD_MAX;
+        c[i] = (int32_t)x;
+    }
+}
+
+static uint32_t grid_hash(const int32_t *c, int dim) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < dim; i++) {
+        h ^= (uint32_t)c[i];
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Slot holding cell c, or the empty slot where it would go
+static int grid_slot(const GridIndex *g, const int32_t *c) {
+    int s = (int)(grid_hash(c, g->dim) & (uint32_t)g->table_mask);
+    while (g->table[s] >= 0 && memcmp(g->coords + (size_t)g->table[s] * g->dim, c, g->dim * sizeof(int32_t)) != 0) {
+        s = (s + 1) & g->table_mask;
+    }
+    return s;
+}
+
+static void grid_link(GridIndex *g, int id) {
+    int s = grid_slot(g, g->coords + (size_t)id * g->dim);
+    g->next[id] = g->table[s];
+    g->table[s] = id;
+}
+
+void grid_index_insert(GridIndex *g, int id, const Frame *anchor) {
+    if (id != g->count || id >= g->capacity) return;
+    grid_cell_of(g, anchor, g->coords + (size_t)id * g->dim);
+    g->count++;
+    grid_link(g, id);
+}
+
+void grid_index_remove(GridIndex *g, int id) {
+    if (id < 0 || id >= g->count) return;
+    int tail = g->count - id - 1;
+    if (tail > 0) {
+        memmove(g->coords + (size_t)id * g->dim, g->coords + (size_t)(id + 1) * g->dim,
+                (size_t)tail * g->dim * sizeof(int32_t));
+    }
+    g->count--;
+    // Chains hold ids: relink everything
+    for (int s = 0; s <= g->table_mask; s++) g->table[s] = -1;
+    for (int i = 0; i < g->count; i++) grid_link(g, i);
+}
+
+int grid_index_query(GridIndex *g, const Frame *f) {
+    int32_t base[GRID_MAX_DIM], c[GRID_MAX_DIM];
+    int off[GRID_MAX_DIM];
+    grid_cell_of(g, f, base);
+    for (int i = 0; i < g->dim; i++) off[i] = -1;
+
+    g->nhits = 0;
+    for (;;) {
+        for (int i = 0; i < g->dim; i++) c[i] = base[i] + off[i];
+        int s = grid_slot(g, c);
+        for (int id = g->table[s]; id >= 0; id = g->next[id]) g->hits[g->nhits++] = id;
+
+        // Next offset in {-1, 0, 1}^dim
+        int i = 0;
+        while (i < g->dim && off[i] == 1) off[i++] = -1;
+        if (i == g->dim) break;
+        off[i]++;
+    }
+    return g->nhits;
+}
+
+void grid_index_free(GridIndex *g) {
+    free(g->coords);
+    free(g->next);
+    free(g->table);
+    free(g->hits);
+    free(g->mark);
+    memset(g, 0, sizeof(GridIndex));
+}
@@ -0,0 +1,48 @@
+#ifndef GRID_INDEX_H
+#define GRID_INDEX_H
+
+#include <stdint.h>
+#include "common.h"
+
+// Uniform grid over anchors of low-dimensional frames, stored as a sparse
+// hash of occupied cells. With cells of side rlim, an anchor within rlim of
+// a frame (L2, L1 or Linf) differs from it by less than rlim on every
+// coordinate, so it lies in one of the 3^dim cells around the frame's cell:
+// the lookup is exact.
+
+#define GRID_MAX_DIM 8
+// -index auto picks the grid up to this dimension: the 3^dim cells probed
+// per frame stay few
+#define GRID_AUTO_DIM 4
+
+typedef struct {
+    int dim;
+    double inv_cell;     // 1 / cell side
+    int capacity;        // Anchors
+    int count;
+    int32_t *coords;     // capacity x dim cell coordinates
+    int *next;           // Next anchor in the same cell (-1 = end)
+    int *table;          // Open-addressing slots: first anchor of a cell (-1 = empty)
+    int table_mask;      // Table size - 1 (power of 2, >= 2 * capacity)
+    int *hits;           // Last query result
+    int nhits;
+    int cursor;          // Next hit to hand out (caller side)
+    unsigned char *mark; // Per anchor scratch flag
+} GridIndex;
+
+// Prepare a grid for dim-pixel frames with cells of side rlim. Returns 0 on
+// success.
+int grid_index_init(GridIndex *g, int dim, double rlim, int capacity);
+
+// Add anchor id (== g->count)
+void grid_index_insert(GridIndex *g, int id, const Frame *anchor);
+
+// Remove anchor id; ids above it shift down by one
+void grid_index_remove(GridIndex *g, int id);
+
+// Anchors in the cells around f, into g->hits. Returns their number.
+int grid_index_query(GridIndex *g, const Frame *f);
+
+void grid_index_free(GridIndex *g);
+
+#endif // GRID_INDEX_H
@@ -12,6 +12,8 @@
 #include "cluster_io.h"
 #include "frameread.h"
 #include "config_utils.h"
+#include "framedistance.h"
+#include "sketch.h"
 
 volatile sig_atomic_t stop_requested = 0;
 
@@ -75,6 +77,15 @@ int main(int argc, char *argv[]) {
     config.pred_n = 2;
     config.maxcl_strategy = MAXCL_STOP;
     config.discard_fraction = 0.5;
+    config.simd_level = SIMD_AUTO;
+    config.precision = FRAME_DTYPE_AUTO;
+    config.abandon_mode = 1;
+    config.lbound_mode = 1;
+    config.pca_frames = 32;
+    config.pq_frames = 256;
+    config.sketch_conf = 0.999;
+    config.index_ef = 32;
+    config.index_mode = ANCHOR_INDEX_AUTO;
 
     // Output defaults (disabled by default, except membership and dcc)
     config.output_dcc = 1;
@@ -194,12 +205,109 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    SimdLevel simd_level = framedist_init(config.simd_level);
+    if (config.simd_level != SIMD_AUTO && simd_level != config.simd_level) {
+        fprintf(stderr, "Warning: %s kernel not supported by this CPU, using %s\n",
+                simd_level_name(config.simd_level), simd_level_name(simd_level));
+    }
+    printf("Distance kernel: %s\n", framedist_kernel_name());
+    framedist_set_threads(config.ncpu);
+
+    set_frame_dtype(config.precision);
+    set_sparse_fill(config.sparse_fill);
     if (init_frameread(config.fits_filename, config.stream_input_mode, config.cnt2sync_mode, config.filelist_mode) != 0) {
         if (cmdline) free(cmdline);
         print_args_on_error(argc, argv);
         return 1;
     }
 
+    double *weights = NULL;
+    long nweights = 0;
+    if (config.weights_filename) {
+        weights = read_weight_map(config.weights_filename, &nweights);
+        if (!weights) {
+            if (cmdline) free(cmdline);
+            return 1;
+        }
+        if (nweights != get_frame_width() * get_frame_height()) {
+            fprintf(stderr, "Error: Weight map has %ld values, frames have %ld pixels\n",
+                    nweights, get_frame_width() * get_frame_height());
+            free(weights);
+            if (cmdline) free(cmdline);
+            return 1;
+        }
+    } else if (config.metric == METRIC_WL2) {
+        fprintf(stderr, "Error: -metric wl2 requires -weights <file>\n");
+        if (cmdline) free(cmdline);
+        return 1;
+    }
+    if (framedist_set_metric(config.metric, weights, nweights) != 0) {
+        fprintf(stderr, "Error: Invalid weight map (weights must be >= 0)\n");
+        free(weights);
+        if (cmdline) free(cmdline);
+        return 1;
+    }
+    if (framedist_set_fixed_dim(get_frame_width() * get_frame_height()) && get_frame_dtype() == FRAME_DTYPE_DOUBLE) {
+        printf("Distance kernel: fixed %ld-D\n", get_frame_width() * get_frame_height());
+    }
+    free(weights);
+    if (!metric_is_euclidean(config.metric) && (config.te4_mode || config.te5_mode)) {
+        fprintf(stderr, "Warning: TE4/TE5 require a Euclidean metric, disabled for %s\n", metric_name(config.metric));
+        config.te4_mode = 0;
+        config.te5_mode = 0;
+    }
+    if (config.delta_period > 0 && config.metric != METRIC_L2) {
+        fprintf(stderr, "Warning: -delta requires the l2 metric, disabled for %s\n", metric_name(config.metric));
+        config.delta_period = 0;
+    }
+    // Incremental updates are exact in integer arithmetic only: float and
+    // double frames would feed drifted distances to the rlim test as exact
+    if (config.delta_period > 0 && !frame_dtype_is_integer(get_frame_dtype())) {
+        fprintf(stderr, "Warning: -delta requires integer frames, disabled for %s\n", frame_dtype_name(get_frame_dtype()));
+        config.delta_period = 0;
+    }
+    // Norm and block-mean bounds hold for l2 only
+    if (config.metric != METRIC_L2) config.lbound_mode = 0;
+    if (config.pca_k > 0 && config.metric != METRIC_L2) {
+        fprintf(stderr, "Warning: -pca requires the l2 metric, disabled for %s\n", metric_name(config.metric));
+        config.pca_k = 0;
+    }
+    if (config.pq_m > 0 && config.metric != METRIC_L2) {
+        fprintf(stderr, "Warning: -pq requires the l2 metric, disabled for %s\n", metric_name(config.metric));
+        config.pq_m = 0;
+    }
+    if (config.sketch_dim > 0 && config.metric != METRIC_L2) {
+        fprintf(stderr, "Warning: -sketch requires the l2 metric, disabled for %s\n", metric_name(config.metric));
+        config.sketch_dim = 0;
+    }
+    if (config.sketch_dim > 0 && sketch_setup(config.sketch_dim, get_frame_width() * get_frame_height()) != 0) {
+        config.sketch_dim = 0;
+    }
+    if (!metric_is_metric(config.metric)) {
+        fprintf(stderr, "Warning: %s is not a metric, triangle-inequality pruning, early-abandon, pivots, visitor and coherence bounds and the VP-tree disabled\n",
+                metric_name(config.metric));
+        config.abandon_mode = 0;
+        config.pivots = 0;
+        config.visitprune_mode = 0;
+        config.coherence_mode = 0;
+        if (config.index_mode == ANCHOR_INDEX_VPTREE) config.index_mode = ANCHOR_INDEX_LINEAR;
+    }
+    // The grid lookup is exact when every coordinate differs by at most the
+    // distance: l2, l1 and linf
+    long frame_dim = get_frame_width() * get_frame_height();
+    int grid_ok = (config.metric == METRIC_L2 || config.metric == METRIC_L1 || config.metric == METRIC_LINF);
+    if (config.index_mode == ANCHOR_INDEX_AUTO) {
+        // -gprob orders candidates, and discard and merge pick clusters, from
+        // visitor histories, which the grid changes by measuring fewer
+        // distances: keep their linear results
+        if (config.gprob_mode || config.maxcl_strategy != MAXCL_STOP) grid_ok = 0;
+        config.index_mode = (grid_ok && frame_dim <= GRID_AUTO_DIM) ? ANCHOR_INDEX_GRID : ANCHOR_INDEX_LINEAR;
+    } else if (config.index_mode == ANCHOR_INDEX_GRID && (!grid_ok || frame_dim > GRID_MAX_DIM)) {
+        fprintf(stderr, "Warning: -index grid requires l2, l1 or linf and at most %d pixels per frame, using linear\n",
+                GRID_MAX_DIM);
+        config.index_mode = ANCHOR_INDEX_LINEAR;
+    }
+
     // Determine output directory
     char *out_dir = NULL;
     int out_dir_alloc = 0; // Flag to track if out_dir was malloced locally
@@ -275,13 +383,16 @@ int main(int argc, char *argv[]) {
 
     // Allocate State
     state.clusters = (Cluster *)malloc(config.maxnbclust * sizeof(Cluster));
-    state.dccarray = (double *)malloc(config.maxnbclust * config.maxnbclust * sizeof(double));
-    for (int i = 0; i < config.maxnbclust * config.maxnbclust; i++) state.dccarray[i] = -1.0;
+    if (dcc_store_init(&state.dcc, config.dcc_type, config.maxnbclust, config.rlim) != 0) {
+        if (cmdline) free(cmdline);
+        return 1;
+    }
 
     state.current_gprobs = (double *)malloc(config.maxnbclust * sizeof(double));
+    state.gprob_stamp = (unsigned int *)calloc(config.maxnbclust, sizeof(unsigned int));
     state.cluster_visitors = (VisitorList *)calloc(config.maxnbclust, sizeof(VisitorList));
     state.probsortedclindex = (int *)malloc(config.maxnbclust * sizeof(int));
-    state.clmembflag = (int *)malloc(config.maxnbclust * sizeof(int));
+    cand_mask_init(&state.clmemb, config.maxnbclust);
 
     // Run Clustering
     struct timespec clust_start, clust_end;
@@ -310,13 +421,21 @@ int main(int argc, char *argv[]) {
 
     // Cleanup
     for (int i = 0; i < state.num_clusters; i++) {
-        if (state.clusters[i].anchor.data) free(state.clusters[i].anchor.data);
+        if (state.clusters[i].slot < 0 && state.clusters[i].anchor.data) free(state.clusters[i].anchor.data);
+        framedist_drop_sparse(&state.clusters[i].anchor);
+        framedist_drop_summary(&state.clusters[i].anchor);
+        pca_basis_drop(&state.clusters[i].anchor);
+        sketch_drop(&state.clusters[i].anchor);
     }
     free(state.clusters);
+    anchor_matrix_free(&state.anchor_matrix);
+    pca_basis_free(&state.pca);
+    sketch_free();
 
     for (long i = 0; i < state.total_frames_processed; i++) {
         if (state.frame_infos[i].cluster_indices) free(state.frame_infos[i].cluster_indices);
         if (state.frame_infos[i].distances) free(state.frame_infos[i].distances);
+        if (state.frame_infos[i].exact) free(state.frame_infos[i].exact);
     }
     free(state.frame_infos);
 
@@ -325,10 +444,11 @@ int main(int argc, char *argv[]) {
     }
     free(state.cluster_visitors);
     free(state.current_gprobs);
+    free(state.gprob_stamp);
 
-    free(state.dccarray);
+    dcc_store_free(&state.dcc);
     free(state.probsortedclindex);
-    free(state.clmembflag);
+    cand_mask_free(&state.clmemb);
     free(state.assignments);
 
     if (state.pruned_fraction_sum) free(state.pruned_fraction_sum);
@@ -0,0 +1,219 @@
+#include "nsw_graph.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Neighbour candidates considered per insertion, as a multiple of NSW_M
+#define NSW_CANDIDATES 4
+
+int nsw_init(NswGraph *g, int capacity) {
+    memset(g, 0, sizeof(NswGraph));
+    g->max_degree = 2 * NSW_M;
+    g->links = (int *)malloc((size_t)capacity * g->max_degree * sizeof(int));
+    g->degree = (int *)calloc(capacity, sizeof(int));
+    g->seen = (unsigned int *)calloc(capacity, sizeof(unsigned int));
+    g->cand = (NswEntry *)malloc(capacity * sizeof(NswEntry));
+    g->best = (NswEntry *)malloc((capacity + 1) * sizeof(NswEntry));
+    g->pending = (int *)malloc(capacity * sizeof(int));
+    g->scratch = (NswEntry *)malloc(NSW_CANDIDATES * NSW_M * sizeof(NswEntry));
+    if (!g->links || !g->degree || !g->seen || !g->cand || !g->best || !g->pending || !g->scratch) {
+        perror("Memory allocation failed for NSW graph");
+        nsw_free(g);
+        return -1;
+    }
+    g->capacity = capacity;
+    return 0;
+}
+
+// Binary heaps on d: min-heap (sign 1) or max-heap (sign -1)
+static void heap_push(NswEntry *h, int *n, NswEntry e, int sign) {
+    int i = (*n)++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sign * (e.d - h[parent].d) >= 0) break;
+        h[i] = h[parent];
+        i = parent;
+    }
+    h[i] = e;
+}
+
+static NswEntry heap_pop(NswEntry *h, int *n, int sign) {
+    NswEntry top = h[0];
+    NswEntry e = h[--(*n)];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= *n) break;
+        if (c + 1 < *n && sign * (h[c + 1].d - h[c].d) < 0) c++;
+        if (sign * (h[c].d - e.d) >= 0) break;
+        h[i] = h[c];
+        i = c;
+    }
+    if (*n > 0) h[i] = e;
+    return top;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    double da = ((const NswEntry *)a)->d;
+    double db = ((const NswEntry *)b)->d;
+    if (da < db) return -1;
+    if (da > db) return 1;
+    return 0;
+}
+
+// HNSW neighbour heuristic: walk the candidates nearest first and keep one
+// only if it is closer to the base than to every neighbour kept so far, so
+// that links spread in different directions. Pruned candidates fill the
+// remaining slots. Returns the number kept (<= max) in out[].
+static int select_neighbours(NswEntry *c, int n, int max, int *out, NswDistFn dist, void *ctx) {
+    qsort(c, n, sizeof(NswEntry), compare_entries);
+    int kept = 0;
+    for (int i = 0; i < n && kept < max; i++) {
+        int diverse = 1;
+        for (int j = 0; j < kept && diverse; j++) {
+            if (dist(ctx, c[i].id, out[j]) < c[i].d) diverse = 0;
+        }
+        if (diverse) {
+            out[kept++] = c[i].id;
+            c[i].id = -1;
+        }
+    }
+    for (int i = 0; i < n && kept < max; i++) {
+        if (c[i].id >= 0) out[kept++] = c[i].id;
+    }
+    return kept;
+}
+
+static void add_link(NswGraph *g, int from, int to, NswDistFn dist, void *ctx) {
+    int *row = g->links + (size_t)from * g->max_degree;
+    if (g->degree[from] < g->max_degree) {
+        row[g->degree[from]++] = to;
+        return;
+    }
+    // Full: re-select among the current links and the new one
+    NswEntry c[2 * NSW_M + 1];
+    int n = 0;
+    for (int i = 0; i < g->degree[from]; i++) {
+        c[n].id = row[i];
+        c[n].d = dist(ctx, from, row[i]);
+        n++;
+    }
+    c[n].id = to;
+    c[n].d = dist(ctx, from, to);
+    n++;
+    g->degree[from] = select_neighbours(c, n, g->max_degree, row, dist, ctx);
+}
+
+void nsw_insert(NswGraph *g, int id, NswDistFn dist, void *ctx) {
+    if (id != g->count || id >= g->capacity) return;
+    g->degree[id] = 0;
+    g->seen[id] = 0;
+    g->count++;
+    if (id == 0) return;
+
+    // Nearest NSW_CANDIDATES * NSW_M anchors (max-heap on d)
+    int ncand = NSW_CANDIDATES * NSW_M;
+    NswEntry *heap = g->scratch;
+    int n = 0;
+    for (int k = 0; k < id; k++) {
+        NswEntry e = { dist(ctx, id, k), k };
+        if (n < ncand) {
+            heap_push(heap, &n, e, -1);
+        } else if (e.d < heap[0].d) {
+            heap_pop(heap, &n, -1);
+            heap_push(heap, &n, e, -1);
+        }
+    }
+
+    int nb[NSW_M];
+    int kept = select_neighbours(heap, n, NSW_M, nb, dist, ctx);
+    int *row = g->links + (size_t)id * g->max_degree;
+    for (int i = 0; i < kept; i++) {
+        row[i] = nb[i];
+        add_link(g, nb[i], id, dist, ctx);
+    }
+    g->degree[id] = kept;
+}
+
+void nsw_remove(NswGraph *g, int id) {
+    if (id < 0 || id >= g->count) return;
+    for (int k = 0; k < g->count; k++) {
+        if (k == id) continue;
+        int *row = g->links + (size_t)k * g->max_degree;
+        int n = 0;
+        for (int i = 0; i < g->degree[k]; i++) {
+            int v = row[i];
+            if (v == id) continue;
+            row[n++] = (v > id) ? v - 1 : v;
+        }
+        g->degree[k] = n;
+    }
+    int tail = g->count - id - 1;
+    if (tail > 0) {
+        memmove(g->links + (size_t)id * g->max_degree, g->links + (size_t)(id + 1) * g->max_degree,
+                (size_t)tail * g->max_degree * sizeof(int));
+        memmove(g->degree + id, g->degree + id + 1, tail * sizeof(int));
+        memmove(g->seen + id, g->seen + id + 1, tail * sizeof(unsigned int));
+    }
+    g->count--;
+}
+
+void nsw_query_begin(NswGraph *g, int ef) {
+    if (++g->stamp == 0) {
+        memset(g->seen, 0, g->capacity * sizeof(unsigned int));
+        g->stamp = 1;
+    }
+    g->ef = (ef > 0) ? ef : 1;
+    g->ncand = 0;
+    g->nbest = 0;
+    g->npending = 0;
+}
+
+// Queue the unseen neighbours of id for measurement
+static void queue_neighbours(NswGraph *g, int id) {
+    const int *row = g->links + (size_t)id * g->max_degree;
+    for (int i = g->degree[id] - 1; i >= 0; i--) {
+        if (g->seen[row[i]] != g->stamp) {
+            g->seen[row[i]] = g->stamp;
+            g->pending[g->npending++] = row[i];
+        }
+    }
+}
+
+void nsw_report(NswGraph *g, int id, double d) {
+    if (id < 0 || id >= g->count) return;
+    g->seen[id] = g->stamp;
+    if (d < 0.0) {
+        // Unknown: route through it to its neighbours
+        queue_neighbours(g, id);
+        return;
+    }
+    NswEntry e = { d, id };
+    if (g->nbest < g->ef || d < g->best[0].d) {
+        heap_push(g->cand, &g->ncand, e, 1);
+        heap_push(g->best, &g->nbest, e, -1);
+        if (g->nbest > g->ef) heap_pop(g->best, &g->nbest, -1);
+    }
+}
+
+int nsw_next(NswGraph *g) {
+    for (;;) {
+        if (g->npending > 0) return g->pending[--g->npending];
+        if (g->ncand == 0) return -1;
+        NswEntry c = heap_pop(g->cand, &g->ncand, 1);
+        // Nearest unexpanded anchor farther than the whole beam: converged
+        if (g->nbest >= g->ef && c.d > g->best[0].d) return -1;
+        queue_neighbours(g, c.id);
+    }
+}
+
+void nsw_free(NswGraph *g) {
+    free(g->links);
+    free(g->degree);
+    free(g->seen);
+    free(g->cand);
+    free(g->best);
+    free(g->pending);
+    free(g->scratch);
+    memset(g, 0, sizeof(NswGraph));
+}
@@ -0,0 +1,64 @@
+#ifndef NSW_GRAPH_H
+#define NSW_GRAPH_H
+
+// Navigable small-world graph over cluster indices 0..n-1 (single-layer
+// HNSW). Each anchor links to up to NSW_M diverse near neighbours, picked
+// with the HNSW heuristic from anchor-to-anchor distances given by a
+// callback; links are made both ways, up to 2 * NSW_M per anchor. Anchors
+// inserted early keep the long links that make greedy routing work.
+//
+// Queries are beam searches of width ef driven by the caller:
+// nsw_next() returns the next anchor to measure and nsw_report() feeds the
+// measured distance back. The search is approximate: it can miss an anchor
+// within range.
+
+#define NSW_M 16
+
+typedef double (*NswDistFn)(void *ctx, int a, int b);
+
+typedef struct {
+    double d;
+    int id;
+} NswEntry;
+
+typedef struct {
+    int count;
+    int capacity;
+    int max_degree;     // 2 * NSW_M
+    int *links;         // capacity rows of max_degree
+    int *degree;
+    unsigned int *seen; // Query stamp per anchor
+    unsigned int stamp;
+    int ef;
+    NswEntry *cand;     // Min-heap: measured anchors not expanded yet
+    int ncand;
+    NswEntry *best;     // Max-heap: the ef nearest measured anchors
+    int nbest;
+    int *pending;       // Anchors queued for measurement (seen when queued)
+    int npending;
+    NswEntry *scratch;  // Insertion workspace
+} NswGraph;
+
+// Allocate for up to capacity anchors. Returns 0 on success.
+int nsw_init(NswGraph *g, int capacity);
+
+// Link anchor id (== g->count) into the graph
+void nsw_insert(NswGraph *g, int id, NswDistFn dist, void *ctx);
+
+// Remove anchor id; ids above it shift down by one
+void nsw_remove(NswGraph *g, int id);
+
+// Start a query with beam width ef
+void nsw_query_begin(NswGraph *g, int ef);
+
+// Distance from the query to anchor id. Any anchor can be reported, e.g.
+// entry points. d < 0: unknown, the search routes through id to its
+// neighbours.
+void nsw_report(NswGraph *g, int id, double d);
+
+// Next anchor to measure, or -1 when the beam cannot improve any more
+int nsw_next(NswGraph *g);
+
+void nsw_free(NswGraph *g);
+
+#endif // NSW_GRAPH_H
@@ -0,0 +1,306 @@
+#include "pca_basis.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pixels converted to double per pass over the training frames
+#define PCA_CHUNK 2048
+#define PCA_MAX_TRAIN 256
+#define PCA_JACOBI_SWEEPS 64
+// Components with variance below this fraction of the first are dropped
+#define PCA_MIN_VAR 1e-12
+// Rounding margins: coefficients are trusted to PCA_TOL * ||x - mean||;
+// residual norms, computed as sqrt(||x - mean||^2 - ||c||^2), to
+// sqrt(PCA_RES_EPS) * ||x - mean||.
+#define PCA_TOL 1e-8
+#define PCA_RES_EPS 1e-11
+
+int pca_basis_init(PcaBasis *p, int k, long ntrain, long nelem, FrameDType dtype) {
+    memset(p, 0, sizeof(PcaBasis));
+    if (k <= 0 || nelem <= 0) return -1;
+    if (ntrain > PCA_MAX_TRAIN) ntrain = PCA_MAX_TRAIN;
+    // Centering removes one dimension from the training set
+    if (ntrain < k + 1) ntrain = k + 1;
+
+    p->k = k;
+    p->nelem = nelem;
+    p->dtype = dtype;
+    p->ntrain = ntrain;
+    p->train = (unsigned char *)malloc((size_t)ntrain * nelem * frame_dtype_size(dtype));
+    if (!p->train) {
+        perror("Memory allocation failed for PCA training frames");
+        return -1;
+    }
+    return 0;
+}
+
+// out[i] = pixel p0 + i of a raw frame, minus the mean once it is known
+static void load_chunk(const PcaBasis *p, const void *data, long p0, long n, double *out) {
+    switch (p->dtype) {
+        case FRAME_DTYPE_UINT8:  for (long i = 0; i < n; i++) out[i] = ((const uint8_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_UINT16: for (long i = 0; i < n; i++) out[i] = ((const uint16_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_INT16:  for (long i = 0; i < n; i++) out[i] = ((const int16_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_FLOAT:  for (long i = 0; i < n; i++) out[i] = ((const float *)data)[p0 + i]; break;
+        default:                 memcpy(out, (const double *)data + p0, n * sizeof(double)); break;
+    }
+    if (p->mean) {
+        for (long i = 0; i < n; i++) out[i] -= p->mean[p0 + i];
+    }
+}
+
+// Dot product with four partial sums (lets the compiler vectorize it)
+static double dot_chunk(const double *a, const double *b, long n) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static const void *train_frame(const PcaBasis *p, long i) {
+    return p->train + (size_t)i * p->nelem * frame_dtype_size(p->dtype);
+}
+
+// Cyclic Jacobi eigen-decomposition of the symmetric n x n matrix a
+// (destroyed). Eigenvalues end on the diagonal, eigenvectors in the columns of v.
+static void jacobi_eigen(double *a, double *v, int n) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) v[i * n + j] = (i == j) ? 1.0 : 0.0;
+    }
+    for (int sweep = 0; sweep < PCA_JACOBI_SWEEPS; sweep++) {
+        double off = 0.0, diag = 0.0;
+        for (int i = 0; i < n; i++) {
+            diag += a[i * n + i] * a[i * n + i];
+            for (int j = i + 1; j < n; j++) off += a[i * n + j] * a[i * n + j];
+        }
+        if (off <= 1e-30 * diag) break;
+
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double apq = a[p * n + q];
+                if (apq == 0.0) continue;
+                double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                double t = 1.0 / (fabs(theta) + sqrt(theta * theta + 1.0));
+                if (theta < 0.0) t = -t;
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+                for (int r = 0; r < n; r++) {
+                    double arp = a[r * n + p], arq = a[r * n + q];
+                    a[r * n + p] = c * arp - s * arq;
+                    a[r * n + q] = s * arp + c * arq;
+                }
+                for (int r = 0; r < n; r++) {
+                    double apr = a[p * n + r], aqr = a[q * n + r];
+                    a[p * n + r] = c * apr - s * aqr;
+                    a[q * n + r] = s * apr + c * aqr;
+                }
+                for (int r = 0; r < n; r++) {
+                    double vrp = v[r * n + p], vrq = v[r * n + q];
+                    v[r * n + p] = c * vrp - s * vrq;
+                    v[r * n + q] = s * vrp + c * vrq;
+                }
+            }
+        }
+    }
+}
+
+// Basis from the training frames: eigenvectors of their Gram matrix mapped
+// back to pixel space, then re-orthonormalized in double precision.
+static int pca_basis_compute(PcaBasis *p) {
+    long n = p->ntrain;
+    long nelem = p->nelem;
+    double *chunk = (double *)malloc((size_t)n * PCA_CHUNK * sizeof(double));
+    double *gram = (double *)calloc((size_t)n * n, sizeof(double));
+    double *vec = (double *)malloc((size_t)n * n * sizeof(double));
+    p->mean = (double *)calloc(nelem, sizeof(double));
+    if (!chunk || !gram || !vec || !p->mean) {
+        perror("Memory allocation failed for PCA basis");
+        free(chunk);
+        free(gram);
+        free(vec);
+        return -1;
+    }
+
+    // Mean frame (load_chunk does not center while it is being summed)
+    double *mean = p->mean;
+    p->mean = NULL;
+    for (long i = 0; i < n; i++) {
+        for (long p0 = 0; p0 < nelem; p0 += PCA_CHUNK) {
+            long len = (nelem - p0 < PCA_CHUNK) ? nelem - p0 : PCA_CHUNK;
+            load_chunk(p, train_frame(p, i), p0, len, chunk);
+            for (long x = 0; x < len; x++) mean[p0 + x] += chunk[x];
+        }
+    }
+    for (long x = 0; x < nelem; x++) mean[x] /= (double)n;
+    p->mean = mean;
+
+    // Gram matrix of the centered frames, one pixel chunk at a time
+    for (long p0 = 0; p0 < nelem; p0 += PCA_CHUNK) {
+        long len = (nelem - p0 < PCA_CHUNK) ? nelem - p0 : PCA_CHUNK;
+        for (long i = 0; i < n; i++) load_chunk(p, train_frame(p, i), p0, len, chunk + i * PCA_CHUNK);
+        for (long i = 0; i < n; i++) {
+            const double *xi = chunk + i * PCA_CHUNK;
+            for (long j = 0; j <= i; j++) {
+                gram[i * n + j] += dot_chunk(xi, chunk + j * PCA_CHUNK, len);
+            }
+        }
+    }
+    double total = 0.0;
+    for (long i = 0; i < n; i++) {
+        total += gram[i * n + i];
+        for (long j = 0; j < i; j++) gram[j * n + i] = gram[i * n + j];
+    }
+
+    jacobi_eigen(gram, vec, (int)n);
+
+    // Components by decreasing variance
+    int *order = (int *)malloc(n * sizeof(int));
+    if (!order) {
+        free(chunk);
+        free(gram);
+        free(vec);
+        return -1;
+    }
+    for (long i = 0; i < n; i++) order[i] = (int)i;
+    for (long i = 1; i < n; i++) {
+        int o = order[i];
+        long j = i;
+        while (j > 0 && gram[order[j - 1] * n + order[j - 1]] < gram[o * n + o]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = o;
+    }
+    double lambda0 = gram[order[0] * n + order[0]];
+    int k = 0;
+    while (k < p->k && k < n && lambda0 > 0.0 && gram[order[k] * n + order[k]] > PCA_MIN_VAR * lambda0) k++;
+
+    p->basis = (double *)calloc((size_t)(k > 0 ? k : 1) * nelem, sizeof(double));
+    if (!p->basis) {
+        perror("Memory allocation failed for PCA basis");
+        free(order);
+        free(chunk);
+        free(gram);
+        free(vec);
+        return -1;
+    }
+
+    // u_j = sum_i v_ij (x_i - mean)
+    for (long p0 = 0; p0 < nelem; p0 += PCA_CHUNK) {
+        long len = (nelem - p0 < PCA_CHUNK) ? nelem - p0 : PCA_CHUNK;
+        for (long i = 0; i < n; i++) load_chunk(p, train_frame(p, i), p0, len, chunk + i * PCA_CHUNK);
+        for (int j = 0; j < k; j++) {
+            double *u = p->basis + (size_t)j * nelem + p0;
+            for (long i = 0; i < n; i++) {
+                double w = vec[i * n + order[j]];
+                const double *xi = chunk + i * PCA_CHUNK;
+                for (long x = 0; x < len; x++) u[x] += w * xi[x];
+            }
+        }
+    }
+
+    // Modified Gram-Schmidt, applied twice so the rows are orthonormal to
+    // rounding (the bound relies on it, not on the rows being eigenvectors)
+    double explained = 0.0;
+    int kept = 0;
+    for (int j = 0; j < k; j++) {
+        double *u = p->basis + (size_t)j * nelem;
+        double norm0 = 0.0;
+        for (long x = 0; x < nelem; x++) norm0 += u[x] * u[x];
+        for (int pass = 0; pass < 2; pass++) {
+            for (int m = 0; m < kept; m++) {
+                const double *b = p->basis + (size_t)m * nelem;
+                double dot = 0.0;
+                for (long x = 0; x < nelem; x++) dot += u[x] * b[x];
+                for (long x = 0; x < nelem; x++) u[x] -= dot * b[x];
+            }
+        }
+        double norm = 0.0;
+        for (long x = 0; x < nelem; x++) norm += u[x] * u[x];
+        if (norm <= 1e-20 * norm0 || norm == 0.0) continue;
+        double inv = 1.0 / sqrt(norm);
+        double *dst = p->basis + (size_t)kept * nelem;
+        for (long x = 0; x < nelem; x++) dst[x] = u[x] * inv;
+        explained += gram[order[j] * n + order[j]];
+        kept++;
+    }
+    p->k = kept;
+    p->explained = (total > 0.0) ? explained / total : 0.0;
+
+    free(order);
+    free(chunk);
+    free(gram);
+    free(vec);
+    return 0;
+}
+
+int pca_basis_add(PcaBasis *p, const Frame *f) {
+    if (p->ready || !p->train) return 0;
+    if (f->width * f->height != p->nelem || f->dtype != p->dtype) return 0;
+
+    size_t bytes = (size_t)p->nelem * frame_dtype_size(p->dtype);
+    memcpy(p->train + (size_t)p->nseen * bytes, f->data, bytes);
+    if (++p->nseen < p->ntrain) return 0;
+
+    int rc = pca_basis_compute(p);
+    free(p->train);
+    p->train = NULL;
+    if (rc != 0 || p->k == 0) return 0;
+    p->ready = 1;
+    return 1;
+}
+
+int pca_basis_project(const PcaBasis *p, Frame *f) {
+    pca_basis_drop(f);
+    if (!p->ready || f->width * f->height != p->nelem || f->dtype != p->dtype) return 0;
+
+    double *coef = (double *)calloc(PCA_COEF_LEN(p), sizeof(double));
+    if (!coef) return 0;
+    double chunk[PCA_CHUNK];
+    double norm2 = 0.0;
+    for (long p0 = 0; p0 < p->nelem; p0 += PCA_CHUNK) {
+        long len = (p->nelem - p0 < PCA_CHUNK) ? p->nelem - p0 : PCA_CHUNK;
+        load_chunk(p, f->data, p0, len, chunk);
+        norm2 += dot_chunk(chunk, chunk, len);
+        for (int j = 0; j < p->k; j++) {
+            coef[j] += dot_chunk(p->basis + (size_t)j * p->nelem + p0, chunk, len);
+        }
+    }
+    double c2 = 0.0;
+    for (int j = 0; j < p->k; j++) c2 += coef[j] * coef[j];
+    coef[p->k] = (norm2 > c2) ? sqrt(norm2 - c2) : 0.0;
+    coef[p->k + 1] = sqrt(norm2);
+    f->pca = coef;
+    return 1;
+}
+
+double pca_basis_lower_bound(const PcaBasis *p, const double *ca, const double *cb) {
+    double sum = 0.0;
+    for (int j = 0; j < p->k; j++) {
+        double diff = ca[j] - cb[j];
+        sum += diff * diff;
+    }
+    double dr = fabs(ca[p->k] - cb[p->k]) - sqrt(PCA_RES_EPS) * (ca[p->k + 1] + cb[p->k + 1]);
+    if (dr > 0.0) sum += dr * dr;
+    // The bound is 1-Lipschitz in the coefficient errors
+    double lb = sqrt(sum) - PCA_TOL * (ca[p->k + 1] + cb[p->k + 1]);
+    return (lb > 0.0) ? lb : 0.0;
+}
+
+void pca_basis_drop(Frame *f) {
+    free(f->pca);
+    f->pca = NULL;
+}
+
+void pca_basis_free(PcaBasis *p) {
+    free(p->train);
+    free(p->mean);
+    free(p->basis);
+    memset(p, 0, sizeof(PcaBasis));
+}
@@ -0,0 +1,47 @@
+#ifndef PCA_BASIS_H
+#define PCA_BASIS_H
+
+#include "common.h"
+
+// Orthonormal basis of the top principal components of the first frames.
+// For any orthonormal U, ||U(x - a)|| <= ||x - a||; with the residual norms
+// r = ||(x - mean) - U^T U (x - mean)||, the bound
+//   ||x - a||^2 >= ||c_x - c_a||^2 + (r_x - r_a)^2
+// is exact, so anchors can be rejected in k-D without losing matches.
+typedef struct {
+    int k;                // Components kept (may end below the requested count)
+    long nelem;
+    FrameDType dtype;
+    long ntrain;          // Frames to learn from
+    long nseen;
+    unsigned char *train; // ntrain raw frames, nelem * dtype size each
+    double *mean;         // nelem
+    double *basis;        // k rows of nelem, orthonormal
+    double explained;     // Variance fraction captured by the k components
+    int ready;
+} PcaBasis;
+
+// Coefficient vector layout: k coefficients, residual norm, ||x - mean||
+#define PCA_COEF_LEN(p) ((p)->k + 2)
+
+// Prepare to learn k components from the first ntrain frames of nelem
+// pixels. Returns 0 on success.
+int pca_basis_init(PcaBasis *p, int k, long ntrain, long nelem, FrameDType dtype);
+
+// Add a training frame. Once ntrain frames are in, the basis is computed and
+// the training copies freed. Returns 1 when the basis has just become ready.
+int pca_basis_add(PcaBasis *p, const Frame *f);
+
+// Attach the coefficient vector of f (f->pca, PCA_COEF_LEN doubles).
+// Returns 0 if the basis is not ready or f does not match it.
+int pca_basis_project(const PcaBasis *p, Frame *f);
+
+// Lower bound on the L2 distance between two projected frames
+double pca_basis_lower_bound(const PcaBasis *p, const double *ca, const double *cb);
+
+// Free the coefficient vector of f
+void pca_basis_drop(Frame *f);
+
+void pca_basis_free(PcaBasis *p);
+
+#endif // PCA_BASIS_H
@@ -50,7 +50,7 @@ void write_png_frame(const char *filename, double *data, int width, int height)
     fclose(fp);
 }
 
-double* read_png_frame(const char *filename, int *width, int *height) {
+unsigned char* read_png_frame_u8(const char *filename, int *width, int *height) {
     FILE *fp = fopen(filename, "rb");
     if (!fp) {
         perror("Failed to open PNG input file");
@@ -126,7 +126,7 @@ double* read_png_frame(const char *filename, int *width, int *height) {
 
     png_read_image(png, row_pointers);
 
-    double *data = (double*)malloc((*width) * (*height) * sizeof(double));
+    unsigned char *data = (unsigned char*)malloc((size_t)(*width) * (*height));
     if (!data) {
         for (int y = 0; y < *height; y++) free(row_pointers[y]);
         free(row_pointers);
@@ -136,10 +136,8 @@ double* read_png_frame(const char *filename, int *width, int *height) {
     }
 
     for (int y = 0; y < *height; y++) {
-        for (int x = 0; x < *width; x++) {
-             // Assuming 8-bit gray now
-             data[y * (*width) + x] = (double)row_pointers[y][x];
-        }
+        // Assuming 8-bit gray now
+        memcpy(&data[(size_t)y * (*width)], row_pointers[y], *width);
         free(row_pointers[y]);
     }
     free(row_pointers);
@@ -149,6 +147,19 @@ double* read_png_frame(const char *filename, int *width, int *height) {
 
     return data;
 }
+
+double* read_png_frame(const char *filename, int *width, int *height) {
+    unsigned char *pixels = read_png_frame_u8(filename, width, height);
+    if (!pixels) return NULL;
+
+    long n = (long)(*width) * (*height);
+    double *data = (double*)malloc(n * sizeof(double));
+    if (data) {
+        for (long i = 0; i < n; i++) data[i] = (double)pixels[i];
+    }
+    free(pixels);
+    return data;
+}
 #else
 // stubs if no png support
 void write_png_frame(const char *filename, double *data, int width, int height) {
@@ -158,4 +169,8 @@ double* read_png_frame(const char *filename, int *width, int *height) {
     fprintf(stderr, "PNG support not compiled in.\n");
     return NULL;
 }
+unsigned char* read_png_frame_u8(const char *filename, int *width, int *height) {
+    fprintf(stderr, "PNG support not compiled in.\n");
+    return NULL;
+}
 #endif
\ No newline at end of file
@@ -3,5 +3,7 @@
 
 void write_png_frame(const char *filename, double *data, int width, int height);
 double* read_png_frame(const char *filename, int *width, int *height);
+// 8-bit grayscale pixels, row-major (RGB is converted to gray)
+unsigned char* read_png_frame_u8(const char *filename, int *width, int *height);
 
 #endif // PNG_IO_H
@@ -0,0 +1,274 @@
+#include "pq_codebook.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The gather kernel is only built for x86 with GCC/Clang, as in framedistance.c
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define GRIC_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#define PQ_MAX_TRAIN 4096
+#define PQ_KMEANS_ITERS 8
+// Rounding margin on ||x - q(a)|| + r_a (sums of squares in double precision)
+#define PQ_TOL 1e-8
+// Training frames per centroid: fewer and each frame becomes its own centroid
+#define PQ_FRAMES_PER_CENTROID 4
+
+int pq_codebook_init(PqCodebook *q, int m, long ntrain, long nelem, FrameDType dtype, SimdLevel simd) {
+    memset(q, 0, sizeof(PqCodebook));
+    if (m <= 0 || nelem <= 0) return -1;
+    if (m > nelem) m = (int)nelem;
+    if (ntrain > PQ_MAX_TRAIN) ntrain = PQ_MAX_TRAIN;
+    if (ntrain < 2 * PQ_FRAMES_PER_CENTROID) ntrain = 2 * PQ_FRAMES_PER_CENTROID;
+
+    q->m = m;
+    q->k = (int)(ntrain / PQ_FRAMES_PER_CENTROID);
+    if (q->k > PQ_MAX_CENTROIDS) q->k = PQ_MAX_CENTROIDS;
+    q->nelem = nelem;
+    q->dtype = dtype;
+    q->ntrain = ntrain;
+    q->start = (long *)malloc((m + 1) * sizeof(long));
+    q->train = (unsigned char *)malloc((size_t)ntrain * nelem * frame_dtype_size(dtype));
+    if (!q->start || !q->train) {
+        perror("Memory allocation failed for PQ training frames");
+        pq_codebook_free(q);
+        return -1;
+    }
+    for (int j = 0; j <= m; j++) q->start[j] = (long)j * nelem / m;
+#ifdef GRIC_X86_DISPATCH
+    q->gather = (simd == SIMD_AUTO || simd >= SIMD_AVX2) && framedist_detect_simd() >= SIMD_AVX2;
+#else
+    (void)simd;
+#endif
+    return 0;
+}
+
+// out[i] = pixel p0 + i of a raw frame
+static void load_chunk(FrameDType dtype, const void *data, long p0, long n, double *out) {
+    switch (dtype) {
+        case FRAME_DTYPE_UINT8:  for (long i = 0; i < n; i++) out[i] = ((const uint8_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_UINT16: for (long i = 0; i < n; i++) out[i] = ((const uint16_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_INT16:  for (long i = 0; i < n; i++) out[i] = ((const int16_t *)data)[p0 + i]; break;
+        case FRAME_DTYPE_FLOAT:  for (long i = 0; i < n; i++) out[i] = ((const float *)data)[p0 + i]; break;
+        default:                 memcpy(out, (const double *)data + p0, n * sizeof(double)); break;
+    }
+}
+
+// Squared distance with four partial sums (lets the compiler vectorize it)
+static double sqdist_chunk(const double *a, const double *b, long n) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    long i = 0;
+    for (; i + 4 <= n; i += 4) {
+        double d0 = a[i] - b[i], d1 = a[i + 1] - b[i + 1];
+        double d2 = a[i + 2] - b[i + 2], d3 = a[i + 3] - b[i + 3];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    for (; i < n; i++) {
+        double d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Nearest of the k centroids of one sub-vector (len values each)
+static int nearest_centroid(const double *cent, int k, const double *x, long len, double *d2) {
+    int best = 0;
+    double best_d = sqdist_chunk(cent, x, len);
+    for (int c = 1; c < k; c++) {
+        double d = sqdist_chunk(cent + (size_t)c * len, x, len);
+        if (d < best_d) {
+            best_d = d;
+            best = c;
+        }
+    }
+    if (d2) *d2 = best_d;
+    return best;
+}
+
+// Lloyd iterations on the training sub-vectors x (n rows of len), seeded
+// with evenly spaced rows. Empty clusters keep their previous centroid.
+static int kmeans(const double *x, long n, long len, int k, double *cent) {
+    double *sum = (double *)malloc((size_t)k * len * sizeof(double));
+    long *count = (long *)malloc(k * sizeof(long));
+    int *assign = (int *)malloc(n * sizeof(int));
+    if (!sum || !count || !assign) {
+        free(sum);
+        free(count);
+        free(assign);
+        return -1;
+    }
+    for (int c = 0; c < k; c++) memcpy(cent + (size_t)c * len, x + (size_t)(c * n / k) * len, len * sizeof(double));
+    for (long i = 0; i < n; i++) assign[i] = -1;
+
+    for (int iter = 0; iter < PQ_KMEANS_ITERS; iter++) {
+        int changed = 0;
+        for (long i = 0; i < n; i++) {
+            int c = nearest_centroid(cent, k, x + (size_t)i * len, len, NULL);
+            if (c != assign[i]) {
+                assign[i] = c;
+                changed = 1;
+            }
+        }
+        if (!changed) break;
+        memset(sum, 0, (size_t)k * len * sizeof(double));
+        memset(count, 0, k * sizeof(long));
+        for (long i = 0; i < n; i++) {
+            double *s = sum + (size_t)assign[i] * len;
+            const double *xi = x + (size_t)i * len;
+            for (long v = 0; v < len; v++) s[v] += xi[v];
+            count[assign[i]]++;
+        }
+        for (int c = 0; c < k; c++) {
+            if (count[c] == 0) continue;
+            double inv = 1.0 / (double)count[c];
+            for (long v = 0; v < len; v++) cent[(size_t)c * len + v] = sum[(size_t)c * len + v] * inv;
+        }
+    }
+    free(sum);
+    free(count);
+    free(assign);
+    return 0;
+}
+
+static long max_sub_len(const PqCodebook *q) {
+    long maxlen = 0;
+    for (int j = 0; j < q->m; j++) {
+        if (q->start[j + 1] - q->start[j] > maxlen) maxlen = q->start[j + 1] - q->start[j];
+    }
+    return maxlen;
+}
+
+// Centroids from the training frames, one sub-vector at a time
+static int pq_codebook_compute(PqCodebook *q) {
+    long n = q->ntrain;
+    double *x = (double *)malloc((size_t)n * max_sub_len(q) * sizeof(double));
+    q->centroids = (double *)malloc((size_t)q->k * q->nelem * sizeof(double));
+    if (!x || !q->centroids) {
+        perror("Memory allocation failed for PQ codebook");
+        free(x);
+        return -1;
+    }
+    size_t bytes = (size_t)q->nelem * frame_dtype_size(q->dtype);
+    for (int j = 0; j < q->m; j++) {
+        long len = q->start[j + 1] - q->start[j];
+        for (long i = 0; i < n; i++) load_chunk(q->dtype, q->train + i * bytes, q->start[j], len, x + (size_t)i * len);
+        if (kmeans(x, n, len, q->k, q->centroids + (size_t)q->k * q->start[j]) != 0) {
+            perror("Memory allocation failed for PQ codebook");
+            free(x);
+            return -1;
+        }
+    }
+    free(x);
+    return 0;
+}
+
+int pq_codebook_add(PqCodebook *q, const Frame *f) {
+    if (q->ready || !q->train) return 0;
+    if (f->width * f->height != q->nelem || f->dtype != q->dtype) return 0;
+
+    size_t bytes = (size_t)q->nelem * frame_dtype_size(q->dtype);
+    memcpy(q->train + (size_t)q->nseen * bytes, f->data, bytes);
+    if (++q->nseen < q->ntrain) return 0;
+
+    int rc = pq_codebook_compute(q);
+    free(q->train);
+    q->train = NULL;
+    if (rc != 0) return 0;
+    q->ready = 1;
+    return 1;
+}
+
+int pq_codebook_encode(const PqCodebook *q, const Frame *f, unsigned char *code, double *resid) {
+    if (!q->ready || f->width * f->height != q->nelem || f->dtype != q->dtype) return 0;
+    double *x = (double *)malloc(max_sub_len(q) * sizeof(double));
+    if (!x) return 0;
+    double r2 = 0.0;
+    for (int j = 0; j < q->m; j++) {
+        long len = q->start[j + 1] - q->start[j];
+        double d2;
+        load_chunk(q->dtype, f->data, q->start[j], len, x);
+        code[j] = (unsigned char)nearest_centroid(q->centroids + (size_t)q->k * q->start[j], q->k, x, len, &d2);
+        r2 += d2;
+    }
+    free(x);
+    *resid = sqrt(r2);
+    return 1;
+}
+
+int pq_codebook_table(const PqCodebook *q, const Frame *f, double *table) {
+    if (!q->ready || f->width * f->height != q->nelem || f->dtype != q->dtype) return 0;
+    double *x = (double *)malloc(max_sub_len(q) * sizeof(double));
+    if (!x) return 0;
+    for (int j = 0; j < q->m; j++) {
+        long len = q->start[j + 1] - q->start[j];
+        const double *cent = q->centroids + (size_t)q->k * q->start[j];
+        load_chunk(q->dtype, f->data, q->start[j], len, x);
+        for (int c = 0; c < q->k; c++) table[(size_t)j * q->k + c] = sqdist_chunk(cent + (size_t)c * len, x, len);
+    }
+    free(x);
+    return 1;
+}
+
+static void scan_scalar(const double *table, int m, int k, const unsigned char *codes, int n, double *out) {
+    for (int i = 0; i < n; i++) {
+        const unsigned char *code = codes + (size_t)i * m;
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        int j = 0;
+        for (; j + 4 <= m; j += 4) {
+            s0 += table[(size_t)j * k + code[j]];
+            s1 += table[(size_t)(j + 1) * k + code[j + 1]];
+            s2 += table[(size_t)(j + 2) * k + code[j + 2]];
+            s3 += table[(size_t)(j + 3) * k + code[j + 3]];
+        }
+        for (; j < m; j++) s0 += table[(size_t)j * k + code[j]];
+        out[i] = (s0 + s1) + (s2 + s3);
+    }
+}
+
+#ifdef GRIC_X86_DISPATCH
+// Four anchors per step: lane a gathers table[j * k + code_a[j]]
+__attribute__((target("avx2")))
+static void scan_avx2(const double *table, int m, int k, const unsigned char *codes, int n, double *out) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const unsigned char *c0 = codes + (size_t)i * m;
+        __m256d acc = _mm256_setzero_pd();
+        for (int j = 0; j < m; j++) {
+            __m128i idx = _mm_setr_epi32(j * k + c0[j], j * k + c0[m + j], j * k + c0[2 * m + j], j * k + c0[3 * m + j]);
+            acc = _mm256_add_pd(acc, _mm256_i32gather_pd(table, idx, 8));
+        }
+        _mm256_storeu_pd(out + i, acc);
+    }
+    if (i < n) scan_scalar(table, m, k, codes + (size_t)i * m, n - i, out + i);
+}
+#endif
+
+void pq_codebook_scan(const PqCodebook *q, const double *table, const unsigned char *codes, int n, double *out) {
+#ifdef GRIC_X86_DISPATCH
+    // 32-bit gather offsets
+    if (q->gather && (long)q->m * q->k < 0x7fffffffL) {
+        scan_avx2(table, q->m, q->k, codes, n, out);
+        return;
+    }
+#endif
+    scan_scalar(table, q->m, q->k, codes, n, out);
+}
+
+double pq_codebook_lower_bound(double adc, double resid) {
+    double est = sqrt(adc > 0.0 ? adc : 0.0);
+    double lb = est - resid - PQ_TOL * (est + resid);
+    return (lb > 0.0) ? lb : 0.0;
+}
+
+void pq_codebook_free(PqCodebook *q) {
+    free(q->train);
+    free(q->start);
+    free(q->centroids);
+    memset(q, 0, sizeof(PqCodebook));
+}
@@ -0,0 +1,56 @@
+#ifndef PQ_CODEBOOK_H
+#define PQ_CODEBOOK_H
+
+#include "common.h"
+#include "framedistance.h"
+
+// Product quantizer learned from the first frames. Frames are cut into m
+// contiguous sub-vectors, each coded as the nearest of up to 256 centroids
+// (k-means per sub-vector). The distance from a frame x to a decoded anchor
+// q(a) is a sum of m lookups in a per-frame table (asymmetric distance
+// computation). With the exact residual r_a = ||a - q(a)|| kept per anchor,
+//   ||x - q(a)|| - r_a <= ||x - a|| <= ||x - q(a)|| + r_a
+// so the lookups give exact bounds for the L2 metric.
+
+#define PQ_MAX_CENTROIDS 256
+
+typedef struct {
+    int m;                // Sub-vectors
+    int k;                // Centroids per sub-vector
+    long nelem;
+    FrameDType dtype;
+    long ntrain;          // Frames to learn from
+    long nseen;
+    unsigned char *train; // ntrain raw frames, nelem * dtype size each
+    long *start;          // m + 1 sub-vector boundaries
+    double *centroids;    // Sub-vector j: k rows of its length, from k * start[j]
+    int gather;           // AVX2 gather kernel for pq_codebook_scan
+    int ready;
+} PqCodebook;
+
+// Prepare to learn m sub-quantizers from the first ntrain frames of nelem
+// pixels. simd caps the scan kernel. Returns 0 on success.
+int pq_codebook_init(PqCodebook *q, int m, long ntrain, long nelem, FrameDType dtype, SimdLevel simd);
+
+// Add a training frame. Once ntrain frames are in, the centroids are
+// computed and the training copies freed. Returns 1 when the codebook has
+// just become ready.
+int pq_codebook_add(PqCodebook *q, const Frame *f);
+
+// Code f into code[0..m-1]; *resid receives ||f - q(f)||. Returns 0 if the
+// codebook is not ready or f does not match it.
+int pq_codebook_encode(const PqCodebook *q, const Frame *f, unsigned char *code, double *resid);
+
+// Squared distances from the sub-vectors of f to every centroid: table[j * k + c]
+int pq_codebook_table(const PqCodebook *q, const Frame *f, double *table);
+
+// out[i] = ||x - q(a_i)||^2 for the n codes stored m bytes apart, x being the
+// frame the table was built for
+void pq_codebook_scan(const PqCodebook *q, const double *table, const unsigned char *codes, int n, double *out);
+
+// Lower bound on ||x - a|| from adc = ||x - q(a)||^2 and the anchor residual
+double pq_codebook_lower_bound(double adc, double resid);
+
+void pq_codebook_free(PqCodebook *q);
+
+#endif // PQ_CODEBOOK_H
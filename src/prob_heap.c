@@ -0,0 +1,143 @@
+#include "prob_heap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int prob_heap_init(ProbHeap *h, int capacity) {
+    memset(h, 0, sizeof(ProbHeap));
+    if (capacity <= 0) return -1;
+    h->key = (double *)malloc(capacity * sizeof(double));
+    h->heap = (int *)malloc(capacity * sizeof(int));
+    h->pos = (int *)malloc(capacity * sizeof(int));
+    h->frontier = (int *)malloc(capacity * sizeof(int));
+    if (!h->key || !h->heap || !h->pos || !h->frontier) {
+        perror("Memory allocation failed for probability heap");
+        prob_heap_free(h);
+        return -1;
+    }
+    h->capacity = capacity;
+    return 0;
+}
+
+// Cluster a goes before cluster b
+static int before(const ProbHeap *h, int a, int b) {
+    if (h->key[a] != h->key[b]) return h->key[a] > h->key[b];
+    return a < b;
+}
+
+static void place(ProbHeap *h, int i, int id) {
+    h->heap[i] = id;
+    h->pos[id] = i;
+}
+
+static void sift_up(ProbHeap *h, int i) {
+    int id = h->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!before(h, id, h->heap[parent])) break;
+        place(h, i, h->heap[parent]);
+        i = parent;
+    }
+    place(h, i, id);
+}
+
+static void sift_down(ProbHeap *h, int i) {
+    int id = h->heap[i];
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= h->count) break;
+        if (c + 1 < h->count && before(h, h->heap[c + 1], h->heap[c])) c++;
+        if (!before(h, h->heap[c], id)) break;
+        place(h, i, h->heap[c]);
+        i = c;
+    }
+    place(h, i, id);
+}
+
+static void rebuild(ProbHeap *h) {
+    for (int i = h->count / 2 - 1; i >= 0; i--) sift_down(h, i);
+}
+
+void prob_heap_insert(ProbHeap *h, int id, double key) {
+    if (id != h->count || id >= h->capacity) return;
+    h->key[id] = key;
+    place(h, h->count++, id);
+    sift_up(h, id);
+}
+
+void prob_heap_update(ProbHeap *h, int id, double key) {
+    if (id < 0 || id >= h->count) return;
+    double old = h->key[id];
+    h->key[id] = key;
+    if (key > old) sift_up(h, h->pos[id]);
+    else sift_down(h, h->pos[id]);
+}
+
+void prob_heap_scale(ProbHeap *h, double factor) {
+    for (int i = 0; i < h->count; i++) h->key[i] *= factor;
+    // Rounding can turn close keys into ties that the index order breaks
+    rebuild(h);
+}
+
+void prob_heap_remove(ProbHeap *h, int id) {
+    if (id < 0 || id >= h->count) return;
+    int tail = h->count - id - 1;
+    if (tail > 0) memmove(h->key + id, h->key + id + 1, tail * sizeof(double));
+    h->count--;
+    for (int i = 0; i < h->count; i++) place(h, i, i);
+    rebuild(h);
+}
+
+// Frontier entries are heap positions; the heap order of their clusters
+// orders them
+static int frontier_before(const ProbHeap *h, int pa, int pb) {
+    return before(h, h->heap[pa], h->heap[pb]);
+}
+
+static void frontier_push(ProbHeap *h, int p) {
+    int i = h->nfrontier++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!frontier_before(h, p, h->frontier[parent])) break;
+        h->frontier[i] = h->frontier[parent];
+        i = parent;
+    }
+    h->frontier[i] = p;
+}
+
+static int frontier_pop(ProbHeap *h) {
+    int top = h->frontier[0];
+    int p = h->frontier[--h->nfrontier];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= h->nfrontier) break;
+        if (c + 1 < h->nfrontier && frontier_before(h, h->frontier[c + 1], h->frontier[c])) c++;
+        if (!frontier_before(h, h->frontier[c], p)) break;
+        h->frontier[i] = h->frontier[c];
+        i = c;
+    }
+    if (h->nfrontier > 0) h->frontier[i] = p;
+    return top;
+}
+
+void prob_heap_walk_begin(ProbHeap *h) {
+    h->nfrontier = 0;
+    if (h->count > 0) frontier_push(h, 0);
+}
+
+int prob_heap_walk_next(ProbHeap *h) {
+    if (h->nfrontier == 0) return -1;
+    int p = frontier_pop(h);
+    if (2 * p + 1 < h->count) frontier_push(h, 2 * p + 1);
+    if (2 * p + 2 < h->count) frontier_push(h, 2 * p + 2);
+    return h->heap[p];
+}
+
+void prob_heap_free(ProbHeap *h) {
+    free(h->key);
+    free(h->heap);
+    free(h->pos);
+    free(h->frontier);
+    memset(h, 0, sizeof(ProbHeap));
+}
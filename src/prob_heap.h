@@ -0,0 +1,44 @@
+#ifndef PROB_HEAP_H
+#define PROB_HEAP_H
+
+// Indexed max-heap over cluster indices 0..n-1, keyed by a weight (ties: lower
+// index first). A key change costs O(log n).
+//
+// The heap is read in order without being modified: prob_heap_walk_next()
+// pops the best entry of a small frontier of heap nodes and pushes its two
+// children, so the first m clusters in order cost O(m log m).
+
+typedef struct {
+    int count;
+    int capacity;
+    double *key;   // Per cluster
+    int *heap;     // Clusters, heap-ordered
+    int *pos;      // Position of each cluster in heap
+    int *frontier; // Walk: heap positions, heap-ordered
+    int nfrontier;
+} ProbHeap;
+
+// Allocate for up to capacity clusters. Returns 0 on success.
+int prob_heap_init(ProbHeap *h, int capacity);
+
+// Add cluster id (== h->count)
+void prob_heap_insert(ProbHeap *h, int id, double key);
+
+// Change the key of cluster id
+void prob_heap_update(ProbHeap *h, int id, double key);
+
+// Multiply every key by factor (> 0)
+void prob_heap_scale(ProbHeap *h, double factor);
+
+// Remove cluster id; ids above it shift down by one
+void prob_heap_remove(ProbHeap *h, int id);
+
+// Restart the ordered walk
+void prob_heap_walk_begin(ProbHeap *h);
+
+// Next cluster by decreasing key, or -1 when all have been returned
+int prob_heap_walk_next(ProbHeap *h);
+
+void prob_heap_free(ProbHeap *h);
+
+#endif // PROB_HEAP_H
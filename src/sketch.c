@@ -0,0 +1,122 @@
+#include "sketch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Nonzeros per pixel column, and the fixed seed of the projection. One
+// nonzero (CountSketch) already gives the Gaussian JL variance for dense
+// frames; each extra one costs a full scattered pass over the pixels.
+#define SKETCH_NNZ 1
+#define SKETCH_SEED 0x5EED5EEDULL
+
+static int sk_dim = 0;
+static long sk_nelem = 0;
+static uint32_t *sk_target = NULL; // nelem * SKETCH_NNZ: row << 1 | sign
+static double sk_scale = 0.0;
+
+// splitmix64: small, well-mixed and reproducible across platforms
+static uint64_t sketch_hash(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+int sketch_setup(int m, long nelem) {
+    sketch_free();
+    if (m <= 0 || nelem <= 0) return 0;
+
+    sk_target = (uint32_t *)malloc((size_t)nelem * SKETCH_NNZ * sizeof(uint32_t));
+    if (!sk_target) {
+        perror("Memory allocation failed for sketch projection");
+        return -1;
+    }
+    for (long i = 0; i < nelem; i++) {
+        for (int t = 0; t < SKETCH_NNZ; t++) {
+            uint64_t h = sketch_hash(SKETCH_SEED ^ ((uint64_t)i * SKETCH_NNZ + t));
+            sk_target[i * SKETCH_NNZ + t] = (uint32_t)((h >> 1) % (uint64_t)m) << 1 | (uint32_t)(h & 1);
+        }
+    }
+    sk_dim = m;
+    sk_nelem = nelem;
+    sk_scale = 1.0 / sqrt((double)SKETCH_NNZ);
+    return 0;
+}
+
+int sketch_dim(void) {
+    return sk_dim;
+}
+
+// Branchless sign: a data-dependent branch here costs more than the add
+#define SKETCH_ADD(i, v) do { \
+    const uint32_t *tg = sk_target + (i) * SKETCH_NNZ; \
+    for (int t = 0; t < SKETCH_NNZ; t++) out[tg[t] >> 1] += (v) * (double)(1 - 2 * (int)(tg[t] & 1)); \
+} while (0)
+
+#define SKETCH_ACCUMULATE(T) do { \
+    const T *p = (const T *)f->data; \
+    for (long i = 0; i < sk_nelem; i++) SKETCH_ADD(i, (double)p[i]); \
+} while (0)
+
+int sketch_frame(Frame *f) {
+    sketch_drop(f);
+    if (sk_dim == 0 || f->width * f->height != sk_nelem) return 0;
+
+    double *out = (double *)calloc(sk_dim, sizeof(double));
+    if (!out) return 0;
+    if (f->nnz >= 0) {
+        for (long k = 0; k < f->nnz; k++) SKETCH_ADD((long)f->sp_idx[k], f->sp_val[k]);
+    } else switch (f->dtype) {
+        case FRAME_DTYPE_UINT8:  SKETCH_ACCUMULATE(uint8_t); break;
+        case FRAME_DTYPE_UINT16: SKETCH_ACCUMULATE(uint16_t); break;
+        case FRAME_DTYPE_INT16:  SKETCH_ACCUMULATE(int16_t); break;
+        case FRAME_DTYPE_FLOAT:  SKETCH_ACCUMULATE(float); break;
+        default:                 SKETCH_ACCUMULATE(double); break;
+    }
+    for (int j = 0; j < sk_dim; j++) out[j] *= sk_scale;
+    f->sketch = out;
+    return 1;
+}
+
+void sketch_drop(Frame *f) {
+    free(f->sketch);
+    f->sketch = NULL;
+}
+
+double sketch_dist(const Frame *a, const Frame *b) {
+    double sum = 0.0;
+    for (int j = 0; j < sk_dim; j++) {
+        double diff = a->sketch[j] - b->sketch[j];
+        sum += diff * diff;
+    }
+    return sqrt(sum);
+}
+
+// Standard normal quantile, by bisection on erfc
+static double normal_quantile(double p) {
+    double lo = -10.0, hi = 10.0;
+    for (int it = 0; it < 80; it++) {
+        double mid = 0.5 * (lo + hi);
+        if (0.5 * erfc(-mid / sqrt(2.0)) < p) lo = mid;
+        else hi = mid;
+    }
+    return 0.5 * (lo + hi);
+}
+
+double sketch_reject_radius(double rlim, double confidence) {
+    if (sk_dim == 0 || confidence >= 1.0) return -1.0;
+    // |S x|^2 / |x|^2 ~ chi2(m) / m; Wilson-Hilferty quantile
+    double m = (double)sk_dim;
+    double z = normal_quantile(confidence);
+    double c = 1.0 - 2.0 / (9.0 * m) + z * sqrt(2.0 / (9.0 * m));
+    double q = c * c * c;
+    return rlim * sqrt(q);
+}
+
+void sketch_free(void) {
+    free(sk_target);
+    sk_target = NULL;
+    sk_dim = 0;
+    sk_nelem = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include "common.h"
+
+// Sparse Johnson-Lindenstrauss sketches. Each pixel adds +-x/sqrt(s) to s of
+// the m sketch coordinates (s = 1: CountSketch), picked by a fixed seeded
+// hash, so that E[|S(a - b)|^2] = |a - b|^2. Sketch distances are only
+// estimates: they order and reject candidates, exact distances still decide
+// assignments.
+
+// Build the projection for nelem-pixel frames. m <= 0 disables sketches.
+// Returns 0 on success.
+int sketch_setup(int m, long nelem);
+
+// Sketch size (0 when disabled)
+int sketch_dim(void);
+
+// Attach the sketch of f (f->sketch, m doubles). Returns 1 on success.
+int sketch_frame(Frame *f);
+
+// Free the sketch of f
+void sketch_drop(Frame *f);
+
+// Sketch distance between two sketched frames
+double sketch_dist(const Frame *a, const Frame *b);
+
+// Sketch distance above which a true distance below rlim has probability
+// under 1 - confidence (chi-square tail of the Gaussian JL estimate).
+// confidence >= 1 never rejects (returns -1).
+double sketch_reject_radius(double rlim, double confidence);
+
+void sketch_free(void);
+
+#endif // SKETCH_H
@@ -0,0 +1,64 @@
+#include "tournament_tree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int tournament_init(TournamentTree *t, int capacity) {
+    memset(t, 0, sizeof(TournamentTree));
+    if (capacity <= 0) return -1;
+    int size = 1;
+    while (size < capacity) size *= 2;
+    t->score = (double *)malloc(capacity * sizeof(double));
+    t->win = (int *)malloc(2 * (size_t)size * sizeof(int));
+    if (!t->score || !t->win) {
+        perror("Memory allocation failed for tournament tree");
+        tournament_free(t);
+        return -1;
+    }
+    t->capacity = capacity;
+    return 0;
+}
+
+static int winner(const TournamentTree *t, int a, int b) {
+    if (a < 0) return b;
+    if (b < 0) return a;
+    if (t->score[a] > t->score[b]) return a;
+    if (t->score[b] > t->score[a]) return b;
+    return (a < b) ? a : b;
+}
+
+// Replay the matches from leaf i up to the root
+static void replay(TournamentTree *t, int i) {
+    for (int p = (t->size + i) / 2; p >= 1; p /= 2) t->win[p] = winner(t, t->win[2 * p], t->win[2 * p + 1]);
+}
+
+void tournament_build(TournamentTree *t, int n, const double *score) {
+    if (n > t->capacity) n = t->capacity;
+    if (n < 0) n = 0;
+    int size = 1;
+    while (size < n) size *= 2;
+    t->size = size;
+    t->n = n;
+    memcpy(t->score, score, n * sizeof(double));
+    for (int i = 0; i < size; i++) t->win[size + i] = (i < n) ? i : -1;
+    // With a single leaf, the leaf is the root
+    for (int p = size - 1; p >= 1; p--) t->win[p] = winner(t, t->win[2 * p], t->win[2 * p + 1]);
+}
+
+void tournament_set(TournamentTree *t, int i, double score) {
+    if (i < 0 || i >= t->n) return;
+    t->score[i] = score;
+    if (t->win[t->size + i] >= 0) replay(t, i);
+}
+
+void tournament_remove(TournamentTree *t, int i) {
+    if (i < 0 || i >= t->n) return;
+    t->win[t->size + i] = -1;
+    replay(t, i);
+}
+
+void tournament_free(TournamentTree *t) {
+    free(t->score);
+    free(t->win);
+    memset(t, 0, sizeof(TournamentTree));
+}
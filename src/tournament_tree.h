@@ -0,0 +1,34 @@
+#ifndef TOURNAMENT_TREE_H
+#define TOURNAMENT_TREE_H
+
+// Max tournament tree over scores of entries 0..n-1: each node holds the
+// winner of its two children (higher score; ties: lower index), the root the
+// overall winner. Changing or removing one entry replays its path, O(log n).
+
+typedef struct {
+    int capacity;
+    int size;     // Leaves this build (power of two >= n)
+    int n;
+    double *score;
+    int *win;     // Nodes 1..2 * size - 1; leaves at size + i (-1: empty)
+} TournamentTree;
+
+// Allocate for up to capacity entries. Returns 0 on success.
+int tournament_init(TournamentTree *t, int capacity);
+
+// Entries 0..n-1 with the given scores, O(n)
+void tournament_build(TournamentTree *t, int n, const double *score);
+
+void tournament_set(TournamentTree *t, int i, double score);
+
+// Take entry i out of the competition
+void tournament_remove(TournamentTree *t, int i);
+
+// Entry with the highest score, or -1 when none is left
+static inline int tournament_top(const TournamentTree *t) {
+    return (t->n > 0) ? t->win[1] : -1;
+}
+
+void tournament_free(TournamentTree *t);
+
+#endif // TOURNAMENT_TREE_H
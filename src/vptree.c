@@ -0,0 +1,218 @@
+#include "vptree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Relative slack on the triangle-inequality bounds, for rounding in the
+// stored distances
+#define VP_SLACK 1e-9
+
+typedef struct {
+    int id;
+    double d;
+} VpItem;
+
+static int compare_items(const void *a, const void *b) {
+    double da = ((const VpItem *)a)->d;
+    double db = ((const VpItem *)b)->d;
+    if (da < db) return -1;
+    if (da > db) return 1;
+    return 0;
+}
+
+int vptree_init(VpTree *t, int capacity) {
+    memset(t, 0, sizeof(VpTree));
+    t->root = -1;
+    t->nodes = (VpNode *)malloc(capacity * sizeof(VpNode));
+    t->heap = (VpEntry *)malloc((capacity + 1) * sizeof(VpEntry));
+    t->scratch = malloc(capacity * sizeof(VpItem));
+    if (!t->nodes || !t->heap || !t->scratch) {
+        perror("Memory allocation failed for VP-tree");
+        vptree_free(t);
+        return -1;
+    }
+    t->capacity = capacity;
+    return 0;
+}
+
+static int vptree_new_node(VpTree *t, int id) {
+    VpNode *nd = &t->nodes[t->count];
+    nd->id = id;
+    nd->mu = -1.0;
+    nd->inside = -1;
+    nd->outside = -1;
+    return t->count++;
+}
+
+// Subtree over items[0..n). The vantage is the item farthest from the parent
+// vantage (sorted last by the caller): corner points split better.
+static int vptree_build_rec(VpTree *t, VpItem *items, int n, VpDistFn dist, void *ctx) {
+    if (n <= 0) return -1;
+    VpItem tmp = items[0];
+    items[0] = items[n - 1];
+    items[n - 1] = tmp;
+
+    int node = vptree_new_node(t, items[0].id);
+    if (n == 1) return node;
+
+    VpItem *rest = items + 1;
+    int m = n - 1;
+    for (int i = 0; i < m; i++) rest[i].d = dist(ctx, items[0].id, rest[i].id);
+    qsort(rest, m, sizeof(VpItem), compare_items);
+
+    int h = (m + 1) / 2; // Inside gets the nearest half, ties on either side
+    t->nodes[node].mu = rest[h - 1].d;
+    int inside = vptree_build_rec(t, rest, h, dist, ctx);
+    int outside = vptree_build_rec(t, rest + h, m - h, dist, ctx);
+    t->nodes[node].inside = inside;
+    t->nodes[node].outside = outside;
+    return node;
+}
+
+void vptree_build(VpTree *t, int n, VpDistFn dist, void *ctx) {
+    if (n > t->capacity) n = t->capacity;
+    VpItem *items = (VpItem *)t->scratch;
+    for (int i = 0; i < n; i++) items[i].id = i;
+    t->count = 0;
+    t->root = vptree_build_rec(t, items, n, dist, ctx);
+    t->live = n;
+    t->dead = 0;
+    t->built = n;
+}
+
+int vptree_insert(VpTree *t, int id, VpDistFn dist, void *ctx) {
+    if (t->count >= t->capacity) return -1;
+    t->live++;
+    if (t->root < 0) {
+        t->root = vptree_new_node(t, id);
+        return 0;
+    }
+    int node = t->root;
+    for (;;) {
+        VpNode *nd = &t->nodes[node];
+        if (nd->id < 0) {
+            // Removed vantage: its children carry no split, either one works
+            int child = (nd->inside >= 0) ? nd->inside : nd->outside;
+            if (child < 0) {
+                nd->inside = vptree_new_node(t, id);
+                return 0;
+            }
+            node = child;
+            continue;
+        }
+        double d = dist(ctx, nd->id, id);
+        if (nd->mu < 0.0) nd->mu = d; // First child sets the split
+        int go_inside = d <= nd->mu;
+        int child = go_inside ? nd->inside : nd->outside;
+        if (child < 0) {
+            int leaf = vptree_new_node(t, id);
+            if (go_inside) nd->inside = leaf;
+            else nd->outside = leaf;
+            return 0;
+        }
+        node = child;
+    }
+}
+
+void vptree_remove(VpTree *t, int id) {
+    for (int i = 0; i < t->count; i++) {
+        if (t->nodes[i].id == id) {
+            t->nodes[i].id = -1;
+            t->dead++;
+            t->live--;
+        } else if (t->nodes[i].id > id) {
+            t->nodes[i].id--;
+        }
+    }
+}
+
+static int entry_before(const VpEntry *a, const VpEntry *b) {
+    if (a->lb != b->lb) return a->lb < b->lb;
+    return a->prio > b->prio;
+}
+
+static void heap_push(VpTree *t, VpEntry e) {
+    int i = t->heap_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!entry_before(&e, &t->heap[parent])) break;
+        t->heap[i] = t->heap[parent];
+        i = parent;
+    }
+    t->heap[i] = e;
+}
+
+static VpEntry heap_pop(VpTree *t) {
+    VpEntry top = t->heap[0];
+    VpEntry e = t->heap[--t->heap_count];
+    int i = 0;
+    for (;;) {
+        int c = 2 * i + 1;
+        if (c >= t->heap_count) break;
+        if (c + 1 < t->heap_count && entry_before(&t->heap[c + 1], &t->heap[c])) c++;
+        if (!entry_before(&t->heap[c], &e)) break;
+        t->heap[i] = t->heap[c];
+        i = c;
+    }
+    if (t->heap_count > 0) t->heap[i] = e;
+    return top;
+}
+
+static void vptree_push_child(VpTree *t, int child, double lb, double radius, const double *prio) {
+    if (child < 0 || lb >= radius) return;
+    int id = t->nodes[child].id;
+    VpEntry e = { child, lb, (id >= 0) ? prio[id] : 0.0 };
+    heap_push(t, e);
+}
+
+void vptree_query_begin(VpTree *t, const double *prio) {
+    t->heap_count = 0;
+    t->last.node = -1;
+    vptree_push_child(t, t->root, 0.0, HUGE_VAL, prio);
+    t->prio = prio;
+}
+
+int vptree_next(VpTree *t, double radius, double *lb) {
+    t->last.node = -1;
+    while (t->heap_count > 0 && t->heap[0].lb < radius) {
+        VpEntry e = heap_pop(t);
+        const VpNode *nd = &t->nodes[e.node];
+        if (nd->id < 0) {
+            vptree_push_child(t, nd->inside, e.lb, radius, t->prio);
+            vptree_push_child(t, nd->outside, e.lb, radius, t->prio);
+            continue;
+        }
+        t->last = e;
+        *lb = e.lb;
+        return nd->id;
+    }
+    return -1;
+}
+
+
+void vptree_report(VpTree *t, double d, int exact, double radius) {
+    const double *prio = t->prio;
+    if (t->last.node < 0) return;
+    const VpNode *nd = &t->nodes[t->last.node];
+    double lb = t->last.lb;
+    double lb_in = lb, lb_out = lb;
+    if (nd->mu >= 0.0 && d >= 0.0) {
+        // Triangle inequality: inside d(v,x) <= mu, outside d(v,x) >= mu.
+        // A lower-bound-only d still bounds the inside subtree.
+        double slack = VP_SLACK * (d + nd->mu);
+        if (d - nd->mu - slack > lb_in) lb_in = d - nd->mu - slack;
+        if (exact && nd->mu - d - slack > lb_out) lb_out = nd->mu - d - slack;
+    }
+    vptree_push_child(t, nd->inside, lb_in, radius, prio);
+    vptree_push_child(t, nd->outside, lb_out, radius, prio);
+    t->last.node = -1;
+}
+
+void vptree_free(VpTree *t) {
+    free(t->nodes);
+    free(t->heap);
+    free(t->scratch);
+    memset(t, 0, sizeof(VpTree));
+    t->root = -1;
+}
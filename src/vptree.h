@@ -0,0 +1,73 @@
+#ifndef VPTREE_H
+#define VPTREE_H
+
+// Vantage-point tree over cluster indices 0..n-1. Each node splits its
+// subtree on the distance to its vantage anchor: inside d <= mu, outside
+// d >= mu. Anchor-to-anchor distances come from a callback (the dcc table),
+// so building and inserting cost no new frame distances.
+//
+// Queries are best-first: vptree_next() returns the anchor with the smallest
+// lower bound on its distance to the query (ties: highest prio), and the
+// caller reports the distance it measured so that the node's children get
+// their bounds |d(q,v) - mu|.
+
+typedef double (*VpDistFn)(void *ctx, int a, int b);
+
+typedef struct {
+    int id;       // Vantage anchor (-1: removed, the node only routes)
+    double mu;    // Split radius (< 0: no children yet)
+    int inside;   // Child nodes (-1 = none)
+    int outside;
+} VpNode;
+
+typedef struct {
+    int node;
+    double lb;    // Lower bound on d(query, anything in the subtree)
+    double prio;  // Tie-break, higher first
+} VpEntry;
+
+typedef struct {
+    VpNode *nodes;
+    int count;        // Nodes in use, removed ones included
+    int capacity;
+    int root;
+    int live;         // Anchors in the tree: ids 0..live-1
+    int dead;         // Removed nodes
+    int built;        // live at the last balanced build
+    VpEntry *heap;    // Query frontier, min-heap on (lb, -prio)
+    int heap_count;
+    VpEntry last;     // Entry returned by the last vptree_next()
+    const double *prio;
+    void *scratch;    // Build workspace
+} VpTree;
+
+// Allocate for up to capacity anchors. Returns 0 on success.
+int vptree_init(VpTree *t, int capacity);
+
+// Balanced build over anchors 0..n-1: median split, the vantage of each
+// subset being its anchor farthest from the parent vantage
+void vptree_build(VpTree *t, int n, VpDistFn dist, void *ctx);
+
+// Add anchor id (== live) below the leaf its distances lead to. Returns -1
+// when the node storage is full.
+int vptree_insert(VpTree *t, int id, VpDistFn dist, void *ctx);
+
+// Remove anchor id; ids above it shift down by one. Its node stays as a
+// routing node whose children inherit its bound.
+void vptree_remove(VpTree *t, int id);
+
+// Start a query. prio[id] breaks ties between equal bounds.
+void vptree_query_begin(VpTree *t, const double *prio);
+
+// Next anchor whose bound is below radius, or -1 when none is left.
+// *lb receives its bound.
+int vptree_next(VpTree *t, double radius, double *lb);
+
+// Distance from the query to the anchor just returned. exact = 0 marks d as
+// a lower bound only (early-abandoned). d < 0: unknown, the children inherit
+// the node's bound.
+void vptree_report(VpTree *t, double d, int exact, double radius);
+
+void vptree_free(VpTree *t);
+
+#endif // VPTREE_H